@@ -233,6 +233,7 @@ parse_url_format.udp = function(url, data)
 end
 
 parse_url_format.rtp = parse_url_format.udp
+parse_url_format.rist = parse_url_format.udp
 
 parse_url_format._http = function(url, data)
     local b = url:find("/")
@@ -278,6 +279,12 @@ parse_url_format.https = function(url, data)
     return r
 end
 
+parse_url_format.hls = function(url, data)
+    local r = parse_url_format._http(url, data)
+    if data.port == nil then data.port = 80 end
+    return r
+end
+
 parse_url_format.np = function(url, data)
     local r = parse_url_format._http(url, data)
     if data.port == nil then data.port = 80 end
@@ -503,6 +510,12 @@ init_input_module.udp = function(conf)
             socket_size = conf.socket_size,
             renew = conf.renew,
             rtp = conf.rtp,
+            packets = conf.packets,
+            reorder = conf.reorder,
+            latency = conf.latency,
+            fec = conf.fec,
+            rist = conf.rist,
+            rist_retries = conf.rist_retries,
         })
     end
 
@@ -522,11 +535,46 @@ kill_input_module.udp = function(module, conf)
 end
 
 init_input_module.rtp = function(conf)
+    if conf.merge then
+        local paths = {
+            { addr = conf.addr, port = conf.port, localaddr = conf.localaddr },
+        }
+        for _,url in ipairs(conf.merge:split(",")) do
+            local path = {}
+            if parse_url_format.udp(url, path) ~= true then
+                log.error("[" .. conf.name .. "] wrong merge address: " .. url)
+                astra.abort()
+            end
+            table.insert(paths, path)
+        end
+
+        return rtp_merge({
+            name = conf.name,
+            paths = paths,
+            socket_size = conf.socket_size,
+            renew = conf.renew,
+            packets = conf.packets,
+            reorder = conf.reorder,
+            latency = conf.latency,
+        })
+    end
+
     conf.rtp = true
     return init_input_module.udp(conf)
 end
 
 kill_input_module.rtp = function(module, conf)
+    if conf.merge then return nil end
+    kill_input_module.udp(module, conf)
+end
+
+init_input_module.rist = function(conf)
+    conf.rtp = true
+    conf.rist = true
+    return init_input_module.udp(conf)
+end
+
+kill_input_module.rist = function(module, conf)
     kill_input_module.udp(module, conf)
 end
 
@@ -582,7 +630,7 @@ init_input_module.http = function(conf)
             headers = {
                 "User-Agent: " .. http_user_agent,
                 "Host: " .. conf.host .. ":" .. conf.port,
-                "Connection: close",
+                "Connection: keep-alive",
             }
         }
 
@@ -153,7 +153,6 @@ function on_request_stat(server, client, request)
                 headers = {
                     "WWW-Authenticate: Basic realm=\"Astra Relay\"",
                     "Content-Length: 0",
-                    "Connection: close",
                 }
             })
             return nil
@@ -164,7 +163,6 @@ function on_request_stat(server, client, request)
         code = 200,
         headers = {
             "Content-Type: text/html; charset=utf-8",
-            "Connection: close",
         },
         content = render_stat_html(),
     })
@@ -190,7 +188,6 @@ function on_request_playlist(server, client, request)
                 code = 200,
                 headers = {
                     "Content-Type: " .. content_type,
-                    "Connection: close",
                 },
                 content = content,
             })
@@ -47,6 +47,13 @@ function on_analyze_spts(channel_data, input_id, data)
                 else
                     m = " PES:" .. data.total.pes_errors .. " CC:" .. data.total.cc_errors
                 end
+                local input = input_data.input.input
+                local stat = input.stat and input:stat()
+                if stat and stat.mdi then
+                    m = m .. string.format(" MDI:%.2f:%.2f Jitter:%.2fms Drops:%d",
+                                           stat.mdi.df, stat.mdi.mlr,
+                                           stat.mdi.jitter, stat.mdi.drops)
+                end
                 log.error(analyze_message .. m)
             else
                 log.info(analyze_message)
@@ -283,6 +290,20 @@ init_output_module.udp = function(channel_data, output_id)
         local ifaddr = ifaddr_list[localaddr]
         if ifaddr and ifaddr.ipv4 then localaddr = ifaddr.ipv4[1] end
     end
+    local destinations = nil
+    if output_data.config.fanout then
+        destinations = {
+            { addr = output_data.config.addr, port = output_data.config.port },
+        }
+        for _,url in ipairs(output_data.config.fanout:split(",")) do
+            local dest = {}
+            if parse_url_format.udp(url, dest) ~= true then
+                log.error("[" .. channel_data.config.name .. "] wrong fanout address: " .. url)
+                astra.abort()
+            end
+            table.insert(destinations, { addr = dest.addr, port = dest.port })
+        end
+    end
     output_data.output = udp_output({
         upstream = channel_data.tail:stream(),
         addr = output_data.config.addr,
@@ -290,9 +311,21 @@ init_output_module.udp = function(channel_data, output_id)
         ttl = output_data.config.ttl,
         localaddr = localaddr,
         socket_size = output_data.config.socket_size,
-        rtp = (output_data.config.format == "rtp"),
+        rtp = (output_data.config.format == "rtp"
+               or output_data.config.format == "rist"),
+        packets = output_data.config.packets,
+        max_hold = output_data.config.max_hold,
+        strip_null = output_data.config.strip_null,
         sync = output_data.config.sync,
         sync_opts = output_data.config.sync_opts,
+        fec = output_data.config.fec,
+        fec_1d = output_data.config.fec_1d,
+        txtime = output_data.config.txtime,
+        txtime_horizon = output_data.config.txtime_horizon,
+        txtime_clock = output_data.config.txtime_clock,
+        destinations = destinations,
+        rist = (output_data.config.format == "rist"),
+        rist_buffer = output_data.config.rist_buffer,
     })
 end
 
@@ -309,6 +342,14 @@ kill_output_module.rtp = function(channel_data, output_id)
     kill_output_module.udp(channel_data, output_id)
 end
 
+init_output_module.rist = function(channel_data, output_id)
+    init_output_module.udp(channel_data, output_id)
+end
+
+kill_output_module.rist = function(channel_data, output_id)
+    kill_output_module.udp(channel_data, output_id)
+end
+
 --   ooooooo            ooooooooooo ooooo ooooo       ooooooooooo
 -- o888   888o           888    88   888   888         888    88
 -- 888     888 ooooooooo 888oo8      888   888         888ooo8
@@ -341,6 +382,9 @@ end
 http_output_client_list = {}
 http_output_instance_list = {}
 
+-- fast channel change buffer, Kb. 0 - disabled
+http_output_burst = 4096
+
 function http_output_client(server, client, request)
     local client_data = server:data(client)
 
@@ -412,6 +456,13 @@ function http_output_on_request(server, client, request)
             upstream = channel_data.tail:stream(),
             buffer_size = client_data.output_data.config.buffer_size,
             buffer_fill = client_data.output_data.config.buffer_fill,
+            burst = client_data.output_data.config.burst or http_output_burst,
+            zerocopy = (client_data.output_data.config.zerocopy == true),
+            overflow = client_data.output_data.config.overflow,
+            overflow_limit = tonumber(client_data.output_data.config.overflow_limit),
+            overflow_period = tonumber(client_data.output_data.config.overflow_period),
+            rate_limit = tonumber(client_data.output_data.config.rate_limit),
+            rate_factor = tonumber(client_data.output_data.config.rate_factor),
         })
     end
 
@@ -429,6 +480,7 @@ init_output_module.http = function(channel_data, output_id)
             addr = output_data.config.host,
             port = output_data.config.port,
             sctp = output_data.config.sctp,
+            egress_limit = tonumber(output_data.config.egress_limit),
             route = {
                 { "/*", http_upstream({ callback = http_output_on_request }) },
             },
@@ -474,6 +526,94 @@ kill_output_module.http = function(channel_data, output_id)
     output_data.channel_data = nil
 end
 
+--   ooooooo            ooooo ooooo ooooo        oooooooo8
+-- o888   888o           888   888   888        888
+-- 888     888 ooooooooo 888ooo888   888         888oooooo
+-- 888o   o888           888   888   888      o         888
+--   88ooo88            o888o o888o o888ooooo88 o88oooo888
+
+hls_output_instance_list = {}
+
+function hls_output_on_request(server, client, request)
+    local client_data = server:data(client)
+
+    if not request then
+        if client_data.hls then
+            client_data.hls(server, client, nil)
+            client_data.hls = nil
+        end
+        return nil
+    end
+
+    -- playlist and segments are in the directory of the output path
+    local path = request.path:match("^(.*)/[^/]*$")
+    local output_data = server.__options.channel_list[path]
+    if not output_data then
+        server:abort(client, 404)
+        return nil
+    end
+
+    client_data.hls = output_data.output
+    client_data.hls(server, client, request)
+end
+
+init_output_module.hls = function(channel_data, output_id)
+    local output_data = channel_data.output[output_id]
+    local path = output_data.config.path:gsub("/+$", "")
+
+    output_data.output = http_hls({
+        upstream = channel_data.tail:stream(),
+        name = output_data.config.name,
+        duration = output_data.config.duration,
+        window = output_data.config.window,
+        playlist = output_data.config.playlist,
+    })
+
+    local instance_id = output_data.config.host .. ":" .. output_data.config.port
+    local instance = hls_output_instance_list[instance_id]
+
+    if not instance then
+        instance = http_server({
+            addr = output_data.config.host,
+            port = output_data.config.port,
+            route = {
+                { "/*", hls_output_on_request },
+            },
+            channel_list = {},
+        })
+        hls_output_instance_list[instance_id] = instance
+    end
+
+    output_data.instance = instance
+    output_data.instance_id = instance_id
+    output_data.hls_path = path
+
+    instance.__options.channel_list[path] = output_data
+end
+
+kill_output_module.hls = function(channel_data, output_id)
+    local output_data = channel_data.output[output_id]
+
+    local instance = output_data.instance
+    instance.__options.channel_list[output_data.hls_path] = nil
+
+    local is_instance_empty = true
+    for _ in pairs(instance.__options.channel_list) do
+        is_instance_empty = false
+        break
+    end
+
+    if is_instance_empty then
+        instance:close()
+        hls_output_instance_list[output_data.instance_id] = nil
+    end
+
+    output_data.output = nil
+    output_data.instance = nil
+    output_data.instance_id = nil
+    output_data.hls_path = nil
+end
+
 --   ooooooo            oooo   oooo oooooooooo
 -- o888   888o           8888o  88   888    888
 -- 888     888 ooooooooo 88 888o88   888oooo88
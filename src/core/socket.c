@@ -36,6 +36,14 @@
 #   include <netdb.h>
 #endif
 
+#ifdef __linux__
+#   include <linux/net_tstamp.h>
+#   if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#       include <linux/errqueue.h>
+#       define ASC_ZEROCOPY 1
+#   endif
+#endif
+
 #ifdef IGMP_EMULATION
 #   define IP_HEADER_SIZE 24
 #   define IGMP_HEADER_SIZE 8
@@ -62,8 +70,19 @@ struct asc_socket_t
     event_callback_t on_read;      /* data read */
     event_callback_t on_close;     /* error occured (connection closed) */
     event_callback_t on_ready;     /* data send is possible now */
+
+#ifdef ASC_ZEROCOPY
+    event_callback_t on_zerocopy;  /* zerocopy send completed */
+    uint32_t zerocopy_sent;        /* number of queued zerocopy sends */
+    uint32_t zerocopy_done;        /* number of completed zerocopy sends */
+    bool is_zerocopy_copied;       /* kernel fell back to copying */
+#endif
 };
 
+#ifdef ASC_ZEROCOPY
+static void __asc_socket_zerocopy_abort(asc_socket_t *sock);
+#endif
+
 /*
  * sending multicast: socket(LOOPBACK) -> set_if() -> sendto() -> close()
  * receiving multicast: socket(REUSEADDR | BIND) -> join() -> read() -> close()
@@ -185,6 +204,9 @@ void asc_socket_close(asc_socket_t *sock)
 
     if(sock->fd != -1)
     {
+#ifdef ASC_ZEROCOPY
+        __asc_socket_zerocopy_abort(sock);
+#endif
         asc_socket_shutdown_both(sock);
         if (sock_close(sock) != 0)
         {
@@ -205,9 +227,86 @@ void asc_socket_close(asc_socket_t *sock)
  *
  */
 
+#ifdef ASC_ZEROCOPY
+/* reads zerocopy completions from the error queue */
+static bool __asc_socket_zerocopy_recv(asc_socket_t *sock)
+{
+    bool is_done = false;
+
+    while(true)
+    {
+        uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if(recvmsg(sock->fd, &msg, MSG_ERRQUEUE) == -1)
+            break;
+
+        struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&msg);
+        if(cmsg == NULL)
+            break;
+
+        const struct sock_extended_err *const serr =
+            (const struct sock_extended_err *)CMSG_DATA(cmsg);
+
+        if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            continue;
+
+        /* ee_info..ee_data is the range of completed sends */
+        sock->zerocopy_done = serr->ee_data + 1;
+        if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            sock->is_zerocopy_copied = true;
+
+        is_done = true;
+    }
+
+    return is_done;
+}
+
+/* drops the connection if the kernel still reads from the caller's memory */
+static void __asc_socket_zerocopy_abort(asc_socket_t *sock)
+{
+    if(sock->zerocopy_sent == sock->zerocopy_done)
+        return;
+
+    __asc_socket_zerocopy_recv(sock);
+    if(sock->zerocopy_sent == sock->zerocopy_done)
+        return;
+
+    /* disconnect resets the connection and purges the send queue */
+    struct sockaddr sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_family = AF_UNSPEC;
+    if(connect(sock->fd, &sa, sizeof(sa)) != 0)
+        asc_log_error(MSG("failed to drop zerocopy sends: %s"), asc_error_msg());
+
+    sock->zerocopy_done = sock->zerocopy_sent;
+}
+#endif /* ASC_ZEROCOPY */
+
 static void __asc_socket_on_close(void *arg)
 {
     asc_socket_t *sock = (asc_socket_t *)arg;
+
+#ifdef ASC_ZEROCOPY
+    /* completions are reported as socket errors */
+    if(sock->on_zerocopy != NULL && __asc_socket_zerocopy_recv(sock))
+    {
+        int err = 0;
+        socklen_t err_size = sizeof(err);
+        getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &err, &err_size);
+
+        if(err == 0)
+        {
+            sock->on_zerocopy(sock->arg);
+            return;
+        }
+    }
+#endif /* ASC_ZEROCOPY */
+
     if(sock->on_close)
         sock->on_close(sock->arg);
 }
@@ -398,7 +497,10 @@ bool asc_socket_accept(asc_socket_t *sock, asc_socket_t **client_ptr
     const int fd = accept(sock->fd, (struct sockaddr *)&addr, &addrlen);
     if(fd == -1)
     {
-        asc_log_error(MSG("accept() failed: %s"), asc_error_msg());
+        // backlog is empty
+        if(!asc_socket_would_block())
+            asc_log_error(MSG("accept() failed: %s"), asc_error_msg());
+
         *client_ptr = NULL;
 
         return false;
@@ -511,6 +613,15 @@ ssize_t asc_socket_recv(asc_socket_t *sock, void *buffer, size_t size)
     return recv(sock->fd, (char *)buffer, size, 0);
 }
 
+/* returns true if the connection is open and has nothing to read */
+bool asc_socket_is_idle(asc_socket_t *sock)
+{
+    char c;
+    const ssize_t ret = recv(sock->fd, &c, 1, MSG_PEEK);
+
+    return (ret == -1 && asc_socket_would_block());
+}
+
 ssize_t asc_socket_recvfrom(asc_socket_t *sock, void *buffer, size_t size)
 {
     socklen_t slen = sizeof(struct sockaddr_in);
@@ -538,6 +649,96 @@ ssize_t asc_socket_send(asc_socket_t *sock, const void *buffer, size_t size)
     return ret;
 }
 
+/* sends up to ASC_SOCKET_SENDV_MAX buffers in a single system call */
+ssize_t asc_socket_sendv(asc_socket_t *sock, const asc_socket_buf_t *buf
+                         , unsigned int count)
+{
+    if(count > ASC_SOCKET_SENDV_MAX)
+        count = ASC_SOCKET_SENDV_MAX;
+
+#ifdef _WIN32
+    WSABUF wsabuf[ASC_SOCKET_SENDV_MAX];
+    for(unsigned int i = 0; i < count; i++)
+    {
+        wsabuf[i].buf = (char *)buf[i].data;
+        wsabuf[i].len = buf[i].size;
+    }
+
+    DWORD sent = 0;
+    if(WSASend(sock->fd, wsabuf, count, &sent, 0, NULL, NULL) != 0)
+        return asc_socket_would_block() ? 0 : -1;
+
+    return sent;
+#else
+    struct iovec iov[ASC_SOCKET_SENDV_MAX];
+    for(unsigned int i = 0; i < count; i++)
+    {
+        iov[i].iov_base = (void *)buf[i].data;
+        iov[i].iov_len = buf[i].size;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    const ssize_t ret = sendmsg(sock->fd, &msg, 0);
+    if(ret == -1)
+    {
+        if(asc_socket_would_block())
+            return 0;
+    }
+    return ret;
+#endif /* _WIN32 */
+}
+
+/*
+ * Same as asc_socket_sendv(), without copying data to the kernel. Sets
+ * is_zerocopy if the data has been queued this way: then it must stay
+ * intact until asc_socket_zerocopy_done() counts this send as completed,
+ * or until asc_socket_zerocopy_abort() or asc_socket_close() drops it.
+ * Falls back to the regular send if zerocopy is not enabled on the
+ * socket or the kernel is out of memory for pinned pages.
+ */
+ssize_t asc_socket_sendv_zerocopy(asc_socket_t *sock, const asc_socket_buf_t *buf
+                                  , unsigned int count, bool *is_zerocopy)
+{
+    *is_zerocopy = false;
+
+#ifdef ASC_ZEROCOPY
+    if(sock->on_zerocopy != NULL)
+    {
+        if(count > ASC_SOCKET_SENDV_MAX)
+            count = ASC_SOCKET_SENDV_MAX;
+
+        struct iovec iov[ASC_SOCKET_SENDV_MAX];
+        for(unsigned int i = 0; i < count; i++)
+        {
+            iov[i].iov_base = (void *)buf[i].data;
+            iov[i].iov_len = buf[i].size;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        const ssize_t ret = sendmsg(sock->fd, &msg, MSG_ZEROCOPY);
+        if(ret > 0)
+        {
+            ++sock->zerocopy_sent;
+            *is_zerocopy = true;
+            return ret;
+        }
+
+        if(ret == -1 && errno != ENOBUFS)
+            return asc_socket_would_block() ? 0 : -1;
+    }
+#endif /* ASC_ZEROCOPY */
+
+    return asc_socket_sendv(sock, buf, count);
+}
+
 ssize_t asc_socket_sendto(asc_socket_t *sock, const void *buffer, size_t size)
 {
     const socklen_t slen = sizeof(struct sockaddr_in);
@@ -545,6 +746,42 @@ ssize_t asc_socket_sendto(asc_socket_t *sock, const void *buffer, size_t size)
                   , (struct sockaddr *)&sock->sockaddr, slen);
 }
 
+ssize_t asc_socket_sendto_at(asc_socket_t *sock, const void *buffer, size_t size
+                             , uint64_t txtime)
+{
+#ifdef SO_TXTIME
+    if(txtime == 0)
+        return asc_socket_sendto(sock, buffer, size);
+
+    struct iovec iov;
+    iov.iov_base = (void *)buffer;
+    iov.iov_len = size;
+
+    uint8_t control[CMSG_SPACE(sizeof(txtime))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &sock->sockaddr;
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(txtime));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+
+    return sendmsg(sock->fd, &msg, 0);
+#else
+    __uarg(txtime);
+    return asc_socket_sendto(sock, buffer, size);
+#endif /* SO_TXTIME */
+}
+
 /*
  * ooooo oooo   oooo ooooooooooo  ooooooo
  *  888   8888o  88   888    88 o888   888o
@@ -585,6 +822,11 @@ int asc_socket_port(asc_socket_t *sock)
  *
  */
 
+void asc_socket_set_arg(asc_socket_t *sock, void *arg)
+{
+    sock->arg = arg;
+}
+
 void asc_socket_set_nonblock(asc_socket_t *sock, bool is_nonblock)
 {
     if(is_nonblock == false && sock->event)
@@ -625,6 +867,24 @@ void asc_socket_set_reuseaddr(asc_socket_t *sock, int is_on)
                , (const char *)&is_on, sizeof(is_on));
 }
 
+bool asc_socket_set_reuseport(asc_socket_t *sock, int is_on)
+{
+#ifdef SO_REUSEPORT
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT
+                  , (const char *)&is_on, sizeof(is_on)) == 0)
+    {
+        return true;
+    }
+
+    asc_log_error(MSG("failed to set SO_REUSEPORT: %s"), asc_error_msg());
+#else
+    __uarg(sock);
+    __uarg(is_on);
+#endif /* SO_REUSEPORT */
+
+    return false;
+}
+
 void asc_socket_set_non_delay(asc_socket_t *sock, int is_on)
 {
     switch(sock->protocol)
@@ -751,6 +1011,99 @@ void asc_socket_set_buffer(asc_socket_t *sock, int rcvbuf, int sndbuf)
     }
 }
 
+/*
+ * Enables MSG_ZEROCOPY sends, on_zerocopy is called when the kernel
+ * reports completed sends. Returns false if not supported.
+ */
+bool asc_socket_set_zerocopy(asc_socket_t *sock, event_callback_t on_zerocopy)
+{
+#ifdef ASC_ZEROCOPY
+    const int is_on = (on_zerocopy != NULL);
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, &is_on, sizeof(is_on)) != 0)
+    {
+        if(is_on)
+            asc_log_debug(MSG("failed to enable zerocopy: %s"), asc_error_msg());
+
+        sock->on_zerocopy = NULL;
+        return false;
+    }
+
+    sock->on_zerocopy = on_zerocopy;
+    return true;
+#else
+    __uarg(sock);
+    __uarg(on_zerocopy);
+    return false;
+#endif /* ASC_ZEROCOPY */
+}
+
+/* returns number of completed zerocopy sends, modulo 2^32 */
+uint32_t asc_socket_zerocopy_done(asc_socket_t *sock, bool *is_copied)
+{
+#ifdef ASC_ZEROCOPY
+    if(is_copied != NULL)
+        *is_copied = sock->is_zerocopy_copied;
+
+    return sock->zerocopy_done;
+#else
+    __uarg(sock);
+    if(is_copied != NULL)
+        *is_copied = false;
+
+    return 0;
+#endif /* ASC_ZEROCOPY */
+}
+
+/*
+ * Resets the connection if zerocopy sends are still in flight. Unsent
+ * data is discarded, so the memory it was sent from can be reused.
+ */
+void asc_socket_zerocopy_abort(asc_socket_t *sock)
+{
+#ifdef ASC_ZEROCOPY
+    __asc_socket_zerocopy_abort(sock);
+#else
+    __uarg(sock);
+#endif /* ASC_ZEROCOPY */
+}
+
+bool asc_socket_set_txtime(asc_socket_t *sock, int clockid)
+{
+#ifdef SO_TXTIME
+    struct sock_txtime cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.clockid = clockid;
+
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) == 0)
+        return true;
+
+    asc_log_debug(MSG("failed to set SO_TXTIME: %s"), asc_error_msg());
+#else
+    __uarg(sock);
+    __uarg(clockid);
+#endif /* SO_TXTIME */
+
+    return false;
+}
+
+bool asc_socket_set_pacing_rate(asc_socket_t *sock, uint32_t rate)
+{
+#ifdef SO_MAX_PACING_RATE
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_MAX_PACING_RATE
+                  , &rate, sizeof(rate)) == 0)
+    {
+        return true;
+    }
+
+    asc_log_debug(MSG("failed to set SO_MAX_PACING_RATE: %s"), asc_error_msg());
+#else
+    __uarg(sock);
+    __uarg(rate);
+#endif /* SO_MAX_PACING_RATE */
+
+    return false;
+}
+
 /*
  * oooo     oooo       oooooooo8     o       oooooooo8 ooooooooooo
  *  8888o   888      o888     88    888     888        88  888  88
@@ -29,6 +29,15 @@
 
 typedef struct asc_socket_t asc_socket_t;
 
+/* gather send, see asc_socket_sendv() */
+#define ASC_SOCKET_SENDV_MAX 8
+
+typedef struct
+{
+    const void *data;
+    size_t size;
+} asc_socket_buf_t;
+
 #ifdef _WIN32
 void asc_socket_core_init(void);
 void asc_socket_core_destroy(void);
@@ -59,22 +68,36 @@ void asc_socket_connect(asc_socket_t *sock, const char *addr, int port
 
 ssize_t asc_socket_recv(asc_socket_t *sock, void *buffer, size_t size) __wur;
 ssize_t asc_socket_recvfrom(asc_socket_t *sock, void *buffer, size_t size) __wur;
+bool asc_socket_is_idle(asc_socket_t *sock) __wur;
 
 ssize_t asc_socket_send(asc_socket_t *sock, const void *buffer, size_t size) __wur;
+ssize_t asc_socket_sendv(asc_socket_t *sock, const asc_socket_buf_t *buf
+                         , unsigned int count) __wur;
+ssize_t asc_socket_sendv_zerocopy(asc_socket_t *sock, const asc_socket_buf_t *buf
+                                  , unsigned int count, bool *is_zerocopy) __wur;
 ssize_t asc_socket_sendto(asc_socket_t *sock, const void *buffer, size_t size) __wur;
+ssize_t asc_socket_sendto_at(asc_socket_t *sock, const void *buffer, size_t size
+                             , uint64_t txtime) __wur;
 
 int asc_socket_fd(asc_socket_t *sock) __func_pure __wur;
 const char *asc_socket_addr(asc_socket_t *sock) __wur;
 int asc_socket_port(asc_socket_t *sock) __wur;
 
+void asc_socket_set_arg(asc_socket_t *sock, void *arg);
 void asc_socket_set_nonblock(asc_socket_t *sock, bool is_nonblock);
 void asc_socket_set_sockaddr(asc_socket_t *sock, const char *addr, int port);
 void asc_socket_set_reuseaddr(asc_socket_t *sock, int is_on);
+bool asc_socket_set_reuseport(asc_socket_t *sock, int is_on);
 void asc_socket_set_non_delay(asc_socket_t *sock, int is_on);
 void asc_socket_set_keep_alive(asc_socket_t *sock, int is_on);
 void asc_socket_set_broadcast(asc_socket_t *sock, int is_on);
 void asc_socket_set_timeout(asc_socket_t *sock, int rcvmsec, int sndmsec);
 void asc_socket_set_buffer(asc_socket_t *sock, int rcvbuf, int sndbuf);
+bool asc_socket_set_zerocopy(asc_socket_t *sock, event_callback_t on_zerocopy);
+uint32_t asc_socket_zerocopy_done(asc_socket_t *sock, bool *is_copied) __wur;
+void asc_socket_zerocopy_abort(asc_socket_t *sock);
+bool asc_socket_set_txtime(asc_socket_t *sock, int clockid);
+bool asc_socket_set_pacing_rate(asc_socket_t *sock, uint32_t rate);
 
 void asc_socket_set_multicast_if(asc_socket_t *sock, const char *addr);
 void asc_socket_set_multicast_ttl(asc_socket_t *sock, int ttl);
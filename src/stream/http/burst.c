@@ -0,0 +1,431 @@
+/*
+ * Astra Module: HTTP (Burst buffer)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "burst.h"
+
+/* bitrate is measured over that many packets, but not less than a second */
+#define BURST_RATE_PACKETS 256
+
+typedef struct
+{
+    unsigned int refs;
+    size_t size;
+    size_t capacity;
+    uint8_t data[];
+} burst_block_t;
+
+struct http_burst_t
+{
+    module_stream_t stream;
+    module_stream_t *upstream;
+    unsigned int refs;
+
+    size_t capacity;
+    burst_block_t *block;
+
+    http_psi_t psi;
+
+    uint64_t rate_time;
+    uint64_t rate_bytes;
+    uint64_t bitrate;       // bytes per second
+};
+
+/* burst buffers of all upstreams */
+static asc_list_t *burst_list = NULL;
+
+static void block_release(burst_block_t *block)
+{
+    if(--block->refs == 0)
+        free(block);
+}
+
+static void pmt_clear(http_psi_t *psi)
+{
+    for(unsigned int i = 0; i < psi->pmt_count; i++)
+    {
+        ASC_FREE(psi->pmt[i], mpegts_psi_destroy);
+        ASC_FREE(psi->pmt_out[i], mpegts_psi_destroy);
+    }
+
+    psi->pmt_count = 0;
+    psi->video_count = 0;
+    psi->pcr_pid = NULL_TS_PID;
+}
+
+static void psi_keep(mpegts_psi_t *out, const mpegts_psi_t *psi)
+{
+    memcpy(out->buffer, psi->buffer, psi->buffer_size);
+    out->buffer_size = psi->buffer_size;
+}
+
+static void on_pat(void *arg, mpegts_psi_t *psi)
+{
+    http_psi_t *const tables = (http_psi_t *)arg;
+
+    if(psi->buffer[0] != 0x00)
+        return;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == psi->crc32 || crc32 != PSI_CALC_CRC32(psi))
+        return;
+
+    psi->crc32 = crc32;
+    psi_keep(tables->pat_out, psi);
+    pmt_clear(tables);
+
+    const uint8_t *pointer;
+    PAT_ITEMS_FOREACH(psi, pointer)
+    {
+        const uint16_t pnr = PAT_ITEM_GET_PNR(psi, pointer);
+        if(pnr == 0 || tables->pmt_count >= HTTP_PSI_MAX_PMT)
+            continue;
+
+        const uint16_t pid = PAT_ITEM_GET_PID(psi, pointer);
+        tables->pmt[tables->pmt_count] = mpegts_psi_init(MPEGTS_PACKET_PMT, pid);
+        tables->pmt_out[tables->pmt_count] = mpegts_psi_init(MPEGTS_PACKET_PMT, pid);
+        ++tables->pmt_count;
+    }
+}
+
+static void on_pmt(void *arg, mpegts_psi_t *psi)
+{
+    http_psi_t *const tables = (http_psi_t *)arg;
+
+    if(psi->buffer[0] != 0x02)
+        return;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == psi->crc32 || crc32 != PSI_CALC_CRC32(psi))
+        return;
+
+    psi->crc32 = crc32;
+
+    for(unsigned int i = 0; i < tables->pmt_count; i++)
+    {
+        if(tables->pmt[i] == psi)
+            psi_keep(tables->pmt_out[i], psi);
+    }
+
+    if(tables->pcr_pid == NULL_TS_PID)
+        tables->pcr_pid = PMT_GET_PCR(psi);
+
+    const uint8_t *pointer;
+    PMT_ITEMS_FOREACH(psi, pointer)
+    {
+        const uint8_t type = PMT_ITEM_GET_TYPE(psi, pointer);
+        if(mpegts_stream_type(type)->pkt_type != MPEGTS_PACKET_VIDEO)
+            continue;
+
+        const uint16_t pid = PMT_ITEM_GET_PID(psi, pointer);
+
+        unsigned int i = 0;
+        while(i < tables->video_count && tables->video[i] != pid)
+            ++i;
+
+        if(i == tables->video_count && i < HTTP_PSI_MAX_VIDEO)
+            tables->video[tables->video_count++] = pid;
+    }
+}
+
+void http_psi_init(http_psi_t *psi)
+{
+    memset(psi, 0, sizeof(*psi));
+    psi->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    psi->pat_out = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    psi->pcr_pid = NULL_TS_PID;
+}
+
+void http_psi_destroy(http_psi_t *psi)
+{
+    pmt_clear(psi);
+    ASC_FREE(psi->pat, mpegts_psi_destroy);
+    ASC_FREE(psi->pat_out, mpegts_psi_destroy);
+}
+
+/* returns true if the packet belongs to one of the tables */
+bool http_psi_mux(http_psi_t *psi, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+
+    if(pid == 0)
+    {
+        mpegts_psi_mux(psi->pat, ts, on_pat, psi);
+        return true;
+    }
+
+    for(unsigned int i = 0; i < psi->pmt_count; i++)
+    {
+        if(psi->pmt[i]->pid == pid)
+        {
+            mpegts_psi_mux(psi->pmt[i], ts, on_pmt, psi);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* last valid tables, PAT first */
+void http_psi_demux(http_psi_t *psi, ts_callback_t callback, void *arg)
+{
+    if(psi->pat_out->buffer_size > 0)
+        mpegts_psi_demux(psi->pat_out, callback, arg);
+
+    for(unsigned int i = 0; i < psi->pmt_count; i++)
+    {
+        if(psi->pmt_out[i]->buffer_size > 0)
+            mpegts_psi_demux(psi->pmt_out[i], callback, arg);
+    }
+}
+
+/* at least one PMT is known */
+bool http_psi_is_ready(const http_psi_t *psi)
+{
+    for(unsigned int i = 0; i < psi->pmt_count; i++)
+    {
+        if(psi->pmt_out[i]->buffer_size > 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool http_psi_is_video(const http_psi_t *psi, uint16_t pid)
+{
+    for(unsigned int i = 0; i < psi->video_count; i++)
+    {
+        if(psi->video[i] == pid)
+            return true;
+    }
+
+    return false;
+}
+
+static bool is_video(const http_burst_t *burst, uint16_t pid)
+{
+    // any random access point until PMT is known
+    if(burst->psi.video_count == 0)
+        return true;
+
+    return http_psi_is_video(&burst->psi, pid);
+}
+
+static void on_ts(void *arg, const uint8_t *ts)
+{
+    http_burst_t *const burst = (http_burst_t *)arg;
+    const uint16_t pid = TS_GET_PID(ts);
+
+    burst->rate_bytes += TS_PACKET_SIZE;
+    if(burst->rate_bytes % (BURST_RATE_PACKETS * TS_PACKET_SIZE) == 0)
+    {
+        const uint64_t now = asc_utime();
+        const uint64_t elapsed = now - burst->rate_time;
+
+        if(burst->rate_time == 0)
+        {
+            burst->rate_time = now;
+            burst->rate_bytes = 0;
+        }
+        else if(elapsed >= 1000000)
+        {
+            burst->bitrate = burst->rate_bytes * 1000000 / elapsed;
+            burst->rate_time = now;
+            burst->rate_bytes = 0;
+        }
+    }
+
+    http_psi_mux(&burst->psi, ts);
+
+    // tables only
+    if(burst->capacity == 0)
+        return;
+
+    if(TS_IS_RAI(ts) && is_video(burst, pid))
+    {
+        // restart in place unless snapshots still refer to the block
+        if(burst->block && burst->block->refs > 1)
+            ASC_FREE(burst->block, block_release);
+
+        // capacity may have been raised by another client
+        if(burst->block && burst->block->capacity < burst->capacity)
+            ASC_FREE(burst->block, block_release);
+
+        if(!burst->block)
+        {
+            burst->block = (burst_block_t *)asc_calloc(
+                1, sizeof(burst_block_t) + burst->capacity);
+            burst->block->refs = 1;
+            burst->block->capacity = burst->capacity;
+        }
+
+        burst->block->size = 0;
+    }
+
+    burst_block_t *const block = burst->block;
+    if(!block)
+        return;
+
+    if(block->size + TS_PACKET_SIZE > block->capacity)
+    {
+        // group of pictures is too long, wait for the next one
+        ASC_FREE(burst->block, block_release);
+        return;
+    }
+
+    memcpy(&block->data[block->size], ts, TS_PACKET_SIZE);
+    block->size += TS_PACKET_SIZE;
+}
+
+http_burst_t *http_burst_attach(module_stream_t *upstream, size_t size)
+{
+    if(burst_list)
+    {
+        asc_list_for(burst_list)
+        {
+            http_burst_t *const burst = (http_burst_t *)asc_list_data(burst_list);
+
+            // parent is cleared if the upstream has been destroyed
+            if(burst->upstream == upstream && burst->stream.parent == upstream)
+            {
+                if(size > burst->capacity)
+                    burst->capacity = size;
+
+                ++burst->refs;
+                return burst;
+            }
+        }
+    }
+    else
+    {
+        burst_list = asc_list_init();
+    }
+
+    http_burst_t *const burst = ASC_ALLOC(1, http_burst_t);
+    burst->upstream = upstream;
+    burst->refs = 1;
+    burst->capacity = size;
+    http_psi_init(&burst->psi);
+
+    burst->stream.self = (module_data_t *)burst;
+    burst->stream.on_ts = (stream_callback_t)on_ts;
+    __module_stream_init(&burst->stream);
+    __module_stream_attach(upstream, &burst->stream);
+
+    asc_list_insert_tail(burst_list, burst);
+
+    return burst;
+}
+
+void http_burst_detach(http_burst_t *burst)
+{
+    if(--burst->refs > 0)
+        return;
+
+    __module_stream_destroy(&burst->stream);
+
+    ASC_FREE(burst->block, block_release);
+    http_psi_destroy(&burst->psi);
+
+    asc_list_remove_item(burst_list, burst);
+    free(burst);
+
+    if(asc_list_size(burst_list) == 0)
+        ASC_FREE(burst_list, asc_list_destroy);
+}
+
+typedef struct
+{
+    uint8_t *buffer;
+    size_t size;
+    size_t capacity;
+} psi_buffer_t;
+
+static void on_psi(void *arg, const uint8_t *ts)
+{
+    psi_buffer_t *const out = (psi_buffer_t *)arg;
+
+    if(out->size + TS_PACKET_SIZE <= out->capacity)
+    {
+        memcpy(&out->buffer[out->size], ts, TS_PACKET_SIZE);
+        out->size += TS_PACKET_SIZE;
+    }
+}
+
+size_t http_burst_psi(http_burst_t *burst, uint8_t *buffer, size_t size)
+{
+    psi_buffer_t out = { buffer, 0, size };
+    http_psi_demux(&burst->psi, on_psi, &out);
+
+    return out.size;
+}
+
+bool http_burst_has_psi(const http_burst_t *burst)
+{
+    return http_psi_is_ready(&burst->psi);
+}
+
+bool http_burst_is_start(const http_burst_t *burst, const uint8_t *ts)
+{
+    // radio: any payload start of a non-table pid
+    if(burst->psi.video_count == 0 && http_psi_is_ready(&burst->psi))
+        return TS_IS_PAYLOAD_START(ts) && TS_GET_PID(ts) >= 0x20;
+
+    return TS_IS_RAI(ts) && is_video(burst, TS_GET_PID(ts));
+}
+
+uint64_t http_burst_bitrate(const http_burst_t *burst)
+{
+    return burst->bitrate;
+}
+
+bool http_burst_get(http_burst_t *burst, http_burst_snapshot_t *snap)
+{
+    burst_block_t *const block = burst->block;
+
+    snap->block = NULL;
+    snap->data = NULL;
+    snap->size = 0;
+    snap->psi_size = 0;
+
+    if(!block || block->size == 0)
+        return false;
+
+    snap->psi_size = http_burst_psi(burst, snap->psi, sizeof(snap->psi));
+
+    ++block->refs;
+    snap->block = block;
+    snap->data = block->data;
+    snap->size = block->size;
+
+    return true;
+}
+
+void http_burst_release(http_burst_snapshot_t *snap)
+{
+    if(snap->block)
+    {
+        block_release((burst_block_t *)snap->block);
+        snap->block = NULL;
+    }
+
+    snap->data = NULL;
+    snap->size = 0;
+    snap->psi_size = 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Astra Module: HTTP (Burst buffer)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HTTP_BURST_H_
+#define _HTTP_BURST_H_ 1
+
+#include <astra.h>
+#include <luaapi/stream.h>
+#include <mpegts/psi.h>
+
+/*
+ * Program tables of a stream.
+ *
+ * Tables are assembled from the stream and the last valid PAT and PMTs
+ * are kept, so they can be sent ahead of the data to a client that joins
+ * in the middle of the stream. Video PIDs and the PCR PID of the first
+ * program are taken from the PMTs.
+ */
+
+#define HTTP_PSI_MAX_PMT 8
+#define HTTP_PSI_MAX_VIDEO 8
+
+typedef struct
+{
+    // tables are assembled in pat/pmt and the last valid ones are kept
+    // in pat_out/pmt_out, which have their own continuity counters
+    mpegts_psi_t *pat;
+    mpegts_psi_t *pat_out;
+    mpegts_psi_t *pmt[HTTP_PSI_MAX_PMT];
+    mpegts_psi_t *pmt_out[HTTP_PSI_MAX_PMT];
+    unsigned int pmt_count;
+
+    uint16_t video[HTTP_PSI_MAX_VIDEO];
+    unsigned int video_count;
+    uint16_t pcr_pid;
+} http_psi_t;
+
+void http_psi_init(http_psi_t *psi);
+void http_psi_destroy(http_psi_t *psi);
+
+bool http_psi_mux(http_psi_t *psi, const uint8_t *ts);
+void http_psi_demux(http_psi_t *psi, ts_callback_t callback, void *arg);
+
+bool http_psi_is_ready(const http_psi_t *psi) __wur;
+bool http_psi_is_video(const http_psi_t *psi, uint16_t pid) __wur;
+
+/*
+ * Fast channel change buffer.
+ *
+ * One burst buffer is shared by all clients of the same upstream. It
+ * keeps the stream since the latest random access point on a video PID
+ * along with the last PAT and PMT. A new client takes a snapshot: the
+ * tables followed by the buffered data, which can be sent at once and
+ * continue with live packets without waiting for the next keyframe.
+ *
+ * Buffered data is kept in reference counted blocks, so a snapshot is
+ * not copied and stays valid after the buffer has moved on.
+ *
+ * Zero size keeps the tables only, for clients that need to resume at a
+ * random access point. The upstream bitrate is measured either way.
+ */
+
+#define HTTP_BURST_PSI_SIZE (16 * TS_PACKET_SIZE)
+
+typedef struct http_burst_t http_burst_t;
+
+typedef struct
+{
+    void *block;
+    const uint8_t *data;
+    size_t size;
+
+    uint8_t psi[HTTP_BURST_PSI_SIZE];
+    size_t psi_size;
+} http_burst_snapshot_t;
+
+http_burst_t *http_burst_attach(module_stream_t *upstream, size_t size) __wur;
+void http_burst_detach(http_burst_t *burst);
+
+bool http_burst_get(http_burst_t *burst, http_burst_snapshot_t *snap) __wur;
+void http_burst_release(http_burst_snapshot_t *snap);
+
+size_t http_burst_psi(http_burst_t *burst, uint8_t *buffer, size_t size) __wur;
+bool http_burst_has_psi(const http_burst_t *burst) __wur;
+bool http_burst_is_start(const http_burst_t *burst, const uint8_t *ts) __wur;
+uint64_t http_burst_bitrate(const http_burst_t *burst) __wur;
+
+#endif /* _HTTP_BURST_H_ */
@@ -6,13 +6,19 @@
 #include <core/event.h>
 #include <core/socket.h>
 #include <core/strbuf.h>
+#include <luaapi/stream.h>
 #include <utils/strhex.h>
 
 #include "parser.h"
+#include "shaper.h"
 
 #define HTTP_BUFFER_SIZE (16 * 1024)
 
+/* maximum data sent to a stream client per socket wakeup */
+#define HTTP_SEND_BUDGET (512 * 1024)
+
 typedef struct http_response_t http_response_t;
+typedef struct http_stream_t http_stream_t;
 typedef struct http_client_t http_client_t;
 
 struct http_client_t
@@ -30,18 +36,33 @@ struct http_client_t
 
     // request
     int status;         // 1 - empty line is found, 2 - request ready, 3 - release
+    http_scan_t scan;   // request head lines
     int idx_request;
     int idx_callback;   // route callback
 
     bool is_head;
     bool is_content_length;
+    bool is_chunked;
+    bool is_trailer;    // chunked body: waiting for the trailer section
     string_buffer_t *content;
 
+    // persistent connection
+    bool is_keep_alive;
+    bool is_response_length;
+    bool is_response_connection;
+    unsigned int requests;
+    uint64_t idle_time;
+
+    char *pipeline;     // data received after the current request
+    size_t pipeline_skip;
+
     // response
     event_callback_t on_send;
     event_callback_t on_read;
     event_callback_t on_ready;
     http_response_t *response;
+    http_stream_t *stream; // native stream route
+    http_shaper_t *shaper; // http_server egress limit, NULL if unlimited
 
     int idx_content;
 };
@@ -55,10 +76,44 @@ void http_response_send(http_client_t *client);
 void http_client_warning(http_client_t *client, const char *message, ...) __fmt_printf(2, 3);
 void http_client_error(http_client_t *client, const char *message, ...) __fmt_printf(2, 3);
 void http_client_close(http_client_t *client);
+void http_client_done(http_client_t *client);
 
 void http_client_redirect(http_client_t *client, int code, const char *location);
 void http_client_abort(http_client_t *client, int code, const char *text);
 
+// HTTP Upstream API
+
+typedef enum
+{
+    HTTP_OVERFLOW_RESET = 0,    // drop buffered data and go on
+    HTTP_OVERFLOW_SKIP,         // drop buffered data, resume at the next keyframe
+    HTTP_OVERFLOW_DEGRADE,      // skip and switch to the fallback stream
+} http_overflow_t;
+
+typedef struct
+{
+    size_t buffer_size;
+    size_t buffer_fill;
+    size_t burst_size;
+    bool is_zerocopy;
+
+    http_overflow_t overflow;
+    unsigned int overflow_limit;    // disconnect after that many overflows,
+    unsigned int overflow_period;   // within that many seconds
+    module_stream_t *fallback;
+
+    unsigned int rate_limit;        // Kbit/s per client,
+    double rate_factor;             // or a multiple of the stream bitrate
+} http_upstream_config_t;
+
+const char *http_upstream_config(lua_State *L, int idx
+                                 , http_upstream_config_t *config) __wur;
+
+void http_upstream_send(http_client_t *client, module_stream_t *upstream
+                        , const http_upstream_config_t *config);
+void http_upstream_release(http_client_t *client);
+bool http_upstream_stat(lua_State *L, http_client_t *client);
+
 // Utils
 
 void lua_string_to_lower(lua_State *L, const char *str, size_t size);
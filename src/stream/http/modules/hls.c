@@ -0,0 +1,529 @@
+/*
+ * Astra Module: HTTP Module: HLS segmenter
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      http_hls
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, instance name
+ *      duration    - number, target segment duration in seconds, default 6
+ *      window      - number, segments in the playlist, default 5
+ *      playlist    - string, playlist file name, default "index.m3u8"
+ *
+ * Module Methods:
+ *      stat()      - return table, segmenter counters
+ *
+ * The stream is cut into segments at random access points on a video PID
+ * once the target duration is reached. Duration is measured by PCR, or by
+ * wall clock if the stream has no PCR. Every segment starts with the last
+ * PAT and PMT. The latest `window' segments are kept in memory and sent
+ * to clients directly from there; a segment that is pushed out of the
+ * window stays valid until the clients that are reading it are done.
+ *
+ * The instance is used as an http_server route callback. Only the last
+ * path component of the request is used: the playlist name or
+ * "<sequence>.ts", so the same instance works with any route prefix.
+ */
+
+#include <astra.h>
+#include <luaapi/stream.h>
+#include <mpegts/psi.h>
+#include <mpegts/pcr.h>
+
+#include "../http.h"
+#include "../burst.h"
+
+#define HLS_MAX_WINDOW 64
+
+/* defaults */
+#define HLS_DURATION 6
+#define HLS_WINDOW 5
+
+/* initial segment buffer size */
+#define HLS_SEGMENT_SIZE (1024 * 1024)
+
+/* playlist header and one line per segment */
+#define HLS_PLAYLIST_SIZE(_window) (256 + (_window) * 64)
+
+#define MSG(_msg) "[http_hls %s] " _msg, mod->name
+
+typedef struct
+{
+    unsigned int refs;
+
+    uint64_t sequence;
+    uint64_t duration; /* us */
+
+    size_t size;
+    size_t capacity;
+    uint8_t *data;
+} hls_block_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    const char *playlist_name;
+    uint64_t target;    /* us */
+    unsigned int window;
+
+    // last valid tables are inserted at the start of each segment
+    http_psi_t psi;
+
+    // time since the last segment boundary
+    uint64_t pcr;
+    uint64_t start_pcr;
+    uint64_t start_time;
+
+    // segment being assembled, not visible to clients
+    hls_block_t *current;
+    // buffer of an evicted segment, reused for the next one
+    hls_block_t *spare;
+
+    hls_block_t *ring[HLS_MAX_WINDOW];
+    unsigned int ring_head;
+    unsigned int ring_count;
+
+    uint64_t sequence;
+    hls_block_t *playlist;
+
+    // statistics
+    uint64_t segments;
+    uint64_t requests;
+    uint64_t misses;
+};
+
+struct http_response_t
+{
+    hls_block_t *block;
+    size_t skip;
+};
+
+/*
+ * client->mod - http_server module
+ * client->response->block - segment or playlist being sent
+ */
+
+static hls_block_t *block_alloc(size_t capacity)
+{
+    hls_block_t *const block = ASC_ALLOC(1, hls_block_t);
+    block->refs = 1;
+    block->capacity = capacity;
+    block->data = ASC_ALLOC(capacity, uint8_t);
+
+    return block;
+}
+
+static void block_release(hls_block_t *block)
+{
+    if(--block->refs == 0)
+    {
+        free(block->data);
+        free(block);
+    }
+}
+
+static void block_append(hls_block_t *block, const uint8_t *data, size_t size)
+{
+    if(block->size + size > block->capacity)
+    {
+        while(block->size + size > block->capacity)
+            block->capacity *= 2;
+
+        block->data = (uint8_t *)realloc(block->data, block->capacity);
+        asc_assert(block->data != NULL, "[http_hls] realloc() failed");
+    }
+
+    memcpy(&block->data[block->size], data, size);
+    block->size += size;
+}
+
+/*
+ *  oooooooo8 ooooooooooo  ooooooo8
+ * 888         888    88 o888    88
+ *  888oooooo  888ooo8   888    oooo
+ *         888 888    oo 888o    88
+ * o88oooo888 o888ooo8888 888ooo888
+ *
+ */
+
+/* time since the last segment boundary, us */
+static uint64_t segment_time(const module_data_t *mod)
+{
+    if(mod->start_pcr != XTS_NONE && mod->pcr != XTS_NONE)
+    {
+        const uint64_t delta = (mod->pcr >= mod->start_pcr)
+                             ? (mod->pcr - mod->start_pcr)
+                             : (PCR_MAX + 1 - mod->start_pcr + mod->pcr);
+        const uint64_t us = delta / (PCR_TIME_BASE / 1000000);
+
+        // ignore PCR discontinuities
+        if(us < mod->target * 4)
+            return us;
+    }
+
+    return asc_utime() - mod->start_time;
+}
+
+static bool is_boundary(const module_data_t *mod, const uint8_t *ts
+                        , uint16_t pid)
+{
+    // audio only stream, cut at any PES header
+    if(mod->psi.video_count == 0)
+        return TS_IS_PAYLOAD_START(ts);
+
+    if(!http_psi_is_video(&mod->psi, pid))
+        return false;
+
+    if(TS_IS_RAI(ts))
+        return true;
+
+    // encoders that don't set random access indicator
+    return TS_IS_PAYLOAD_START(ts) && segment_time(mod) >= mod->target * 2;
+}
+
+static void on_psi(void *arg, const uint8_t *ts)
+{
+    block_append((hls_block_t *)arg, ts, TS_PACKET_SIZE);
+}
+
+static void segment_open(module_data_t *mod)
+{
+    hls_block_t *block = mod->spare;
+    mod->spare = NULL;
+
+    if(!block)
+        block = block_alloc(HLS_SEGMENT_SIZE);
+
+    block->size = 0;
+    block->sequence = mod->sequence++;
+    block->duration = 0;
+
+    http_psi_demux(&mod->psi, on_psi, block);
+
+    mod->current = block;
+}
+
+static void playlist_update(module_data_t *mod)
+{
+    hls_block_t *block = mod->playlist;
+    if(block && block->refs > 1)
+    {
+        // still being sent to a client
+        block_release(block);
+        block = NULL;
+    }
+
+    if(!block)
+        block = block_alloc(HLS_PLAYLIST_SIZE(mod->window));
+
+    mod->playlist = block;
+
+    // target duration is the maximum segment duration rounded up
+    uint64_t target = mod->target;
+    for(unsigned int i = 0; i < mod->ring_count; i++)
+    {
+        const hls_block_t *const seg = mod->ring[(mod->ring_head + i) % mod->window];
+        if(seg->duration > target)
+            target = seg->duration;
+    }
+
+    char *const out = (char *)block->data;
+    const size_t size = block->capacity;
+
+    size_t skip = snprintf(out, size
+                           , "#EXTM3U\n"
+                             "#EXT-X-VERSION:3\n"
+                             "#EXT-X-TARGETDURATION:%" PRIu64 "\n"
+                             "#EXT-X-MEDIA-SEQUENCE:%" PRIu64 "\n"
+                           , (target + 999999) / 1000000
+                           , mod->ring[mod->ring_head]->sequence);
+
+    for(unsigned int i = 0; i < mod->ring_count && skip < size; i++)
+    {
+        const hls_block_t *const seg = mod->ring[(mod->ring_head + i) % mod->window];
+        skip += snprintf(&out[skip], size - skip
+                         , "#EXTINF:%.3f,\n"
+                           "%" PRIu64 ".ts\n"
+                         , seg->duration / 1000000.0
+                         , seg->sequence);
+    }
+
+    block->size = (skip < size) ? skip : size;
+}
+
+static void segment_close(module_data_t *mod)
+{
+    hls_block_t *const block = mod->current;
+    mod->current = NULL;
+
+    block->duration = segment_time(mod);
+
+    if(mod->ring_count == mod->window)
+    {
+        hls_block_t *const old = mod->ring[mod->ring_head];
+        mod->ring_head = (mod->ring_head + 1) % mod->window;
+        --mod->ring_count;
+
+        if(old->refs == 1 && !mod->spare)
+            mod->spare = old;
+        else
+            block_release(old);
+    }
+
+    mod->ring[(mod->ring_head + mod->ring_count) % mod->window] = block;
+    ++mod->ring_count;
+    ++mod->segments;
+
+    playlist_update(mod);
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+    const bool is_psi = http_psi_mux(&mod->psi, ts);
+
+    if(pid == mod->psi.pcr_pid && TS_IS_PCR(ts))
+        mod->pcr = TS_GET_PCR(ts);
+
+    if(!is_psi && http_psi_is_ready(&mod->psi) && is_boundary(mod, ts, pid))
+    {
+        if(!mod->current || segment_time(mod) >= mod->target)
+        {
+            if(mod->current)
+                segment_close(mod);
+
+            segment_open(mod);
+
+            mod->start_pcr = mod->pcr;
+            mod->start_time = asc_utime();
+        }
+    }
+
+    if(mod->current)
+        block_append(mod->current, ts, TS_PACKET_SIZE);
+}
+
+/*
+ * ooooo ooooo ooooooooooo ooooooooooo oooooooooo
+ *  888   888  88  888  88 88  888  88  888    888
+ *  888ooo888      888         888      888oooo88
+ *  888   888      888         888      888
+ * o888o o888o    o888o       o888o    o888o
+ *
+ */
+
+static void on_ready_send_block(void *arg)
+{
+    http_client_t *const client = (http_client_t *)arg;
+    http_response_t *const response = client->response;
+    const hls_block_t *const block = response->block;
+
+    // sent directly from the segment buffer
+    const ssize_t send_size = asc_socket_send(  client->sock
+                                              , &block->data[response->skip]
+                                              , block->size - response->skip);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send segment: %s", asc_error_msg());
+        http_client_close(client);
+        return;
+    }
+
+    response->skip += send_size;
+
+    if(response->skip >= block->size)
+        http_client_done(client);
+}
+
+static hls_block_t *find_segment(module_data_t *mod, const char *name)
+{
+    char *end = NULL;
+    const unsigned long long sequence = strtoull(name, &end, 10);
+
+    if(end == name || strcmp(end, ".ts") != 0 || mod->ring_count == 0)
+        return NULL;
+
+    const uint64_t first = mod->ring[mod->ring_head]->sequence;
+    if(sequence < first || sequence - first >= mod->ring_count)
+        return NULL;
+
+    return mod->ring[(mod->ring_head + (sequence - first)) % mod->window];
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(lua_State *L, module_data_t *mod)
+{
+    http_client_t *const client = (http_client_t *)lua_touserdata(L, 3);
+
+    if(lua_isnil(L, 4))
+    {
+        if(client->response)
+        {
+            ASC_FREE(client->response->block, block_release);
+            ASC_FREE(client->response, free);
+        }
+        return 0;
+    }
+
+    lua_getfield(L, 4, "path");
+    const char *path = lua_tostring(L, -1);
+    lua_pop(L, 1);
+
+    const char *name = strrchr(path, '/');
+    name = (name) ? (name + 1) : path;
+
+    ++mod->requests;
+
+    hls_block_t *block;
+    const char *content_type;
+    const bool is_playlist = (strcmp(name, mod->playlist_name) == 0);
+
+    if(is_playlist)
+    {
+        block = mod->playlist;
+        content_type = "application/vnd.apple.mpegurl";
+    }
+    else
+    {
+        block = find_segment(mod, name);
+        content_type = "video/MP2T";
+    }
+
+    if(!block)
+    {
+        ++mod->misses;
+        http_client_abort(client, 404, NULL);
+        return 0;
+    }
+
+    ++block->refs;
+
+    client->response = ASC_ALLOC(1, http_response_t);
+    client->response->block = block;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = on_ready_send_block;
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Content-Type: %s", content_type);
+    http_response_header(client, "Content-Length: %zu", block->size);
+    if(is_playlist)
+    {
+        http_response_header(client, "Cache-Control: no-cache");
+    }
+    else
+    {
+        // segment content never changes while it is in the window
+        const uint64_t max_age = (mod->target * mod->window) / 1000000;
+        http_response_header(client, "Cache-Control: max-age=%" PRIu64, max_age);
+    }
+    http_response_send(client);
+
+    return 0;
+}
+
+static int __module_call(lua_State *L)
+{
+    module_data_t *const mod =
+        (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
+
+    return module_call(L, mod);
+}
+
+static int method_stat(lua_State *L, module_data_t *mod)
+{
+    size_t size = 0;
+    for(unsigned int i = 0; i < mod->ring_count; i++)
+        size += mod->ring[(mod->ring_head + i) % mod->window]->size;
+
+    lua_newtable(L);
+    lua_pushnumber(L, mod->segments);
+    lua_setfield(L, -2, "segments");
+    lua_pushinteger(L, mod->ring_count);
+    lua_setfield(L, -2, "window");
+    lua_pushnumber(L, size);
+    lua_setfield(L, -2, "size");
+    lua_pushnumber(L, mod->requests);
+    lua_setfield(L, -2, "requests");
+    lua_pushnumber(L, mod->misses);
+    lua_setfield(L, -2, "misses");
+
+    return 1;
+}
+
+static void module_init(lua_State *L, module_data_t *mod)
+{
+    module_option_string(L, "name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[http_hls] option 'name' is required");
+
+    int duration = HLS_DURATION;
+    module_option_integer(L, "duration", &duration);
+    asc_assert(duration > 0, MSG("option 'duration' is out of range"));
+    mod->target = (uint64_t)duration * 1000000;
+
+    int window = HLS_WINDOW;
+    module_option_integer(L, "window", &window);
+    asc_assert(window >= 2 && window <= HLS_MAX_WINDOW
+               , MSG("option 'window' is out of range"));
+    mod->window = window;
+
+    mod->playlist_name = "index.m3u8";
+    module_option_string(L, "playlist", &mod->playlist_name, NULL);
+
+    http_psi_init(&mod->psi);
+    mod->pcr = XTS_NONE;
+    mod->start_pcr = XTS_NONE;
+    mod->start_time = asc_utime();
+
+    module_stream_init(mod, on_ts);
+
+    // Set callback for http route
+    lua_getmetatable(L, 3);
+    lua_pushlightuserdata(L, (void *)mod);
+    lua_pushcclosure(L, __module_call, 1);
+    lua_setfield(L, -2, "__call");
+    lua_pop(L, 1);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    // blocks that are being sent are released by their clients
+    for(unsigned int i = 0; i < mod->ring_count; i++)
+        block_release(mod->ring[(mod->ring_head + i) % mod->window]);
+    mod->ring_count = 0;
+
+    ASC_FREE(mod->current, block_release);
+    ASC_FREE(mod->spare, block_release);
+    ASC_FREE(mod->playlist, block_release);
+
+    http_psi_destroy(&mod->psi);
+}
+
+MODULE_LUA_METHODS()
+{
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(http_hls)
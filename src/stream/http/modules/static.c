@@ -18,6 +18,47 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      http_static
+ *
+ * Module Options:
+ *      path        - string, directory with the files
+ *      skip        - string, route prefix to remove from the request path
+ *      block_size  - number, sendfile block size, Kb. default: 128
+ *      default_mime
+ *                  - string, type for unknown extensions,
+ *                    default: "application/octet-stream"
+ *      cache_size  - number, memory for small files, Kb. default: 16384,
+ *                    0 - disable cache
+ *      cache_file_size
+ *                  - number, largest file to keep in memory, Kb. default: 256
+ *      mmap        - boolean, map larger files to memory and share the mapping
+ *                    between clients instead of sending them with sendfile.
+ *                    files must not be truncated while they are served,
+ *                    reading a truncated mapping kills the process with
+ *                    SIGBUS. default: false
+ *      ts_align    - boolean, files are MPEG-TS recordings: align byte ranges
+ *                    to 188-byte packets and send files that are not cached
+ *                    with sendfile even if 'mmap' is set. default: false
+ *
+ * Module Methods:
+ *      stat()      - return table, cache counters
+ *
+ * Files are kept in the cache by their full name, and least recently used
+ * ones are dropped when the cache is full. A cached file is checked with
+ * stat() once a second and is loaded again if its mtime, size or inode
+ * has changed. Mapped files must be replaced with rename(), truncating a
+ * file in place while it is being sent is not supported.
+ *
+ * Every response carries an ETag built from mtime and size, a request
+ * with a matching If-None-Match gets 304 Not Modified.
+ *
+ * A single byte range is sent as 206 Partial Content, multiple ranges
+ * and ranges with an If-Range that does not match the ETag are ignored
+ * and the whole file is sent.
+ */
+
 #include <astra.h>
 #include <luaapi/luaapi.h>
 
@@ -31,8 +72,47 @@
 #   endif
 #endif
 
+#ifndef _WIN32
+#   include <sys/mman.h>
+#   define ASC_MMAP 1
+#endif
+
 #include "../http.h"
 
+#define MSG(_msg) "[http_static %s] " _msg, mod->path
+
+#define STATIC_CACHE_BUCKETS 1024
+#define STATIC_CACHE_CHECK 1000000
+#define STATIC_MMAP_FILES 256
+#define STATIC_SEND_SIZE (128 * 1024)
+
+/* defaults */
+#define STATIC_CACHE_SIZE (16 * 1024)
+#define STATIC_CACHE_FILE_SIZE 256
+
+typedef struct static_file_t static_file_t;
+
+struct static_file_t
+{
+    char *name;
+    uint32_t hash;
+
+    static_file_t *next;    // hash bucket
+    static_file_t *lru_prev;
+    static_file_t *lru_next;
+
+    time_t mtime;
+    off_t size;
+    ino_t ino;
+    uint64_t check;         // time of the last stat()
+    char etag[40];
+
+    uint8_t *data;
+    bool is_mmap;
+    bool is_cached;         // false when dropped while clients still use it
+    unsigned int refs;
+};
+
 struct module_data_t
 {
     MODULE_LUA_DATA();
@@ -43,6 +123,26 @@ struct module_data_t
     size_t block_size;
 
     const char *default_mime;
+    bool is_ts_align;
+
+    struct
+    {
+        static_file_t **table;
+        static_file_t *head;    // most recently used
+        static_file_t *tail;
+
+        size_t limit;           // cache_size
+        size_t file_limit;      // cache_file_size
+        bool is_mmap;
+
+        size_t size;            // memory used by cached files
+        unsigned int files;
+        unsigned int mapped;
+
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t not_modified;
+    } cache;
 };
 
 struct http_response_t
@@ -52,17 +152,320 @@ struct http_response_t
     int file_fd;
     int sock_fd;
 
+    static_file_t *file;    // served from the cache, file_fd is not used
+
     off_t file_skip;
     off_t file_size;
 };
 
 static const char __path[] = "path";
+static const char __etag_format[] = "\"%jx-%jx\"";
+
+/*
+ *   oooooooo8     o       oooooooo8 ooooo ooooo ooooooooooo
+ * o888     88    888    o888     88  888   888   888    88
+ * 888           8  88   888          888ooo888   888ooo8
+ * 888o     oo  8oooo88  888o     oo  888   888   888    oo
+ *  888oooo88 o88o  o888o 888oooo88  o888o o888o o888ooo8888
+ *
+ */
+
+static uint32_t file_hash(const char *name)
+{
+    // FNV-1a
+    uint32_t hash = 0x811C9DC5;
+    for(; *name; ++name)
+        hash = (hash ^ (uint8_t)*name) * 0x01000193;
+
+    return hash;
+}
+
+static void file_free(static_file_t *file)
+{
+#ifdef ASC_MMAP
+    if(file->is_mmap)
+        munmap(file->data, file->size);
+    else
+#endif
+        free(file->data);
+
+    free(file->name);
+    free(file);
+}
+
+static void file_release(static_file_t *file)
+{
+    --file->refs;
+    if(!file->refs && !file->is_cached)
+        file_free(file);
+}
+
+static void lru_unlink(module_data_t *mod, static_file_t *file)
+{
+    if(file->lru_prev)
+        file->lru_prev->lru_next = file->lru_next;
+    else
+        mod->cache.head = file->lru_next;
+
+    if(file->lru_next)
+        file->lru_next->lru_prev = file->lru_prev;
+    else
+        mod->cache.tail = file->lru_prev;
+
+    file->lru_prev = NULL;
+    file->lru_next = NULL;
+}
+
+static void lru_push(module_data_t *mod, static_file_t *file)
+{
+    file->lru_prev = NULL;
+    file->lru_next = mod->cache.head;
+
+    if(mod->cache.head)
+        mod->cache.head->lru_prev = file;
+    else
+        mod->cache.tail = file;
+
+    mod->cache.head = file;
+}
+
+/* removes file from the cache, clients that are sending it keep it alive */
+static void cache_remove(module_data_t *mod, static_file_t *file)
+{
+    static_file_t **item = &mod->cache.table[file->hash % STATIC_CACHE_BUCKETS];
+    while(*item != file)
+        item = &(*item)->next;
+    *item = file->next;
+
+    lru_unlink(mod, file);
+
+    --mod->cache.files;
+    if(file->is_mmap)
+        --mod->cache.mapped;
+    else
+        mod->cache.size -= file->size;
+
+    file->is_cached = false;
+    if(!file->refs)
+        file_free(file);
+}
+
+static void cache_insert(module_data_t *mod, static_file_t *file)
+{
+    static_file_t **item = &mod->cache.table[file->hash % STATIC_CACHE_BUCKETS];
+    file->next = *item;
+    *item = file;
+
+    lru_push(mod, file);
+
+    ++mod->cache.files;
+    if(file->is_mmap)
+        ++mod->cache.mapped;
+    else
+        mod->cache.size += file->size;
+
+    file->is_cached = true;
+
+    // drop least recently used files
+    static_file_t *it = mod->cache.tail;
+    while(it && (   mod->cache.size > mod->cache.limit
+                 || mod->cache.mapped > STATIC_MMAP_FILES))
+    {
+        static_file_t *const prev = it->lru_prev;
+
+        if(it->is_mmap ? (mod->cache.mapped > STATIC_MMAP_FILES)
+                       : (mod->cache.size > mod->cache.limit))
+        {
+            cache_remove(mod, it);
+        }
+
+        it = prev;
+    }
+}
+
+/* returns referenced cached file if it is still valid */
+static static_file_t *cache_find(module_data_t *mod, const char *name
+                                 , uint32_t hash)
+{
+    static_file_t *file = mod->cache.table[hash % STATIC_CACHE_BUCKETS];
+    while(file && (file->hash != hash || strcmp(file->name, name)))
+        file = file->next;
+
+    if(!file)
+        return NULL;
+
+    const uint64_t now = asc_utime();
+    if(now - file->check >= STATIC_CACHE_CHECK)
+    {
+        struct stat sb;
+        if(   stat(name, &sb) != 0
+           || sb.st_mtime != file->mtime
+           || sb.st_size != file->size
+           || sb.st_ino != file->ino)
+        {
+            cache_remove(mod, file);
+            return NULL;
+        }
+
+        file->check = now;
+    }
+
+    lru_unlink(mod, file);
+    lru_push(mod, file);
+
+    ++file->refs;
+    return file;
+}
+
+/* reads or maps opened file and returns it referenced,
+ * or NULL if it should be sent with fd */
+static static_file_t *cache_load(module_data_t *mod, const char *name
+                                 , uint32_t hash, int fd, const struct stat *sb)
+{
+    const size_t size = sb->st_size;
+    if(size == 0)
+        return NULL;
+
+    static_file_t *const file = ASC_ALLOC(1, static_file_t);
+
+    if(mod->cache.limit > 0 && size <= mod->cache.file_limit)
+    {
+        file->data = ASC_ALLOC(size, uint8_t);
+
+        size_t skip = 0;
+        while(skip < size)
+        {
+            const ssize_t len = pread(fd, &file->data[skip], size - skip, skip);
+            if(len <= 0)
+            {
+                free(file->data);
+                free(file);
+                return NULL;
+            }
+            skip += len;
+        }
+    }
+#ifdef ASC_MMAP
+    else if(mod->cache.is_mmap && !mod->is_ts_align)
+    {
+        void *const data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(data == MAP_FAILED)
+        {
+            asc_log_error(MSG("mmap() failed: %s"), asc_error_msg());
+            free(file);
+            return NULL;
+        }
+
+        file->data = (uint8_t *)data;
+        file->is_mmap = true;
+    }
+#endif
+    else
+    {
+        free(file);
+        return NULL;
+    }
+
+    file->name = strdup(name);
+    file->hash = hash;
+    file->mtime = sb->st_mtime;
+    file->size = sb->st_size;
+    file->ino = sb->st_ino;
+    file->check = asc_utime();
+    snprintf(file->etag, sizeof(file->etag), __etag_format
+             , (uintmax_t)file->mtime, (uintmax_t)file->size);
+
+    // referenced before insert, the file may not fit into the cache
+    file->refs = 1;
+    cache_insert(mod, file);
+
+    return file;
+}
+
+/* returns request header, the string is kept by the request table */
+static const char *lua_get_header(lua_State *L, http_client_t *client
+                                  , const char *name)
+{
+    const char *value = NULL;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, client->idx_request);
+    lua_getfield(L, -1, "headers");
+    if(lua_istable(L, -1))
+    {
+        lua_getfield(L, -1, name);
+        value = lua_tostring(L, -1);
+        lua_pop(L, 1); // name
+    }
+    lua_pop(L, 2); // request + headers
+
+    return value;
+}
+
+/* If-None-Match: "etag", W/"etag" or * */
+static bool is_not_modified(lua_State *L, http_client_t *client, const char *etag)
+{
+    const char *const value = lua_get_header(L, client, "if-none-match");
+    if(!value)
+        return false;
+
+    const size_t etag_size = strlen(etag);
+    bool is_match = (value[0] == '*');
+
+    const char *p = strchr(value, '"');
+    while(p && !is_match)
+    {
+        const char *const q = strchr(p + 1, '"');
+        if(!q)
+            break;
+
+        is_match = (   (size_t)(q - p + 1) == etag_size
+                    && !strncmp(p, etag, etag_size));
+        p = strchr(q + 1, '"');
+    }
+
+    return is_match;
+}
+
+/*
+ *  oooooooo8 ooooooooooo oooo   oooo ooooooooo
+ * 888         888    88   8888o  88   888    88o
+ *  888oooooo  888ooo8     88 888o88   888    888
+ *         888 888    oo   88   8888   888    888
+ * o88oooo888 o888ooo8888 o88o    88  o888ooo88
+ *
+ */
 
 /*
  * client->mod - http_server module
  * client->response->mod - http_static module
  */
 
+static void on_ready_send_cache(void *arg)
+{
+    http_client_t *const client = (http_client_t *)arg;
+    http_response_t *const response = client->response;
+    const static_file_t *const file = response->file;
+
+    size_t size = response->file_size - response->file_skip;
+    if(size > STATIC_SEND_SIZE)
+        size = STATIC_SEND_SIZE;
+
+    const ssize_t send_size = asc_socket_send(  client->sock
+                                              , &file->data[response->file_skip]
+                                              , size);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send file: %s", asc_error_msg());
+        http_client_close(client);
+        return;
+    }
+
+    response->file_skip += send_size;
+
+    if(response->file_skip >= response->file_size)
+        http_client_done(client);
+}
+
 static void on_ready_send_file(void *arg)
 {
     http_client_t *const client = (http_client_t *)arg;
@@ -70,10 +473,15 @@ static void on_ready_send_file(void *arg)
 
     ssize_t send_size;
 
+    size_t size = response->file_size - response->file_skip;
+
     if(!response->mod->block_size)
     {
+        if(size > HTTP_BUFFER_SIZE)
+            size = HTTP_BUFFER_SIZE;
+
         const ssize_t len = pread(  response->file_fd
-                                  , client->buffer, HTTP_BUFFER_SIZE
+                                  , client->buffer, size
                                   , response->file_skip);
         if(len <= 0)
             send_size = -1;
@@ -82,15 +490,19 @@ static void on_ready_send_file(void *arg)
     }
     else
     {
+        if(size > response->mod->block_size)
+            size = response->mod->block_size;
+
 #if defined(__linux)
 
+        off_t offset = response->file_skip;
         send_size = sendfile(  response->sock_fd
                              , response->file_fd
-                             , NULL, response->mod->block_size);
+                             , &offset, size);
 
 #elif defined(__APPLE__)
 
-        off_t block_size = response->mod->block_size;
+        off_t block_size = size;
         const int r = sendfile(  response->file_fd
                                , response->sock_fd
                                , response->file_skip
@@ -107,7 +519,7 @@ static void on_ready_send_file(void *arg)
         const int r = sendfile(  response->file_fd
                                , response->sock_fd
                                , response->file_skip
-                               , response->mod->block_size, NULL
+                               , size, NULL
                                , &block_size, 0);
 
         if(r == 0 || (r == -1 && errno == EAGAIN && block_size > 0))
@@ -132,13 +544,13 @@ static void on_ready_send_file(void *arg)
     response->file_skip += send_size;
 
     if(response->file_skip >= response->file_size)
-        http_client_close(client);
+        http_client_done(client);
 }
 
-static const char *lua_get_mime(lua_State *L, http_client_t *client
+static const char *lua_get_mime(lua_State *L, module_data_t *mod
                                 , const char *path)
 {
-    const char *mime = client->response->mod->default_mime;
+    const char *mime = mod->default_mime;
     size_t dot = 0;
     for(size_t i = 0; true; ++i)
     {
@@ -168,6 +580,16 @@ static const char *lua_get_mime(lua_State *L, http_client_t *client
     return mime;
 }
 
+static void response_free(http_response_t *response)
+{
+    if(response->file)
+        file_release(response->file);
+    else if(response->file_fd != -1)
+        close(response->file_fd);
+
+    free(response);
+}
+
 /* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
 static int module_call(lua_State *L, module_data_t *mod)
 {
@@ -177,20 +599,12 @@ static int module_call(lua_State *L, module_data_t *mod)
     {
         if(client->response)
         {
-            close(client->response->file_fd);
-            free(client->response);
+            response_free(client->response);
             client->response = NULL;
         }
         return 0;
     }
 
-    client->response = ASC_ALLOC(1, http_response_t);
-    client->response->mod = mod;
-    client->on_send = NULL;
-    client->on_read = NULL;
-    client->on_ready = on_ready_send_file;
-    client->response->sock_fd = asc_socket_fd(client->sock);
-
     lua_rawgeti(L, LUA_REGISTRYINDEX, client->idx_request);
     lua_getfield(L, -1, __path);
     const char *path = lua_tostring(L, -1);
@@ -198,40 +612,143 @@ static int module_call(lua_State *L, module_data_t *mod)
 
     char *const filename = ASC_ALLOC(PATH_MAX, char);
     snprintf(filename, PATH_MAX, "%s%s", mod->path, &path[mod->path_skip]);
-    client->response->file_fd = open(filename, O_RDONLY);
+    const uint32_t hash = file_hash(filename);
+
+    http_response_t *const response = ASC_ALLOC(1, http_response_t);
+    response->mod = mod;
+    response->file_fd = -1;
+    response->sock_fd = asc_socket_fd(client->sock);
+
+    char etag[40];
+
+    response->file = cache_find(mod, filename, hash);
+    if(response->file)
+    {
+        ++mod->cache.hits;
+    }
+    else
+    {
+        ++mod->cache.misses;
+
+        response->file_fd = open(filename, O_RDONLY);
+        if(response->file_fd == -1)
+        {
+            http_client_warning(client, "file not found %s", path);
+
+            free(filename);
+            free(response);
+
+            http_client_abort(client, 404, NULL);
+            return 0;
+        }
+
+        struct stat sb;
+        fstat(response->file_fd, &sb);
+
+        if(!S_ISREG(sb.st_mode))
+        {
+            http_client_warning(client, "wrong file type %s", path);
+
+            free(filename);
+            response_free(response);
+
+            http_client_abort(client, 404, NULL);
+            return 0;
+        }
+
+        response->file = cache_load(mod, filename, hash, response->file_fd, &sb);
+        if(response->file)
+        {
+            close(response->file_fd);
+            response->file_fd = -1;
+        }
+        else
+        {
+            response->file_size = sb.st_size;
+            snprintf(etag, sizeof(etag), __etag_format
+                     , (uintmax_t)sb.st_mtime, (uintmax_t)sb.st_size);
+        }
+    }
+
     free(filename);
 
-    if(client->response->file_fd == -1)
+    if(response->file)
     {
-        http_client_warning(client, "file not found %s", path);
+        response->file_size = response->file->size;
+        strcpy(etag, response->file->etag);
+    }
 
-        free(client->response);
-        client->response = NULL;
+    if(is_not_modified(L, client, etag))
+    {
+        ++mod->cache.not_modified;
+        response_free(response);
 
-        http_client_abort(client, 404, NULL);
+        http_response_code(client, 304, NULL);
+        http_response_header(client, "ETag: %s", etag);
+        http_response_send(client);
         return 0;
     }
 
-    struct stat sb;
-    fstat(client->response->file_fd, &sb);
+    const off_t file_size = response->file_size;
+    off_t first = 0;
+    off_t last = file_size - 1;
+    int range = 0;
 
-    if(!S_ISREG(sb.st_mode))
+    const char *const value = lua_get_header(L, client, "range");
+    if(value)
     {
-        http_client_warning(client, "wrong file type %s", path);
+        const char *const if_range = lua_get_header(L, client, "if-range");
+        if(!if_range || !strcmp(if_range, etag))
+            range = http_parse_range(value, file_size, &first, &last);
+    }
 
-        close(client->response->file_fd);
-        free(client->response);
-        client->response = NULL;
+    if(range == -1)
+    {
+        response_free(response);
 
-        http_client_abort(client, 404, NULL);
+        http_response_code(client, 416, NULL);
+        http_response_header(client, "Content-Range: bytes */%jd", (intmax_t)file_size);
+        http_response_header(client, "Content-Length: 0");
+        http_response_send(client);
         return 0;
     }
 
-    client->response->file_size = sb.st_size;
+    if(range == 1 && mod->is_ts_align)
+    {
+        // start and end on the packet boundaries
+        first -= first % TS_PACKET_SIZE;
 
-    http_response_code(client, 200, NULL);
-    http_response_header(client, "Content-Length: %jd", client->response->file_size);
-    http_response_header(client, "Content-Type: %s", lua_get_mime(L, client, path));
+        off_t length = last + 1 - first;
+        if(length >= TS_PACKET_SIZE)
+            length -= length % TS_PACKET_SIZE;
+        last = first + length - 1;
+    }
+
+    response->file_skip = first;
+    response->file_size = last + 1;
+
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = (response->file) ? on_ready_send_cache : on_ready_send_file;
+
+    // empty file has nothing to send after the headers
+    const off_t length = last + 1 - first;
+    if(length > 0)
+        client->response = response;
+    else
+        response_free(response);
+
+    http_response_code(client, (range == 1) ? 206 : 200, NULL);
+    if(range == 1)
+    {
+        http_response_header(client, "Content-Range: bytes %jd-%jd/%jd"
+                             , (intmax_t)first, (intmax_t)last
+                             , (intmax_t)file_size);
+    }
+    http_response_header(client, "Content-Length: %jd", (intmax_t)length);
+    http_response_header(client, "Content-Type: %s", lua_get_mime(L, mod, path));
+    http_response_header(client, "Accept-Ranges: bytes");
+    http_response_header(client, "ETag: %s", etag);
     http_response_send(client);
 
     return 0;
@@ -274,6 +791,22 @@ static void module_init(lua_State *L, module_data_t *mod)
     mod->default_mime = "application/octet-stream";
     module_option_string(L, "default_mime", &mod->default_mime, NULL);
 
+    int value = STATIC_CACHE_SIZE;
+    module_option_integer(L, "cache_size", &value);
+    asc_assert(value >= 0, MSG("option 'cache_size' is out of range"));
+    mod->cache.limit = (size_t)value * 1024;
+
+    value = STATIC_CACHE_FILE_SIZE;
+    module_option_integer(L, "cache_file_size", &value);
+    asc_assert(value >= 0, MSG("option 'cache_file_size' is out of range"));
+    mod->cache.file_limit = (size_t)value * 1024;
+
+    module_option_boolean(L, "mmap", &mod->cache.is_mmap);
+
+    module_option_boolean(L, "ts_align", &mod->is_ts_align);
+
+    mod->cache.table = ASC_ALLOC(STATIC_CACHE_BUCKETS, static_file_t *);
+
     struct stat s;
     asc_assert(stat(mod->path, &s) != -1, "[http_static] path is not found");
     asc_assert(S_ISDIR(s.st_mode), "[http_static] path is not directory");
@@ -286,13 +819,35 @@ static void module_init(lua_State *L, module_data_t *mod)
     lua_pop(L, 1);
 }
 
+static int method_stat(lua_State *L, module_data_t *mod)
+{
+    lua_newtable(L);
+    lua_pushnumber(L, mod->cache.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, mod->cache.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, mod->cache.not_modified);
+    lua_setfield(L, -2, "not_modified");
+    lua_pushinteger(L, mod->cache.files);
+    lua_setfield(L, -2, "files");
+    lua_pushinteger(L, mod->cache.mapped);
+    lua_setfield(L, -2, "mapped");
+    lua_pushnumber(L, mod->cache.size);
+    lua_setfield(L, -2, "size");
+
+    return 1;
+}
+
 static void module_destroy(module_data_t *mod)
 {
-    __uarg(mod);
+    while(mod->cache.head)
+        cache_remove(mod, mod->cache.head);
+
+    ASC_FREE(mod->cache.table, free);
 }
 
 MODULE_LUA_METHODS()
 {
-    { NULL, NULL },
+    { "stat", method_stat },
 };
 MODULE_LUA_REGISTER(http_static)
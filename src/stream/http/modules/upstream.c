@@ -19,18 +19,34 @@
  */
 
 #include <astra.h>
+#include <core/mainloop.h>
+#include <core/timer.h>
 #include <luaapi/stream.h>
 
 #include "../http.h"
+#include "../burst.h"
 
 #define DEFAULT_BUFFER_SIZE (1024 * 1024)
 #define DEFAULT_BUFFER_FILL (128 * 1024)
 
+/* smaller sends are cheaper to copy than to pin */
+#define ZEROCOPY_MIN_SIZE (64 * 1024)
+#define ZEROCOPY_PENDING 64
+
+#define DEFAULT_OVERFLOW_PERIOD 10
+
+/* streams without random access indicators resume at any payload start */
+#define SKIP_TIMEOUT (2 * 1000000)
+
+/* poll interval while the stream bitrate for rate_factor is unknown, ms */
+#define SHAPER_RATE_WAIT 100
+
 struct module_data_t
 {
     MODULE_LUA_DATA();
 
     int idx_callback;
+    http_upstream_config_t config;
 };
 
 struct http_response_t
@@ -48,73 +64,368 @@ struct http_response_t
     size_t buffer_fill;
 
     bool is_socket_busy;
+
+    // fast channel change
+    size_t burst_size;
+    http_burst_t *burst;
+    http_burst_t *fallback_burst;   // tables of the fallback stream
+    http_burst_snapshot_t snap;
+    size_t snap_skip;
+
+    // zerocopy send, ring space stays pinned until the kernel is done
+    bool is_zerocopy;
+    uint32_t zc_sent;       // zerocopy sends queued
+    uint64_t zc_total;      // bytes sent from the ring
+    uint64_t zc_released;   // bytes the ring may reuse
+
+    struct
+    {
+        uint32_t id;
+        uint64_t end;       // zc_total after this send
+    } zc_pending[ZEROCOPY_PENDING];
+    unsigned int zc_head;
+    unsigned int zc_count;
+
+    // slow client policy
+    http_overflow_t overflow;
+    module_stream_t *fallback;
+    bool is_skip;           // waiting for the next random access point
+    uint64_t skip_time;
+    bool is_degraded;
+    bool is_closing;
+
+    unsigned int overflow_limit;
+    uint64_t overflow_period;
+    uint64_t *overflow_time;    // last overflow_limit overflows
+    unsigned int overflow_index;
+
+    uint64_t overflows;
+    uint64_t dropped;       // bytes
+
+    // egress shaping
+    unsigned int rate_limit;
+    double rate_factor;
+    http_shaper_t shaper;
+    asc_timer_t *shaper_timer;
+    uint64_t shaper_time;   // last rate update
+    bool is_paced;          // the kernel paces the socket as well
+    uint64_t throttled;
 };
 
 /*
  * client->mod - http_server module
- * client->response->mod - http_upstream module
+ * client->response->mod - http_upstream module, NULL for native stream routes
  */
 
+static void on_upstream_ready(void *arg);
+
+static void on_shaper_timer(void *arg)
+{
+    http_client_t *const client = (http_client_t *)arg;
+    http_response_t *const response = client->response;
+
+    response->shaper_timer = NULL;
+
+    if(response->is_socket_busy)
+        asc_socket_set_on_ready(client->sock, on_upstream_ready);
+}
+
+/* returns false until the stream bitrate for rate_factor is measured */
+static bool shaper_update(http_client_t *client, uint64_t now)
+{
+    http_response_t *const response = client->response;
+
+    if(response->shaper_time != 0 && now - response->shaper_time < 1000000)
+        return true;
+
+    uint64_t rate = 0;
+    if(response->rate_limit > 0)
+        rate = response->rate_limit * 1000ULL / 8;
+    else if(response->rate_factor > 0 && response->burst)
+        rate = http_burst_bitrate(response->burst) * response->rate_factor;
+
+    // zero rate is unlimited, wait for the measurement instead
+    if(rate == 0 && response->rate_limit == 0 && response->rate_factor > 0)
+        return false;
+
+    response->shaper_time = now;
+
+    const uint64_t current = response->shaper.rate;
+    if(rate == current)
+        return true;
+
+    // ignore bitrate jitter
+    if(rate > 0 && current > 0 && rate < current * 21 / 20 && rate > current * 19 / 20)
+        return true;
+
+    http_shaper_set_rate(&response->shaper, rate);
+
+    const uint64_t pacing = (rate > 0) ? rate * 21 / 20 : UINT32_MAX;
+    response->is_paced = asc_socket_set_pacing_rate(client->sock
+                                                    , (pacing < UINT32_MAX)
+                                                      ? pacing
+                                                      : UINT32_MAX)
+                       && rate > 0;
+
+    return true;
+}
+
+/* returns send budget, zero if the client has to wait */
+static size_t shaper_budget(http_client_t *client, size_t pending)
+{
+    http_response_t *const response = client->response;
+    http_shaper_t *const egress = client->shaper;
+
+    const uint64_t now = asc_utime();
+    if(!shaper_update(client, now))
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        if(!response->shaper_timer)
+        {
+            response->shaper_timer = asc_timer_one_shot(SHAPER_RATE_WAIT
+                                                        , on_shaper_timer
+                                                        , client);
+        }
+
+        return 0;
+    }
+
+    size_t budget = HTTP_SEND_BUDGET;
+
+    const size_t tokens = http_shaper_get(&response->shaper, now);
+    if(tokens < budget)
+        budget = tokens;
+
+    const size_t egress_tokens = (egress) ? http_shaper_get(egress, now) : SIZE_MAX;
+    if(egress_tokens < budget)
+        budget = egress_tokens;
+
+    const size_t chunk = (pending < HTTP_SHAPER_CHUNK) ? pending : HTTP_SHAPER_CHUNK;
+    if(budget >= chunk)
+        return budget;
+
+    unsigned int delay = http_shaper_delay(&response->shaper, chunk);
+    ++response->throttled;
+
+    if(egress_tokens < chunk)
+    {
+        const unsigned int egress_delay = http_shaper_delay(egress, chunk);
+        if(egress_delay > delay)
+            delay = egress_delay;
+
+        ++egress->throttled;
+    }
+
+    asc_socket_set_on_ready(client->sock, NULL);
+    if(!response->shaper_timer)
+        response->shaper_timer = asc_timer_one_shot(delay, on_shaper_timer, client);
+
+    return 0;
+}
+
 static void on_upstream_ready(void *arg)
 {
     http_client_t *const client = (http_client_t *)arg;
     http_response_t *const response = client->response;
 
-    if(response->buffer_count > 0)
+    size_t budget = HTTP_SEND_BUDGET;
+
+    if(   response->rate_limit > 0
+       || response->rate_factor > 0
+       || client->shaper)
     {
-        size_t block_size = (response->buffer_write > response->buffer_read)
-                          ? (response->buffer_write - response->buffer_read)
-                          : (response->buffer_size - response->buffer_read);
+        const http_burst_snapshot_t *const snap = &response->snap;
+        const size_t pending = response->buffer_count + ((snap->block)
+                             ? snap->psi_size + snap->size - response->snap_skip
+                             : 0);
 
-        if(block_size > response->buffer_count)
-            block_size = response->buffer_count;
+        budget = shaper_budget(client, pending);
+        if(budget == 0)
+            return;
+    }
 
-        const ssize_t send_size = asc_socket_send(  client->sock
-                                                  , &response->buffer[response->buffer_read]
-                                                  , block_size);
+    const size_t budget_total = budget;
 
-        if(send_size > 0)
+    while(budget > 0)
+    {
+        asc_socket_buf_t buf[4];
+        unsigned int count = 0;
+
+        // tables and buffered data first, then the live stream
+        const http_burst_snapshot_t *const snap = &response->snap;
+        size_t snap_left = 0;
+        if(snap->block)
         {
-            response->buffer_count -= send_size;
-            response->buffer_read += send_size;
-            if(response->buffer_read >= response->buffer_size)
-                response->buffer_read = 0;
+            const size_t skip = response->snap_skip;
+            snap_left = snap->psi_size + snap->size - skip;
+
+            if(skip < snap->psi_size)
+            {
+                buf[count].data = &snap->psi[skip];
+                buf[count].size = snap->psi_size - skip;
+                ++count;
+                buf[count].data = snap->data;
+                buf[count].size = snap->size;
+                ++count;
+            }
+            else
+            {
+                buf[count].data = &snap->data[skip - snap->psi_size];
+                buf[count].size = snap_left;
+                ++count;
+            }
+        }
+
+        // ring buffer, both parts if it is wrapped
+        if(response->buffer_count > 0)
+        {
+            size_t head = response->buffer_size - response->buffer_read;
+            if(head > response->buffer_count)
+                head = response->buffer_count;
+
+            buf[count].data = &response->buffer[response->buffer_read];
+            buf[count].size = head;
+            ++count;
+
+            if(response->buffer_count > head)
+            {
+                buf[count].data = response->buffer;
+                buf[count].size = response->buffer_count - head;
+                ++count;
+            }
+        }
+
+        size_t block_size = 0;
+        for(unsigned int i = 0; i < count; i++)
+        {
+            if(buf[i].size > budget - block_size)
+            {
+                buf[i].size = budget - block_size;
+                count = i + 1;
+            }
+            block_size += buf[i].size;
+        }
+
+        if(block_size == 0)
+            break;
+
+        bool is_zerocopy = false;
+        ssize_t send_size;
+
+        if(   response->is_zerocopy
+           && snap_left == 0
+           && block_size >= ZEROCOPY_MIN_SIZE
+           && response->zc_count < ZEROCOPY_PENDING)
+        {
+            send_size = asc_socket_sendv_zerocopy(client->sock, buf, count
+                                                  , &is_zerocopy);
+        }
+        else
+        {
+            send_size = asc_socket_sendv(client->sock, buf, count);
         }
-        else if(send_size == -1)
+
+        if(send_size == -1)
         {
             http_client_error(client, "failed to send ts (%zu bytes): %s"
                               , block_size, asc_error_msg());
             http_client_close(client);
             return;
         }
+
+        size_t sent = send_size;
+        budget -= sent;
+
+        if(snap_left > 0)
+        {
+            const size_t snap_sent = (sent < snap_left) ? sent : snap_left;
+            response->snap_skip += snap_sent;
+            sent -= snap_sent;
+
+            if(snap_sent == snap_left)
+                http_burst_release(&response->snap);
+        }
+
+        if(sent > 0)
+        {
+            response->buffer_count -= sent;
+            response->buffer_read += sent;
+            if(response->buffer_read >= response->buffer_size)
+                response->buffer_read -= response->buffer_size;
+
+            response->zc_total += sent;
+            if(is_zerocopy)
+            {
+                const unsigned int i = (response->zc_head + response->zc_count)
+                                     % ZEROCOPY_PENDING;
+                response->zc_pending[i].id = response->zc_sent++;
+                response->zc_pending[i].end = response->zc_total;
+                ++response->zc_count;
+            }
+            else if(response->zc_count == 0)
+            {
+                response->zc_released = response->zc_total;
+            }
+        }
+
+        // socket buffer is full
+        if((size_t)send_size < block_size)
+            break;
     }
 
-    if(response->buffer_count == 0)
+    const size_t sent_total = budget_total - budget;
+    http_shaper_put(&response->shaper, sent_total);
+    if(client->shaper)
+        http_shaper_put(client->shaper, sent_total);
+
+    if(!response->snap.block && response->buffer_count == 0)
     {
         asc_socket_set_on_ready(client->sock, NULL);
         response->is_socket_busy = false;
     }
 }
 
-static void on_ts(void *arg, const uint8_t *ts)
+static void on_upstream_zerocopy(void *arg)
 {
     http_client_t *const client = (http_client_t *)arg;
     http_response_t *const response = client->response;
 
-    if(response->buffer_count + TS_PACKET_SIZE >= response->buffer_size)
+    bool is_copied = false;
+    const uint32_t done = asc_socket_zerocopy_done(client->sock, &is_copied);
+
+    while(response->zc_count > 0)
     {
-        // overflow
-        response->buffer_count = 0;
-        response->buffer_read = 0;
-        response->buffer_write = 0;
-        if(response->is_socket_busy)
-        {
-            asc_socket_set_on_ready(client->sock, NULL);
-            response->is_socket_busy = false;
-        }
-        return;
+        const unsigned int i = response->zc_head;
+        if((int32_t)(response->zc_pending[i].id - done) >= 0)
+            break;
+
+        response->zc_released = response->zc_pending[i].end;
+        response->zc_head = (i + 1) % ZEROCOPY_PENDING;
+        --response->zc_count;
     }
 
+    if(response->zc_count == 0)
+        response->zc_released = response->zc_total;
+
+    if(is_copied && response->is_zerocopy)
+    {
+        // the device can't send from user pages, copying is cheaper
+        asc_log_debug("[http_upstream] zerocopy is not supported by the device"
+                      ", disabled for %s:%d"
+                      , asc_socket_addr(client->sock)
+                      , asc_socket_port(client->sock));
+        response->is_zerocopy = false;
+    }
+}
+
+static bool ring_push(http_response_t *response, const uint8_t *ts)
+{
+    // sent data that is still pinned by zerocopy sends
+    const size_t pinned = response->zc_total - response->zc_released;
+
+    if(response->buffer_count + pinned + TS_PACKET_SIZE >= response->buffer_size)
+        return false;
+
     const size_t buffer_write = response->buffer_write + TS_PACKET_SIZE;
     if(buffer_write < response->buffer_size)
     {
@@ -135,6 +446,141 @@ static void on_ts(void *arg, const uint8_t *ts)
     }
     response->buffer_count += TS_PACKET_SIZE;
 
+    return true;
+}
+
+static void on_ts(void *arg, const uint8_t *ts);
+
+static void on_overflow_close(void *arg)
+{
+    http_client_t *const client = (http_client_t *)arg;
+
+    http_client_warning(client, "client is too slow, %" PRIu64 " overflows"
+                        , client->response->overflows);
+    http_client_close(client);
+}
+
+static void on_overflow_degrade(void *arg)
+{
+    http_client_t *const client = (http_client_t *)arg;
+    http_response_t *const response = client->response;
+
+    // can't be done from on_ts(), the upstream is walking its children
+    module_stream_destroy(response);
+    ASC_FREE(response->burst, http_burst_detach);
+    response->burst = response->fallback_burst;
+    response->fallback_burst = NULL;
+
+    response->__stream.self = (module_data_t *)client;
+    response->__stream.on_ts = (stream_callback_t)on_ts;
+    __module_stream_init(&response->__stream);
+    __module_stream_attach(response->fallback, &response->__stream);
+
+    response->is_skip = true;
+    response->skip_time = asc_utime();
+}
+
+static void on_overflow(http_client_t *client)
+{
+    http_response_t *const response = client->response;
+
+    // keep the rest of a partially sent packet
+    const size_t partial = response->buffer_count % TS_PACKET_SIZE;
+
+    response->dropped += response->buffer_count - partial;
+    response->buffer_count = partial;
+    response->buffer_write = (response->buffer_read + partial) % response->buffer_size;
+
+    if(response->buffer_count == 0 && response->is_socket_busy && !response->snap.block)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+    }
+
+    ++response->overflows;
+
+    const uint64_t now = asc_utime();
+    if(!response->is_skip)
+        response->skip_time = now;
+
+    if(response->overflow_limit > 0)
+    {
+        uint64_t *const first = &response->overflow_time[response->overflow_index];
+
+        // oldest of the last overflow_limit overflows
+        if(*first != 0 && now - *first < response->overflow_period)
+        {
+            response->is_closing = true;
+            asc_job_queue(response, on_overflow_close, client);
+            return;
+        }
+
+        *first = now;
+        response->overflow_index = (response->overflow_index + 1)
+                                 % response->overflow_limit;
+    }
+
+    switch(response->overflow)
+    {
+        case HTTP_OVERFLOW_RESET:
+            break;
+
+        case HTTP_OVERFLOW_DEGRADE:
+            if(response->fallback && !response->is_degraded)
+            {
+                response->is_degraded = true;
+                asc_job_queue(response, on_overflow_degrade, client);
+            }
+            response->is_skip = true;
+            break;
+
+        case HTTP_OVERFLOW_SKIP:
+            response->is_skip = true;
+            break;
+    }
+}
+
+static void on_ts(void *arg, const uint8_t *ts)
+{
+    http_client_t *const client = (http_client_t *)arg;
+    http_response_t *const response = client->response;
+
+    if(response->is_closing)
+        return;
+
+    if(response->is_skip)
+    {
+        // wait for the tables, streams without them resume after a while
+        const bool is_start = http_burst_has_psi(response->burst)
+                           && http_burst_is_start(response->burst, ts);
+
+        if(   !is_start
+           && (   !TS_IS_PAYLOAD_START(ts)
+               || asc_utime() - response->skip_time < SKIP_TIMEOUT))
+        {
+            response->dropped += TS_PACKET_SIZE;
+            return;
+        }
+
+        // resume with the tables and the keyframe
+        uint8_t psi[HTTP_BURST_PSI_SIZE];
+        const size_t psi_size = http_burst_psi(response->burst, psi, sizeof(psi));
+
+        for(size_t i = 0; i < psi_size; i += TS_PACKET_SIZE)
+        {
+            if(!ring_push(response, &psi[i]))
+                break;
+        }
+
+        response->is_skip = false;
+    }
+
+    if(!ring_push(response, ts))
+    {
+        on_overflow(client);
+        return;
+    }
+
     if(   response->is_socket_busy == false
        && response->buffer_count >= response->buffer_fill)
     {
@@ -152,6 +598,10 @@ static void on_upstream_read(void *arg)
         http_client_close(client);
 }
 
+static void upstream_start(http_client_t *client, module_stream_t *upstream
+                           , const http_upstream_config_t *config
+                           , const char *content_type);
+
 static void on_upstream_send(void *arg)
 {
     http_client_t *const client = (http_client_t *)arg;
@@ -159,8 +609,7 @@ static void on_upstream_send(void *arg)
 
     module_stream_t *upstream = NULL;
 
-    client->response->buffer_size = DEFAULT_BUFFER_SIZE;
-    client->response->buffer_fill = DEFAULT_BUFFER_FILL;
+    http_upstream_config_t config = client->response->mod->config;
 
     if(lua_istable(L, 3))
     {
@@ -169,25 +618,22 @@ static void on_upstream_send(void *arg)
             upstream = (module_stream_t *)lua_touserdata(L, -1);
         lua_pop(L, 1);
 
-        lua_getfield(L, 3, "buffer_size");
-        if(lua_isnumber(L, -1))
+        const char *const error = http_upstream_config(L, 3, &config);
+        if(error)
         {
-            client->response->buffer_size = lua_tonumber(L, -1) * 1024;
-            if(client->response->buffer_size == 0)
-                client->response->buffer_size = DEFAULT_BUFFER_SIZE;
+            http_client_error(client, "%s", error);
+            http_client_abort(client, 500, "server configuration error");
+            return;
         }
-        lua_pop(L, 1);
 
-        lua_getfield(L, 3, "buffer_fill");
-        if(lua_isnumber(L, -1))
-        {
-            client->response->buffer_fill = lua_tonumber(L, -1) * 1024;
-            if(client->response->buffer_fill == 0)
-                client->response->buffer_fill = DEFAULT_BUFFER_FILL;
-        }
-        lua_pop(L, 1);
+        const size_t buffer_size = (config.buffer_size > 0)
+                                 ? config.buffer_size
+                                 : DEFAULT_BUFFER_SIZE;
+        const size_t buffer_fill = (config.buffer_fill > 0)
+                                 ? config.buffer_fill
+                                 : DEFAULT_BUFFER_FILL;
 
-        if(client->response->buffer_size <= client->response->buffer_fill)
+        if(buffer_size <= buffer_fill)
         {
             http_client_error(client, "buffer_size must be greater than buffer_fill");
             http_client_abort(client, 500, "server configuration error");
@@ -205,6 +651,44 @@ static void on_upstream_send(void *arg)
         return;
     }
 
+    const char *content_type = lua_isstring(L, 4)
+                             ? lua_tostring(L, 4)
+                             : NULL;
+
+    upstream_start(client, upstream, &config, content_type);
+}
+
+static void upstream_start(http_client_t *client, module_stream_t *upstream
+                           , const http_upstream_config_t *config
+                           , const char *content_type)
+{
+    http_response_t *const response = client->response;
+
+    response->buffer_size = (config->buffer_size > 0)
+                          ? config->buffer_size
+                          : DEFAULT_BUFFER_SIZE;
+    response->buffer_fill = (config->buffer_fill > 0)
+                          ? config->buffer_fill
+                          : DEFAULT_BUFFER_FILL;
+
+    if(response->buffer_size <= response->buffer_fill)
+        response->buffer_fill = response->buffer_size / 2;
+
+    response->burst_size = config->burst_size;
+    response->is_zerocopy = config->is_zerocopy;
+
+    response->overflow = config->overflow;
+    response->fallback = config->fallback;
+    response->overflow_limit = config->overflow_limit;
+    response->overflow_period = (config->overflow_period > 0)
+                              ? config->overflow_period * 1000000ULL
+                              : DEFAULT_OVERFLOW_PERIOD * 1000000ULL;
+    if(response->overflow_limit > 0)
+        response->overflow_time = ASC_ALLOC(response->overflow_limit, uint64_t);
+
+    response->rate_limit = config->rate_limit;
+    response->rate_factor = config->rate_factor;
+
     client->response->buffer = ASC_ALLOC(client->response->buffer_size, uint8_t);
 
     // like module_stream_init()
@@ -216,9 +700,32 @@ static void on_upstream_send(void *arg)
     client->on_read = on_upstream_read;
     client->on_ready = NULL;
 
-    const char *content_type = lua_isstring(L, 4)
-                             ? lua_tostring(L, 4)
-                             : "application/octet-stream";
+    if(client->response->is_zerocopy)
+    {
+        client->response->is_zerocopy =
+            asc_socket_set_zerocopy(client->sock, on_upstream_zerocopy);
+    }
+
+    // tables are required to resume after overflow,
+    // the stream bitrate to shape the client
+    if(   response->burst_size > 0
+       || response->overflow != HTTP_OVERFLOW_RESET
+       || response->rate_factor > 0)
+        response->burst = http_burst_attach(upstream, response->burst_size);
+
+    // fallback tables are collected in advance to switch without a gap
+    if(response->overflow == HTTP_OVERFLOW_DEGRADE && response->fallback)
+        response->fallback_burst = http_burst_attach(response->fallback, 0);
+
+    // start sending right after the response header
+    if(response->burst_size > 0 && http_burst_get(response->burst, &response->snap))
+    {
+        client->on_ready = on_upstream_ready;
+        response->is_socket_busy = true;
+    }
+
+    if(!content_type)
+        content_type = "application/octet-stream";
 
     http_response_code(client, 200, NULL);
     http_response_header(client, "Cache-Control: no-cache");
@@ -242,11 +749,7 @@ static int module_call(lua_State *L, module_data_t *mod)
             lua_pushvalue(L, 4);
             lua_call(L, 3, 0);
 
-            module_stream_destroy(client->response);
-
-            free(client->response->buffer);
-            free(client->response);
-            client->response = NULL;
+            http_upstream_release(client);
         }
         return 0;
     }
@@ -265,6 +768,150 @@ static int module_call(lua_State *L, module_data_t *mod)
     return 0;
 }
 
+/*
+ * Native stream routes of the http_server, no Lua involved
+ */
+
+void http_upstream_send(http_client_t *client, module_stream_t *upstream
+                        , const http_upstream_config_t *config)
+{
+    client->response = ASC_ALLOC(1, http_response_t);
+    upstream_start(client, upstream, config, NULL);
+}
+
+void http_upstream_release(http_client_t *client)
+{
+    if(!client->response)
+        return;
+
+    asc_job_prune(client->response);
+    module_stream_destroy(client->response);
+    ASC_FREE(client->response->shaper_timer, asc_timer_destroy);
+
+    // the kernel keeps reading unsent zerocopy data from the ring, drop
+    // the connection before the ring is freed. asc_socket_close() does
+    // the same if the client has disconnected already
+    if(client->sock && (client->response->is_zerocopy || client->response->zc_sent > 0))
+    {
+        if(client->response->zc_count > 0)
+            asc_socket_zerocopy_abort(client->sock);
+
+        asc_socket_set_zerocopy(client->sock, NULL);
+    }
+
+    http_burst_release(&client->response->snap);
+    ASC_FREE(client->response->burst, http_burst_detach);
+    ASC_FREE(client->response->fallback_burst, http_burst_detach);
+
+    free(client->response->overflow_time);
+    free(client->response->buffer);
+    free(client->response);
+    client->response = NULL;
+}
+
+bool http_upstream_stat(lua_State *L, http_client_t *client)
+{
+    // not a stream client
+    if(!client->response || client->on_read != on_upstream_read)
+        return false;
+
+    const http_response_t *const response = client->response;
+
+    lua_newtable(L);
+    lua_pushnumber(L, response->overflows);
+    lua_setfield(L, -2, "overflows");
+    lua_pushnumber(L, response->dropped);
+    lua_setfield(L, -2, "dropped");
+    lua_pushnumber(L, response->buffer_count);
+    lua_setfield(L, -2, "buffered");
+    lua_pushboolean(L, response->is_degraded);
+    lua_setfield(L, -2, "degraded");
+    lua_pushboolean(L, response->is_zerocopy);
+    lua_setfield(L, -2, "zerocopy");
+    lua_pushnumber(L, response->shaper.rate * 8 / 1000);
+    lua_setfield(L, -2, "rate");
+    lua_pushnumber(L, (response->burst)
+                      ? http_burst_bitrate(response->burst) * 8 / 1000
+                      : 0);
+    lua_setfield(L, -2, "bitrate");
+    lua_pushnumber(L, response->throttled);
+    lua_setfield(L, -2, "throttled");
+    lua_pushboolean(L, response->is_paced);
+    lua_setfield(L, -2, "paced");
+
+    return true;
+}
+
+/* reads stream options from the table at idx, returns error message */
+const char *http_upstream_config(lua_State *L, int idx
+                                 , http_upstream_config_t *config)
+{
+    lua_getfield(L, idx, "buffer_size");
+    if(lua_isnumber(L, -1))
+        config->buffer_size = lua_tonumber(L, -1) * 1024;
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "buffer_fill");
+    if(lua_isnumber(L, -1))
+        config->buffer_fill = lua_tonumber(L, -1) * 1024;
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "burst");
+    if(lua_isnumber(L, -1))
+        config->burst_size = lua_tonumber(L, -1) * 1024;
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "zerocopy");
+    if(lua_isboolean(L, -1))
+        config->is_zerocopy = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "overflow_limit");
+    if(lua_isnumber(L, -1))
+        config->overflow_limit = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "overflow_period");
+    if(lua_isnumber(L, -1))
+        config->overflow_period = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "rate_limit");
+    if(lua_isnumber(L, -1))
+        config->rate_limit = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "rate_factor");
+    if(lua_isnumber(L, -1))
+        config->rate_factor = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "fallback");
+    if(lua_islightuserdata(L, -1))
+        config->fallback = (module_stream_t *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    const char *error = NULL;
+
+    lua_getfield(L, idx, "overflow");
+    if(lua_isstring(L, -1))
+    {
+        const char *const value = lua_tostring(L, -1);
+
+        if(!strcmp(value, "reset"))
+            config->overflow = HTTP_OVERFLOW_RESET;
+        else if(!strcmp(value, "skip"))
+            config->overflow = HTTP_OVERFLOW_SKIP;
+        else if(!strcmp(value, "degrade"))
+            config->overflow = HTTP_OVERFLOW_DEGRADE;
+        else
+            error = "option 'overflow': unknown policy";
+    }
+    lua_pop(L, 1);
+
+    return error;
+}
+
 static int __module_call(lua_State *L)
 {
     module_data_t *const mod =
@@ -296,6 +943,12 @@ static void module_init(lua_State *L, module_data_t *mod)
         asc_log_error("[http_upstream] deprecated usage of the buffer_size/buffer_fill options");
     //
 
+    // defaults for :send()
+    const char *const error = http_upstream_config(L, MODULE_OPTIONS_IDX, &mod->config);
+    asc_assert(error == NULL, "[http_upstream] %s", error);
+    mod->config.buffer_size = 0;
+    mod->config.buffer_fill = 0;
+
     // Set callback for http route
     lua_getmetatable(L, 3);
     lua_pushlightuserdata(L, (void *)mod);
@@ -18,8 +18,32 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      http_websocket
+ *
+ * Module Options:
+ *      callback    - function, called with (server, client, message) for
+ *                    every received message, and with nil message on close
+ *      queue_size  - number, messages queued for a client, at least 2.
+ *                    default 64
+ *      overflow    - string, what to do when a client queue is full:
+ *                    "coalesce" - drop queued messages, keep the newest one
+ *                    "drop" - drop the new message
+ *                    "close" - close the client
+ *                    default: "coalesce"
+ *
+ * Module Methods:
+ *      broadcast(message)
+ *                  - send text message to all clients
+ *      stat()      - return table, { clients, messages, dropped }
+ *
+ * Server frames are not masked, so a message is framed once and the same
+ * buffer is queued to every client by reference.
+ */
+
 #include <astra.h>
-#include <core/list.h>
+#include <core/mainloop.h>
 #include <luaapi/luaapi.h>
 #include <utils/base64.h>
 #include <utils/sha1.h>
@@ -33,18 +57,38 @@
 #define FRAME_SIZE16_SIZE 2
 #define FRAME_SIZE64_SIZE 8
 
+/* defaults */
+#define WS_QUEUE_SIZE 64
+
+typedef enum
+{
+    WS_OVERFLOW_COALESCE = 0,
+    WS_OVERFLOW_DROP,
+    WS_OVERFLOW_CLOSE,
+} ws_overflow_t;
+
 struct module_data_t
 {
     MODULE_LUA_DATA();
 
     int idx_callback;
+
+    unsigned int queue_size;
+    ws_overflow_t overflow;
+
+    http_client_t *clients;
+    unsigned int client_count;
+
+    uint64_t messages;
+    uint64_t dropped;
 };
 
+/* framed message, shared by the client queues */
 typedef struct
 {
-    uint8_t *buffer;
+    unsigned int refs;
     size_t size;
-    size_t skip;
+    uint8_t buffer[];
 } frame_t;
 
 struct http_response_t
@@ -57,7 +101,18 @@ struct http_response_t
     uint8_t frame_key[FRAME_KEY_SIZE];
     uint8_t frame_key_i;
 
-    asc_list_t *frame_queue;
+    // ring of frames to send
+    frame_t **queue;
+    unsigned int queue_head;
+    unsigned int queue_count;
+    size_t skip;            // sent bytes of the first frame
+
+    bool is_ready;          // handshake is sent
+    bool is_closing;
+
+    // module client list
+    http_client_t *prev;
+    http_client_t *next;
 };
 
 /*
@@ -67,90 +122,191 @@ struct http_response_t
 
 static const char __websocket_magic[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
+static frame_t *frame_init(const char *str, size_t str_size)
+{
+    size_t header_size;
+    if(str_size <= 125)
+        header_size = FRAME_HEADER_SIZE;
+    else if(str_size <= 0xFFFF)
+        header_size = FRAME_HEADER_SIZE + FRAME_SIZE16_SIZE;
+    else
+        header_size = FRAME_HEADER_SIZE + FRAME_SIZE64_SIZE;
+
+    frame_t *const frame =
+        (frame_t *)ASC_ALLOC(sizeof(frame_t) + header_size + str_size, uint8_t);
+    uint8_t *const buffer = frame->buffer;
+
+    if(str_size <= 125)
+    {
+        buffer[1] = str_size & 0xFF;
+    }
+    else if(str_size <= 0xFFFF)
+    {
+        buffer[1] = 126;
+        buffer[2] = (str_size >> 8) & 0xFF;
+        buffer[3] = (str_size     ) & 0xFF;
+    }
+    else
+    {
+        buffer[1] = 127;
+        buffer[2] = 0;
+        buffer[3] = 0;
+        buffer[4] = 0;
+        buffer[5] = 0;
+        buffer[6] = (str_size >> 24) & 0xFF;
+        buffer[7] = (str_size >> 16) & 0xFF;
+        buffer[8] = (str_size >> 8 ) & 0xFF;
+        buffer[9] = (str_size      ) & 0xFF;
+    }
+
+    buffer[0] = 0x81;
+    memcpy(&buffer[header_size], str, str_size);
+    frame->size = header_size + str_size;
+
+    return frame;
+}
+
+static void frame_release(frame_t *frame)
+{
+    --frame->refs;
+    if(!frame->refs)
+        free(frame);
+}
+
 static void on_websocket_ready(void *arg)
 {
     http_client_t *const client = (http_client_t *)arg;
     http_response_t *const response = client->response;
+    const unsigned int queue_size = response->mod->queue_size;
 
-    asc_list_first(response->frame_queue);
-    frame_t *frame = (frame_t *)asc_list_data(response->frame_queue);
+    response->is_ready = true;
 
-    ssize_t size = asc_socket_send(  client->sock
-                                   , &frame->buffer[frame->skip]
-                                   , frame->size - frame->skip);
-    if(size <= 0)
+    if(!response->queue_count)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        return;
+    }
+
+    asc_socket_buf_t buf[ASC_SOCKET_SENDV_MAX];
+    unsigned int count = 0;
+
+    size_t skip = response->skip;
+    while(count < response->queue_count && count < ASC_SOCKET_SENDV_MAX)
+    {
+        const frame_t *const frame =
+            response->queue[(response->queue_head + count) % queue_size];
+
+        buf[count].data = &frame->buffer[skip];
+        buf[count].size = frame->size - skip;
+        skip = 0;
+        ++count;
+    }
+
+    ssize_t size = asc_socket_sendv(client->sock, buf, count);
+    if(size == -1)
     {
         http_client_error(client, "failed to send data: %s", asc_error_msg());
         http_client_close(client);
         return;
     }
 
-    frame->skip += size;
+    // socket buffer is full, wait for the next event
+    if(size == 0)
+        return;
 
-    if(frame->size == frame->skip)
+    while(size > 0)
     {
-        free(frame->buffer);
-        free(frame);
-        asc_list_remove_current(response->frame_queue);
-        if(asc_list_eol(response->frame_queue))
-            asc_socket_set_on_ready(client->sock, NULL);
+        frame_t *const frame = response->queue[response->queue_head];
+        const size_t rem = frame->size - response->skip;
+
+        if((size_t)size < rem)
+        {
+            response->skip += size;
+            break;
+        }
+
+        size -= rem;
+        response->skip = 0;
+        response->queue_head = (response->queue_head + 1) % queue_size;
+        --response->queue_count;
+        frame_release(frame);
     }
+
+    if(!response->queue_count)
+        asc_socket_set_on_ready(client->sock, NULL);
 }
 
-/* Stack: 1 - server, 2 - client, 3 - response */
-static void on_websocket_send(void *arg)
+static void on_overflow_close(void *arg)
 {
     http_client_t *const client = (http_client_t *)arg;
-    http_response_t *const response = client->response;
-    lua_State *const L = MODULE_L(client->mod);
 
-    const char *str = lua_tostring(L, 3);
-    const int str_size = luaL_len(L, 3);
+    http_client_warning(client, "client is too slow, closing");
+    http_client_close(client);
+}
 
-    frame_t *const frame = ASC_ALLOC(1, frame_t);
+static void queue_push(http_client_t *client, frame_t *frame)
+{
+    http_response_t *const response = client->response;
+    module_data_t *const mod = response->mod;
 
-    if(str_size <= 125)
-    {
-        frame->size = FRAME_HEADER_SIZE;
-        frame->buffer = ASC_ALLOC(frame->size + str_size, uint8_t);
+    if(response->is_closing)
+        return;
 
-        frame->buffer[1] = str_size & 0xFF;
-    }
-    else if(str_size <= 0xFFFF)
+    if(response->queue_count >= mod->queue_size)
     {
-        frame->size = FRAME_HEADER_SIZE + FRAME_SIZE16_SIZE;
-        frame->buffer = ASC_ALLOC(frame->size + str_size, uint8_t);
+        switch(mod->overflow)
+        {
+            case WS_OVERFLOW_COALESCE:
+            {
+                // the frame that is partially sent can not be dropped
+                const unsigned int keep = (response->skip > 0) ? 1 : 0;
+                while(response->queue_count > keep)
+                {
+                    --response->queue_count;
+                    frame_release(response->queue[
+                        (response->queue_head + response->queue_count) % mod->queue_size]);
+                    ++mod->dropped;
+                }
+                break;
+            }
 
-        frame->buffer[1] = 126;
-        frame->buffer[2] = (str_size >> 8) & 0xFF;
-        frame->buffer[3] = (str_size     ) & 0xFF;
-    }
-    else
-    {
-        frame->size = FRAME_HEADER_SIZE + FRAME_SIZE64_SIZE;
-        frame->buffer = ASC_ALLOC(frame->size + str_size, uint8_t);
-
-        frame->buffer[1] = 127;
-        frame->buffer[2] = 0;
-        frame->buffer[3] = 0;
-        frame->buffer[4] = 0;
-        frame->buffer[5] = 0;
-        frame->buffer[6] = (str_size >> 24) & 0xFF;
-        frame->buffer[7] = (str_size >> 16) & 0xFF;
-        frame->buffer[8] = (str_size >> 8 ) & 0xFF;
-        frame->buffer[9] = (str_size      ) & 0xFF;
+            case WS_OVERFLOW_DROP:
+                ++mod->dropped;
+                return;
+
+            case WS_OVERFLOW_CLOSE:
+                ++mod->dropped;
+                response->is_closing = true;
+                asc_job_queue(response, on_overflow_close, client);
+                return;
+        }
     }
 
-    frame->buffer[0] = 0x81;
-    memcpy(&frame->buffer[frame->size], str, str_size);
-    frame->size += str_size;
-    frame->skip = 0;
+    ++frame->refs;
+    response->queue[(response->queue_head + response->queue_count) % mod->queue_size] = frame;
+    ++response->queue_count;
 
-    asc_list_insert_tail(response->frame_queue, frame);
-    if(asc_list_size(response->frame_queue) == 1)
+    // before the handshake is sent, the socket is used by http_server
+    if(response->is_ready && response->queue_count == 1)
         asc_socket_set_on_ready(client->sock, on_websocket_ready);
 }
 
+/* Stack: 1 - server, 2 - client, 3 - response */
+static void on_websocket_send(void *arg)
+{
+    http_client_t *const client = (http_client_t *)arg;
+    lua_State *const L = MODULE_L(client->mod);
+
+    size_t str_size = 0;
+    const char *str = lua_tolstring(L, 3, &str_size);
+
+    frame_t *const frame = frame_init(str, str_size);
+
+    ++frame->refs;
+    queue_push(client, frame);
+    frame_release(frame);
+}
+
 static void on_websocket_read(void *arg)
 {
     http_client_t *const client = (http_client_t *)arg;
@@ -328,18 +484,28 @@ static int module_call(lua_State *L, module_data_t *mod)
                 string_buffer_free(client->content);
                 client->content = NULL;
             }
-            if(client->response->frame_queue)
+
+            http_response_t *const response = client->response;
+            module_data_t *const owner = response->mod;
+
+            asc_job_prune(response);
+
+            for(; response->queue_count > 0; --response->queue_count)
             {
-                asc_list_clear(client->response->frame_queue)
-                {
-                    frame_t *frame = (frame_t *)asc_list_data(client->response->frame_queue);
-                    free(frame->buffer);
-                    free(frame);
-                }
-                asc_list_destroy(client->response->frame_queue);
-                client->response->frame_queue = NULL;
+                frame_release(response->queue[response->queue_head]);
+                response->queue_head = (response->queue_head + 1) % owner->queue_size;
             }
-            free(client->response);
+            free(response->queue);
+
+            if(response->prev)
+                response->prev->response->next = response->next;
+            else
+                owner->clients = response->next;
+            if(response->next)
+                response->next->response->prev = response->prev;
+            --owner->client_count;
+
+            free(response);
             client->response = NULL;
         }
         return 0;
@@ -384,12 +550,20 @@ static int module_call(lua_State *L, module_data_t *mod)
 
     lua_pop(L, 2); // request + headers
 
-    client->response = ASC_ALLOC(1, http_response_t);
-    client->response->mod = mod;
-    client->response->frame_queue = asc_list_init();
+    http_response_t *const response = ASC_ALLOC(1, http_response_t);
+    response->mod = mod;
+    response->queue = ASC_ALLOC(mod->queue_size, frame_t *);
+
+    response->next = mod->clients;
+    if(mod->clients)
+        mod->clients->response->prev = client;
+    mod->clients = client;
+    ++mod->client_count;
+
+    client->response = response;
     client->on_send = on_websocket_send;
     client->on_read = on_websocket_read;
-    client->on_ready = NULL;
+    client->on_ready = on_websocket_ready;
 
     http_response_code(client, 101, "Switching Protocols");
     http_response_header(client, "Upgrade: websocket");
@@ -418,6 +592,26 @@ static void module_init(lua_State *L, module_data_t *mod)
     asc_assert(lua_isfunction(L, -1), "[http_websocket] option 'callback' is required");
     mod->idx_callback = luaL_ref(L, LUA_REGISTRYINDEX);
 
+    int value = WS_QUEUE_SIZE;
+    module_option_integer(L, "queue_size", &value);
+    // coalesce keeps a partially sent frame and needs room for one more
+    asc_assert(value >= 2, "[http_websocket] option 'queue_size' is out of range");
+    mod->queue_size = value;
+
+    const char *overflow = NULL;
+    module_option_string(L, "overflow", &overflow, NULL);
+    if(overflow)
+    {
+        if(!strcmp(overflow, "coalesce"))
+            mod->overflow = WS_OVERFLOW_COALESCE;
+        else if(!strcmp(overflow, "drop"))
+            mod->overflow = WS_OVERFLOW_DROP;
+        else if(!strcmp(overflow, "close"))
+            mod->overflow = WS_OVERFLOW_CLOSE;
+        else
+            asc_assert(0, "[http_websocket] option 'overflow': unknown policy");
+    }
+
     // Set callback for http route
     lua_getmetatable(L, 3);
     lua_pushlightuserdata(L, (void *)mod);
@@ -435,8 +629,43 @@ static void module_destroy(module_data_t *mod)
     }
 }
 
+/* Stack: 1 - instance, 2 - message */
+static int method_broadcast(lua_State *L, module_data_t *mod)
+{
+    size_t str_size = 0;
+    const char *str = luaL_checklstring(L, 2, &str_size);
+
+    ++mod->messages;
+
+    if(!mod->clients)
+        return 0;
+
+    frame_t *const frame = frame_init(str, str_size);
+
+    ++frame->refs;
+    for(http_client_t *client = mod->clients; client; client = client->response->next)
+        queue_push(client, frame);
+    frame_release(frame);
+
+    return 0;
+}
+
+static int method_stat(lua_State *L, module_data_t *mod)
+{
+    lua_newtable(L);
+    lua_pushinteger(L, mod->client_count);
+    lua_setfield(L, -2, "clients");
+    lua_pushnumber(L, mod->messages);
+    lua_setfield(L, -2, "messages");
+    lua_pushnumber(L, mod->dropped);
+    lua_setfield(L, -2, "dropped");
+
+    return 1;
+}
+
 MODULE_LUA_METHODS()
 {
-    { NULL, NULL },
+    { "broadcast", method_broadcast },
+    { "stat", method_stat },
 };
 MODULE_LUA_REGISTER(http_websocket)
@@ -243,6 +243,167 @@ bool http_parse_header(const char *str, size_t size, parse_match_t *match)
     return true;
 }
 
+/*
+ * Incremental head scanner. Only '\n' and ':' are of interest, so the
+ * vector paths compare a whole block against both bytes and walk the
+ * resulting bit mask; the scalar loop handles the tail and platforms
+ * without SSE2.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#   if defined(__SSE2__)
+#       include <emmintrin.h>
+#       define HTTP_SCAN_SSE2 1
+#   endif
+#   if (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)
+#       include <immintrin.h>
+#       define HTTP_SCAN_AVX2 1
+#   endif
+#endif
+
+#define SCAN_DONE(_scan) \
+    ((_scan)->eoh != 0 || (_scan)->count >= HTTP_SCAN_MAX_LINES)
+
+void http_scan_reset(http_scan_t *scan)
+{
+    scan->skip = 0;
+    scan->eoh = 0;
+    scan->count = 0;
+    scan->line[0].so = 0;
+    scan->line[0].delim = 0;
+}
+
+/* handles '\n' or ':' at `pos'. returns false when the scan is over */
+static inline bool scan_byte(http_scan_t *scan, const char *str, size_t pos)
+{
+    http_scan_line_t *const line = &scan->line[scan->count];
+
+    if(str[pos] == ':')
+    {
+        if(line->delim == 0)
+            line->delim = pos;
+        return true;
+    }
+
+    line->eo = (pos > line->so && str[pos - 1] == '\r') ? (pos - 1) : pos;
+    if(line->eo == line->so)
+    {
+        scan->eoh = pos + 1;
+        return false;
+    }
+
+    if(++scan->count >= HTTP_SCAN_MAX_LINES)
+        return false;
+
+    line[1].so = pos + 1;
+    line[1].delim = 0;
+    return true;
+}
+
+static size_t scan_scalar(http_scan_t *scan, const char *str
+                          , size_t skip, size_t size)
+{
+    for(; skip < size; ++skip)
+    {
+        const char c = str[skip];
+        if((c == '\n' || c == ':') && !scan_byte(scan, str, skip))
+            return skip + 1;
+    }
+
+    return skip;
+}
+
+#define SCAN_MASK(_skip, _mask) \
+    while(_mask) \
+    { \
+        const size_t __pos = _skip + __builtin_ctz(_mask); \
+        if(!scan_byte(scan, str, __pos)) \
+            return __pos + 1; \
+        _mask &= _mask - 1; \
+    }
+
+#ifdef HTTP_SCAN_SSE2
+static size_t scan_sse2(http_scan_t *scan, const char *str
+                        , size_t skip, size_t size)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i colon = _mm_set1_epi8(':');
+
+    for(; skip + 16 <= size; skip += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)&str[skip]);
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, colon)));
+
+        SCAN_MASK(skip, mask);
+    }
+
+    return skip;
+}
+#endif /* HTTP_SCAN_SSE2 */
+
+#ifdef HTTP_SCAN_AVX2
+__attribute__((target("avx2")))
+static size_t scan_avx2(http_scan_t *scan, const char *str
+                        , size_t skip, size_t size)
+{
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i colon = _mm256_set1_epi8(':');
+
+    for(; skip + 32 <= size; skip += 32)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)&str[skip]);
+        unsigned int mask = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, lf)
+                            , _mm256_cmpeq_epi8(v, colon)));
+
+        SCAN_MASK(skip, mask);
+    }
+
+    return skip;
+}
+
+static bool scan_has_avx2(void)
+{
+    static int avx2 = -1;
+
+    if(avx2 < 0)
+    {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+
+    return (avx2 == 1);
+}
+#endif /* HTTP_SCAN_AVX2 */
+
+bool http_scan_head(http_scan_t *scan, const char *str, size_t size)
+{
+    if(SCAN_DONE(scan))
+        return (scan->eoh != 0);
+
+    if(scan->skip > size)
+        http_scan_reset(scan);
+
+    size_t skip = scan->skip;
+
+#ifdef HTTP_SCAN_AVX2
+    if(scan_has_avx2())
+        skip = scan_avx2(scan, str, skip, size);
+#endif
+
+#ifdef HTTP_SCAN_SSE2
+    if(!SCAN_DONE(scan))
+        skip = scan_sse2(scan, str, skip, size);
+#endif
+
+    if(!SCAN_DONE(scan))
+        skip = scan_scalar(scan, str, skip, size);
+
+    scan->skip = skip;
+    return (scan->eoh != 0 || scan->count < HTTP_SCAN_MAX_LINES);
+}
+
 /*
  *      o    ooooo  oooo ooooooooooo ooooo ooooo
  *     888    888    88  88  888  88  888   888
@@ -579,3 +740,68 @@ bool http_parse_query(const char *str, size_t size, parse_match_t *match)
 
     return true;
 }
+
+static bool parse_offset(const char **str, uintmax_t *offset)
+{
+    const char *p = *str;
+    if(*p < '0' || *p > '9')
+        return false;
+
+    uintmax_t value = 0;
+    for(unsigned int i = 0; *p >= '0' && *p <= '9'; ++i, ++p)
+    {
+        if(i >= 18)
+            return false;
+        value = value * 10 + (*p - '0');
+    }
+
+    *offset = value;
+    *str = p;
+    return true;
+}
+
+/*
+ * Range: bytes=first-last, bytes=first- or bytes=-suffix
+ */
+int http_parse_range(const char *value, off_t size, off_t *first, off_t *last)
+{
+    if(strncasecmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL)
+        return 0;
+
+    const char *p = &value[6];
+    const uintmax_t file_size = size;
+    uintmax_t a, b;
+
+    if(*p == '-')
+    {
+        ++p;
+        if(!parse_offset(&p, &b) || *p)
+            return 0;
+
+        if(b == 0 || file_size == 0)
+            return -1;
+
+        *first = (b < file_size) ? (off_t)(file_size - b) : 0;
+        *last = size - 1;
+        return 1;
+    }
+
+    if(!parse_offset(&p, &a) || *p != '-')
+        return 0;
+
+    ++p;
+    if(!*p)
+        b = file_size - 1;
+    else if(!parse_offset(&p, &b) || *p || b < a)
+        return 0;
+
+    if(a >= file_size)
+        return -1;
+
+    if(b >= file_size)
+        b = file_size - 1;
+
+    *first = a;
+    *last = b;
+    return 1;
+}
@@ -38,12 +38,49 @@ bool parse_skip_line(const char *str, size_t size, size_t *skip);
 #define parse_get_line_size(_str, _skip) \
     (((_skip >= 2) && (_str[_skip - 2] == '\r')) ? (_skip - 2) : (_skip - 1))
 
+/*
+ * Incremental request head scanner
+ *
+ * http_scan_head() is called each time more data is appended to the
+ * buffer; it resumes at the offset where the previous call stopped and
+ * records every line of the head along with its first ':' until the
+ * empty line is found. The scan state must be reset when the buffer
+ * is reused for the next request.
+ */
+
+#define HTTP_SCAN_MAX_LINES 128
+
+typedef struct
+{
+    size_t so;      /* line start */
+    size_t eo;      /* line end, without CRLF */
+    size_t delim;   /* first ':' in the line, zero if none */
+} http_scan_line_t;
+
+typedef struct
+{
+    size_t skip;    /* bytes scanned so far */
+    size_t eoh;     /* end of head, zero until the empty line is found */
+    unsigned int count; /* number of lines, excluding the empty one */
+    http_scan_line_t line[HTTP_SCAN_MAX_LINES];
+} http_scan_t;
+
+void http_scan_reset(http_scan_t *scan);
+bool http_scan_head(http_scan_t *scan, const char *str, size_t size) __wur;
+
 bool http_parse_request(const char *, size_t size, parse_match_t *);
 bool http_parse_response(const char *, size_t size, parse_match_t *);
 bool http_parse_header(const char *, size_t size, parse_match_t *);
 bool http_parse_chunk(const char *, size_t size, parse_match_t *);
 bool http_parse_query(const char *, size_t size, parse_match_t *);
 
+/*
+ * Single byte range of a `size' byte resource. Returns 1 and the
+ * inclusive range, 0 if the header should be ignored, or -1 if the
+ * range is not satisfiable.
+ */
+int http_parse_range(const char *value, off_t size, off_t *first, off_t *last);
+
 char * http_authorization(const char *auth_header, size_t size,
     const char *method, const char *path,
     const char *login, const char *password);
@@ -34,6 +34,18 @@
  *      sync        - boolean or number, enable stream synchronization
  *      sctp        - boolean, use sctp instead of tcp
  *      timeout     - number, request timeout
+ *      keep_alive  - boolean, return the connection to the pool on close and
+ *                    reuse pooled connections to the same host and port.
+ *                    a GET or HEAD request that fails on a pooled
+ *                    connection before any response data is retried once
+ *                    on a new connection, other methods only if nothing
+ *                    has been sent yet.
+ *                    default: true, not used with sctp and 'upstream'
+ *      keep_alive_timeout
+ *                  - number, seconds to keep an idle connection, default 30
+ *      max_connections
+ *                  - number, maximum connections to the same host and port,
+ *                    further requests wait for a free one. default: 0 - no limit
  *      callback    - function,
  *      upstream    - object, stream instance returned by module_instance:stream()
  */
@@ -45,11 +57,34 @@
 
 #include "http.h"
 
+#define POOL_IDLE_TIMEOUT 30
+#define POOL_CHECK_INTERVAL 1000
+
 #define MSG(_msg)                                       \
     "[http_request %s:%d%s] " _msg, mod->config.host    \
                                   , mod->config.port    \
                                   , mod->config.path
 
+typedef struct
+{
+    char *key;              // host:port
+    asc_list_t *active;     // module_data_t, connections in use
+    asc_list_t *idle;       // pool_conn_t
+    asc_list_t *waiting;    // module_data_t, waiting for max_connections
+} pool_host_t;
+
+typedef struct
+{
+    pool_host_t *host;
+    asc_socket_t *sock;
+    uint64_t expire;
+} pool_conn_t;
+
+/* idle connections of all hosts */
+static asc_list_t *pool_list = NULL;
+static asc_timer_t *pool_timer = NULL;
+static lua_State *pool_lua = NULL;
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -86,9 +121,20 @@ struct module_data_t
     } request;
 
     bool is_head;
+    bool is_idempotent; // safe to send again on a new connection
     bool is_connection_close;
     bool is_connection_keep_alive;
 
+    // connection pool
+    pool_host_t *pool;
+    bool is_keep_alive;
+    bool is_pool_wait;
+    bool is_pool_reused; // nothing is received on a pooled connection yet
+    bool is_persistent; // response length is known, connection stays open
+    bool is_reusable;   // whole response is received
+    uint64_t pool_idle;
+    unsigned int pool_max;
+
     // response
     char buffer[HTTP_BUFFER_SIZE];
     size_t buffer_skip;
@@ -153,6 +199,8 @@ static const char __close[] = "close";
 static const char __keep_alive[] = "keep-alive";
 
 static void on_close(void *);
+static void pool_release(module_data_t *mod, bool is_reusable);
+static void request_retry(module_data_t *mod);
 
 static void callback(lua_State *L, module_data_t *mod)
 {
@@ -206,8 +254,25 @@ static void on_close(void *arg)
     module_data_t *const mod = (module_data_t *)arg;
     lua_State *const L = MODULE_L(mod);
 
-    if(!mod->sock)
+    if(!mod->sock && !mod->is_pool_wait)
+        return;
+
+    // the server has closed an idle connection while it was being reused.
+    // a request that may have reached the server is only sent again
+    // if repeating it is harmless
+    const bool is_unsent = (mod->request.status == 1 && mod->request.skip == 0);
+    if(   mod->is_pool_reused && mod->pool && mod->request.status > 0 && mod->status == 0
+       && (mod->is_idempotent || is_unsent))
+    {
+        request_retry(mod);
         return;
+    }
+
+    // the whole response is read, nothing else is expected
+    const bool is_reusable = (   mod->is_keep_alive
+                              && mod->is_reusable
+                              && !mod->is_connection_close
+                              && !mod->receiver.callback.ptr);
 
     if(mod->receiver.callback.ptr)
     {
@@ -217,7 +282,10 @@ static void on_close(void *arg)
         mod->receiver.callback.ptr = NULL;
     }
 
-    asc_socket_close(mod->sock);
+    if(mod->pool)
+        pool_release(mod, is_reusable);
+    else if(mod->sock)
+        asc_socket_close(mod->sock);
     mod->sock = NULL;
 
     if(mod->timeout)
@@ -430,6 +498,8 @@ static void on_read(void *arg)
         return;
     }
 
+    mod->is_pool_reused = false;
+
     if(mod->receiver.callback.ptr)
     {
         mod->receiver.callback.fn(mod->receiver.arg, &mod->buffer[mod->buffer_skip], size);
@@ -439,6 +509,7 @@ static void on_read(void *arg)
     if(mod->status == 3)
     {
         asc_log_warning(MSG("received data after response"));
+        mod->is_reusable = false;
         return;
     }
 
@@ -505,6 +576,7 @@ static void on_read(void *arg)
 
         lua_pushlstring(L, &mod->buffer[m[1].so], m[1].eo - m[1].so);
         lua_setfield(L, response, __version);
+        const bool is_http10 = !strncmp(&mod->buffer[m[1].so], "HTTP/1.0", 8);
 
         mod->status_code = atoi(&mod->buffer[m[2].so]);
         lua_pushinteger(L, mod->status_code);
@@ -580,6 +652,29 @@ static void on_read(void *arg)
         }
         lua_pop(L, 1); // transfer-encoding
 
+        // the response has a known length, see RFC 7230 3.3.3
+        mod->is_persistent = (   mod->is_chunked
+                            || mod->is_head
+                            || (mod->status_code >= 100 && mod->status_code < 200)
+                            || (mod->status_code == 204)
+                            || (mod->status_code == 304));
+
+        lua_getfield(L, headers, "content-length");
+        if(lua_isnumber(L, -1))
+            mod->is_persistent = true;
+        lua_pop(L, 1); // content-length
+
+        if(mod->is_stream && mod->status_code == 200)
+            mod->is_persistent = false;
+
+        lua_getfield(L, headers, "connection");
+        const char *connection = lua_tostring(L, -1);
+        if(connection && !strcasecmp(connection, __close))
+            mod->is_persistent = false;
+        else if(is_http10 && !(connection && !strcasecmp(connection, __keep_alive)))
+            mod->is_persistent = false;
+        lua_pop(L, 1); // connection
+
         if(mod->is_content_length || mod->is_chunked)
             mod->content = string_buffer_alloc();
 
@@ -591,6 +686,7 @@ static void on_read(void *arg)
            || (mod->status_code == 304))
         {
             mod->status = 3;
+            mod->is_reusable = (mod->is_persistent && mod->request.status == 3);
 
             lua_rawgeti(L, LUA_REGISTRYINDEX, mod->idx_response);
             callback(L, mod);
@@ -648,6 +744,7 @@ static void on_read(void *arg)
         if(!mod->content)
         {
             mod->status = 3;
+            mod->is_reusable = (mod->is_persistent && mod->request.status == 3);
 
             lua_rawgeti(L, LUA_REGISTRYINDEX, mod->idx_response);
             callback(L, mod);
@@ -705,6 +802,7 @@ static void on_read(void *arg)
                     mod->content = NULL;
                     lua_setfield(L, -2, __content);
                     mod->status = 3;
+                    mod->is_reusable = (mod->is_persistent && mod->request.status == 3);
                     callback(L, mod);
 
                     if(mod->is_connection_close)
@@ -751,6 +849,10 @@ static void on_read(void *arg)
         }
         else
         {
+            // nothing is expected after the response body
+            if(mod->chunk_left < tail)
+                mod->is_persistent = false;
+
             string_buffer_addlstring(mod->content, &mod->buffer[skip], mod->chunk_left);
             mod->chunk_left = 0;
 
@@ -759,6 +861,7 @@ static void on_read(void *arg)
             mod->content = NULL;
             lua_setfield(L, -2, __content);
             mod->status = 3;
+            mod->is_reusable = (mod->is_persistent && mod->request.status == 3);
             callback(L, mod);
 
             if(mod->is_connection_close)
@@ -873,6 +976,7 @@ static void lua_make_request(lua_State *L, module_data_t *mod)
     lua_pop(L, 1);
 
     mod->is_head = (strcmp(method, "HEAD") == 0);
+    mod->is_idempotent = (mod->is_head || strcmp(method, "GET") == 0);
 
     lua_getfield(L, -1, __path);
     mod->config.path = lua_isstring(L, -1) ? lua_tostring(L, -1) : __default_path;
@@ -944,37 +1048,369 @@ static void on_connect(void *arg)
     asc_socket_set_on_ready(mod->sock, on_ready_send_request);
 }
 
+/*
+ * oooooooooo  ooooooo     ooooooo  ooooo
+ *  888    888 o888   888o o888   888o 888
+ *  888oooo88  888     888 888     888 888
+ *  888        888o   o888 888o   o888 888      o
+ * o888o         88ooo88     88ooo88  o888ooooo88
+ *
+ */
+
+static void pool_conn_close(pool_conn_t *conn)
+{
+    asc_socket_close(conn->sock);
+    free(conn);
+}
+
+static void pool_host_free(pool_host_t *host)
+{
+    // requests in progress close their connections by themselves
+    asc_list_till_empty(host->active)
+    {
+        module_data_t *const mod = (module_data_t *)asc_list_data(host->active);
+        mod->pool = NULL;
+        asc_list_remove_current(host->active);
+    }
+    asc_list_till_empty(host->waiting)
+    {
+        module_data_t *const mod = (module_data_t *)asc_list_data(host->waiting);
+        mod->pool = NULL;
+        asc_list_remove_current(host->waiting);
+    }
+    asc_list_till_empty(host->idle)
+    {
+        pool_conn_close((pool_conn_t *)asc_list_data(host->idle));
+        asc_list_remove_current(host->idle);
+    }
+
+    asc_list_destroy(host->active);
+    asc_list_destroy(host->idle);
+    asc_list_destroy(host->waiting);
+    free(host->key);
+    free(host);
+}
+
+static bool pool_host_is_empty(const pool_host_t *host)
+{
+    return (   asc_list_size(host->active) == 0
+            && asc_list_size(host->idle) == 0
+            && asc_list_size(host->waiting) == 0);
+}
+
+static void pool_cleanup(void)
+{
+    if(asc_list_size(pool_list) > 0)
+        return;
+
+    ASC_FREE(pool_list, asc_list_destroy);
+    ASC_FREE(pool_timer, asc_timer_destroy);
+}
+
+static void pool_host_check(pool_host_t *host)
+{
+    if(!pool_host_is_empty(host))
+        return;
+
+    asc_list_remove_item(pool_list, host);
+    pool_host_free(host);
+    pool_cleanup();
+}
+
+static void on_pool_timer(void *arg)
+{
+    __uarg(arg);
+
+    const uint64_t now = asc_utime();
+
+    asc_list_first(pool_list);
+    while(!asc_list_eol(pool_list))
+    {
+        pool_host_t *const host = (pool_host_t *)asc_list_data(pool_list);
+
+        asc_list_first(host->idle);
+        while(!asc_list_eol(host->idle))
+        {
+            pool_conn_t *const conn = (pool_conn_t *)asc_list_data(host->idle);
+            if(now >= conn->expire)
+            {
+                pool_conn_close(conn);
+                asc_list_remove_current(host->idle);
+            }
+            else
+                asc_list_next(host->idle);
+        }
+
+        if(pool_host_is_empty(host))
+        {
+            asc_list_remove_current(pool_list);
+            pool_host_free(host);
+        }
+        else
+            asc_list_next(pool_list);
+    }
+
+    pool_cleanup();
+}
+
+/* idle connection is closed by the server or has received unexpected data */
+static void on_pool_close(void *arg)
+{
+    pool_conn_t *const conn = (pool_conn_t *)arg;
+    pool_host_t *const host = conn->host;
+
+    asc_list_remove_item(host->idle, conn);
+    pool_conn_close(conn);
+    pool_host_check(host);
+}
+
+static void on_pool_read(void *arg)
+{
+    pool_conn_t *const conn = (pool_conn_t *)arg;
+
+    char buffer[64];
+    const ssize_t size = asc_socket_recv(conn->sock, buffer, sizeof(buffer));
+    if(size == -1 && asc_socket_would_block())
+        return;
+
+    on_pool_close(conn);
+}
+
+/* pool lives as long as the Lua state, see pool_gc() */
+static int pool_gc(lua_State *L)
+{
+    __uarg(L);
+
+    if(pool_list)
+    {
+        asc_list_till_empty(pool_list)
+        {
+            pool_host_free((pool_host_t *)asc_list_data(pool_list));
+            asc_list_remove_current(pool_list);
+        }
+        pool_cleanup();
+    }
+
+    pool_lua = NULL;
+    return 0;
+}
+
+static pool_host_t *pool_host_get(module_data_t *mod)
+{
+    lua_State *const L = MODULE_L(mod);
+
+    if(pool_lua != L)
+    {
+        lua_newuserdata(L, 1);
+        lua_newtable(L);
+        lua_pushcfunction(L, pool_gc);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        luaL_ref(L, LUA_REGISTRYINDEX);
+
+        pool_lua = L;
+    }
+
+    char key[512];
+    snprintf(key, sizeof(key), "%s:%d", mod->config.host, mod->config.port);
+
+    if(!pool_list)
+    {
+        pool_list = asc_list_init();
+        pool_timer = asc_timer_init(POOL_CHECK_INTERVAL, on_pool_timer, NULL);
+    }
+    else
+    {
+        asc_list_for(pool_list)
+        {
+            pool_host_t *const host = (pool_host_t *)asc_list_data(pool_list);
+            if(!strcmp(host->key, key))
+                return host;
+        }
+    }
+
+    pool_host_t *const host = ASC_ALLOC(1, pool_host_t);
+    host->key = strdup(key);
+    host->active = asc_list_init();
+    host->idle = asc_list_init();
+    host->waiting = asc_list_init();
+    asc_list_insert_tail(pool_list, host);
+
+    return host;
+}
+
+static void request_connect(module_data_t *mod, bool sctp)
+{
+    if(sctp == true)
+        mod->sock = asc_socket_open_sctp4(mod);
+    else
+        mod->sock = asc_socket_open_tcp4(mod);
+
+    asc_socket_connect(mod->sock, mod->config.host, mod->config.port, on_connect, on_close);
+}
+
+static void request_start(module_data_t *mod)
+{
+    pool_host_t *const host = pool_host_get(mod);
+    mod->pool = host;
+
+    if(mod->is_keep_alive)
+    {
+        asc_list_till_empty(host->idle)
+        {
+            pool_conn_t *const conn = (pool_conn_t *)asc_list_data(host->idle);
+            asc_list_remove_current(host->idle);
+
+            if(!asc_socket_is_idle(conn->sock))
+            {
+                // closed by the server but the event is not processed yet
+                pool_conn_close(conn);
+                continue;
+            }
+
+            mod->sock = conn->sock;
+            mod->is_pool_reused = true;
+            free(conn);
+
+            asc_list_insert_tail(host->active, mod);
+
+            asc_socket_set_arg(mod->sock, mod);
+            asc_socket_set_on_read(mod->sock, NULL);
+            asc_socket_set_on_close(mod->sock, on_close);
+            on_connect(mod);
+            return;
+        }
+    }
+
+    if(mod->pool_max > 0 && asc_list_size(host->active) >= mod->pool_max)
+    {
+        mod->is_pool_wait = true;
+        asc_list_insert_tail(host->waiting, mod);
+        return;
+    }
+
+    asc_list_insert_tail(host->active, mod);
+    request_connect(mod, false);
+}
+
+static void request_retry(module_data_t *mod)
+{
+    mod->is_pool_reused = false;
+
+    asc_socket_close(mod->sock);
+    mod->sock = NULL;
+
+    // request is made again on connect, the connection slot is kept
+    if(mod->request.buffer)
+    {
+        if(mod->request.status == 1)
+            free((void *)mod->request.buffer);
+        mod->request.buffer = NULL;
+    }
+    mod->request.status = 0;
+    mod->buffer_skip = 0;
+
+    request_connect(mod, false);
+}
+
+static void pool_release(module_data_t *mod, bool is_reusable)
+{
+    pool_host_t *const host = mod->pool;
+    mod->pool = NULL;
+
+    if(mod->is_pool_wait)
+    {
+        mod->is_pool_wait = false;
+        asc_list_remove_item(host->waiting, mod);
+        pool_host_check(host);
+        return;
+    }
+
+    asc_list_remove_item(host->active, mod);
+
+    if(is_reusable)
+    {
+        pool_conn_t *const conn = ASC_ALLOC(1, pool_conn_t);
+        conn->host = host;
+        conn->sock = mod->sock;
+        conn->expire = asc_utime() + mod->pool_idle;
+
+        asc_socket_set_arg(conn->sock, conn);
+        asc_socket_set_on_ready(conn->sock, NULL);
+        asc_socket_set_on_read(conn->sock, on_pool_read);
+        asc_socket_set_on_close(conn->sock, on_pool_close);
+        asc_list_insert_tail(host->idle, conn);
+    }
+    else
+    {
+        asc_socket_close(mod->sock);
+    }
+
+    // pass the free connection slot to the next request
+    asc_list_first(host->waiting);
+    if(!asc_list_eol(host->waiting))
+    {
+        module_data_t *const next = (module_data_t *)asc_list_data(host->waiting);
+        asc_list_remove_current(host->waiting);
+
+        next->is_pool_wait = false;
+        request_start(next);
+    }
+
+    pool_host_check(host);
+}
+
 static void on_upstream_ready(void *arg)
 {
     module_data_t *const mod = (module_data_t *)arg;
 
-    if(mod->ts.buf_count > 0)
+    size_t budget = HTTP_SEND_BUDGET;
+
+    while(mod->ts.buf_count > 0 && budget > 0)
     {
-        size_t block_size = (mod->ts.buf_write > mod->ts.buf_read)
-                          ? (mod->ts.buf_write - mod->ts.buf_read)
-                          : (mod->ts.buf_size - mod->ts.buf_read);
+        // both parts of the ring buffer if it is wrapped
+        asc_socket_buf_t buf[2];
+        unsigned int count = 1;
 
-        if(block_size > mod->ts.buf_count)
-            block_size = mod->ts.buf_count;
+        size_t head = mod->ts.buf_size - mod->ts.buf_read;
+        if(head > mod->ts.buf_count)
+            head = mod->ts.buf_count;
+        if(head > budget)
+            head = budget;
 
-        const ssize_t send_size = asc_socket_send(  mod->sock
-                                                  , &mod->ts.buf[mod->ts.buf_read]
-                                                  , block_size);
+        buf[0].data = &mod->ts.buf[mod->ts.buf_read];
+        buf[0].size = head;
 
-        if(send_size > 0)
+        size_t block_size = head;
+        if(head < budget && mod->ts.buf_count > head)
         {
-            mod->ts.buf_count -= send_size;
-            mod->ts.buf_read += send_size;
-            if(mod->ts.buf_read >= mod->ts.buf_size)
-                mod->ts.buf_read = 0;
+            buf[1].data = mod->ts.buf;
+            buf[1].size = mod->ts.buf_count - head;
+            if(buf[1].size > budget - head)
+                buf[1].size = budget - head;
+
+            block_size += buf[1].size;
+            ++count;
         }
-        else if(send_size == -1)
+
+        const ssize_t send_size = asc_socket_sendv(mod->sock, buf, count);
+        if(send_size == -1)
         {
             asc_log_error(MSG("failed to send ts (%zu bytes): %s")
                           , block_size, asc_error_msg());
             on_close(mod);
             return;
         }
+
+        budget -= send_size;
+        mod->ts.buf_count -= send_size;
+        mod->ts.buf_read += send_size;
+        if(mod->ts.buf_read >= mod->ts.buf_size)
+            mod->ts.buf_read -= mod->ts.buf_size;
+
+        // socket buffer is full
+        if((size_t)send_size < block_size)
+            break;
     }
 
     if(mod->ts.buf_count == 0)
@@ -1058,6 +1494,7 @@ static int method_set_receiver(lua_State *L, module_data_t *mod)
 static int method_send(lua_State *L, module_data_t *mod)
 {
     mod->status = 0;
+    mod->is_reusable = false;
 
     if(mod->timeout)
         asc_timer_destroy(mod->timeout);
@@ -1115,9 +1552,11 @@ static void module_init(lua_State *L, module_data_t *mod)
         mod->ts.buf_size = HTTP_BUFFER_SIZE;
     }
 
+    bool is_upstream = false;
     lua_getfield(L, MODULE_OPTIONS_IDX, "upstream");
     if(lua_type(L, -1) == LUA_TLIGHTUSERDATA)
     {
+        is_upstream = true;
         asc_assert(mod->is_stream != true, MSG("option 'upstream' is not allowed in stream mode"));
 
         module_stream_init(mod, on_ts);
@@ -1140,12 +1579,23 @@ static void module_init(lua_State *L, module_data_t *mod)
 
     bool sctp = false;
     module_option_boolean(L, "sctp", &sctp);
-    if(sctp == true)
-        mod->sock = asc_socket_open_sctp4(mod);
-    else
-        mod->sock = asc_socket_open_tcp4(mod);
 
-    asc_socket_connect(mod->sock, mod->config.host, mod->config.port, on_connect, on_close);
+    mod->is_keep_alive = true;
+    module_option_boolean(L, "keep_alive", &mod->is_keep_alive);
+
+    int value = POOL_IDLE_TIMEOUT;
+    module_option_integer(L, "keep_alive_timeout", &value);
+    mod->pool_idle = (uint64_t)value * 1000000;
+
+    value = 0;
+    module_option_integer(L, "max_connections", &value);
+    mod->pool_max = (value > 0) ? value : 0;
+
+    // upstream keeps the connection busy until the module is closed
+    if(sctp == true || is_upstream == true)
+        request_connect(mod, sctp);
+    else
+        request_start(mod);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -0,0 +1,179 @@
+/*
+ * Astra Module: HTTP (Route table)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "route.h"
+
+typedef struct route_node_t route_node_t;
+
+struct route_node_t
+{
+    char key;
+    route_node_t *next;     // next sibling
+    route_node_t *child;    // first child
+    route_node_t *wild;     // one segment wildcard
+
+    void *exact;
+    unsigned int exact_order;
+    void *prefix;
+    unsigned int prefix_order;
+};
+
+struct http_route_t
+{
+    route_node_t root;
+    unsigned int count;
+};
+
+typedef struct
+{
+    void *data;
+    unsigned int order;
+} route_match_t;
+
+static void node_free(route_node_t *node)
+{
+    while(node)
+    {
+        route_node_t *const next = node->next;
+
+        node_free(node->child);
+        node_free(node->wild);
+        free(node);
+
+        node = next;
+    }
+}
+
+static route_node_t *node_child(const route_node_t *node, char key)
+{
+    route_node_t *child = node->child;
+    while(child && child->key != key)
+        child = child->next;
+
+    return child;
+}
+
+static void node_find(const route_node_t *node, const char *path
+                      , route_match_t *best)
+{
+    while(1)
+    {
+        if(node->prefix && node->prefix_order < best->order)
+        {
+            best->data = node->prefix;
+            best->order = node->prefix_order;
+        }
+
+        if(node->wild && *path != '\0' && *path != '/')
+        {
+            const char *next = path;
+            while(*next != '\0' && *next != '/')
+                ++next;
+
+            node_find(node->wild, next, best);
+        }
+
+        if(*path == '\0')
+        {
+            if(node->exact && node->exact_order < best->order)
+            {
+                best->data = node->exact;
+                best->order = node->exact_order;
+            }
+            return;
+        }
+
+        node = node_child(node, *path);
+        if(!node)
+            return;
+
+        ++path;
+    }
+}
+
+http_route_t *http_route_init(void)
+{
+    return ASC_ALLOC(1, http_route_t);
+}
+
+void http_route_destroy(http_route_t *table)
+{
+    node_free(table->root.child);
+    node_free(table->root.wild);
+    free(table);
+}
+
+bool http_route_add(http_route_t *table, const char *pattern, void *data)
+{
+    route_node_t *node = &table->root;
+    const unsigned int order = table->count++;
+
+    for(; *pattern != '\0'; ++pattern)
+    {
+        if(*pattern == '*')
+        {
+            if(pattern[1] == '\0')
+            {
+                if(!node->prefix)
+                {
+                    node->prefix = data;
+                    node->prefix_order = order;
+                }
+                return true;
+            }
+
+            if(pattern[1] != '/')
+                return false;
+
+            if(!node->wild)
+                node->wild = ASC_ALLOC(1, route_node_t);
+
+            node = node->wild;
+            continue;
+        }
+
+        route_node_t *child = node_child(node, *pattern);
+        if(!child)
+        {
+            child = ASC_ALLOC(1, route_node_t);
+            child->key = *pattern;
+            child->next = node->child;
+            node->child = child;
+        }
+
+        node = child;
+    }
+
+    if(!node->exact)
+    {
+        node->exact = data;
+        node->exact_order = order;
+    }
+
+    return true;
+}
+
+void *http_route_find(const http_route_t *table, const char *path)
+{
+    route_match_t best = { NULL, ~0U };
+    node_find(&table->root, path, &best);
+
+    return best.data;
+}
@@ -0,0 +1,46 @@
+/*
+ * Astra Module: HTTP (Route table)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HTTP_ROUTE_H_
+#define _HTTP_ROUTE_H_ 1
+
+#include <astra.h>
+
+/*
+ * Route table, compiled into a character trie.
+ *
+ * A pattern is matched exactly unless it contains '*'. A trailing '*'
+ * matches any remainder of the path, including an empty one. A '*'
+ * elsewhere must be followed by '/' and matches one non-empty path
+ * segment: "/hls/<name>/index.m3u8" with '*' in place of <name>
+ * matches that playlist of every channel.
+ *
+ * If several patterns match, the one added first wins, just like a
+ * linear scan over the route list in configuration order.
+ */
+typedef struct http_route_t http_route_t;
+
+http_route_t *http_route_init(void) __wur;
+void http_route_destroy(http_route_t *table);
+
+bool http_route_add(http_route_t *table, const char *pattern, void *data) __wur;
+void *http_route_find(const http_route_t *table, const char *path) __wur;
+
+#endif /* _HTTP_ROUTE_H_ */
@@ -29,6 +29,61 @@
  *      http_version - string, default value: "HTTP/1.1"
  *      sctp         - boolean, use sctp instead of tcp
  *      route        - list, format: { { "/path", callback }, ... }
+ *                     "/path" - exact match, "/path*" - prefix match,
+ *                     '*' followed by '/' - any single path segment.
+ *                     the first matching route in the list is used
+ *      keep_alive   - number, maximum requests per connection, default 100.
+ *                     0 - close connection after each response
+ *      keep_alive_timeout
+ *                   - number, seconds to wait for the next request, default 15
+ *      reuseport    - boolean, set SO_REUSEPORT on the listening socket.
+ *                     several processes can listen on the same port and
+ *                     the kernel spreads new connections between them
+ *      max_connections
+ *                   - number, maximum number of client connections
+ *      connection_rate
+ *                   - number, maximum new connections per second from
+ *                     a single address.
+ *                     connections over the limits get "503 Service
+ *                     Unavailable" and are closed right after accept
+ *      streams      - table, native stream routes: { ["/path"] = stream, ... }
+ *                     stream - stream or module instance, the instance is
+ *                     kept referenced by the route.
+ *                     GET requests are attached to the stream without Lua.
+ *                     checked before 'route'. paths that need decoding
+ *                     are passed to 'route'
+ *      buffer_size  - number, stream client buffer size in Kb, default 1024
+ *      buffer_fill  - number, stream client minimal send size in Kb, default 128
+ *      burst        - number, fast channel change buffer size in Kb, default 0.
+ *                     new stream clients get the stream since the last
+ *                     keyframe, see burst.h. streams are buffered even
+ *                     when they have no clients
+ *      zerocopy     - boolean, send stream data with MSG_ZEROCOPY, Linux only.
+ *                     sent data is kept in the client buffer until the peer
+ *                     acknowledges it, so buffer_size should be increased
+ *      overflow     - string, what to do when a stream client buffer is full:
+ *                     "reset" - drop the buffered data, default,
+ *                     "skip" - drop the buffered data and resume from the next
+ *                     keyframe with PAT/PMT,
+ *                     "degrade" - like "skip", then switch to 'fallback'
+ *      overflow_limit
+ *                   - number, close stream clients after that many overflows
+ *                     within 'overflow_period' seconds, default 0 - never
+ *      overflow_period
+ *                   - number, default 10
+ *      fallback     - stream, lower bitrate rendition for "degrade"
+ *      rate_limit   - number, stream client send rate limit in Kbit/s
+ *      rate_factor  - number, stream client send rate limit as a multiple
+ *                     of the measured stream bitrate, e.g. 1.5.
+ *                     ignored if 'rate_limit' is set. the kernel paces
+ *                     the socket as well if SO_MAX_PACING_RATE is supported.
+ *                     nothing is sent until the bitrate is measured, which
+ *                     takes about a second on a new stream
+ *      egress_limit - number, total send rate limit of the stream clients
+ *                     in Kbit/s, shared by all clients of the server
+ *      on_stream    - function(server, event), deferred notification of the
+ *                     stream clients, event - table:
+ *                     { path = "...", addr = "...", port = N, event = "open" or "close" }
  *
  * Module Methods:
  *      port()      - return number, server port
@@ -43,16 +98,50 @@
  *                    * content - string, response body from the string
  *      data(client)
  *                  - return table, client data
+ *      stream(path, stream)
+ *                  - add or replace a native stream route, see 'streams'.
+ *                    nil stream removes the route and closes its clients.
+ *                    a route is also removed, and its clients closed, when
+ *                    its upstream instance is destroyed
+ *      stat(client)
+ *                  - return table, stream client counters:
+ *                    { overflows = N, dropped = bytes, buffered = bytes,
+ *                      degraded = boolean, zerocopy = boolean,
+ *                      rate = Kbit/s, bitrate = Kbit/s, throttled = N,
+ *                      paced = boolean }
+ *                    or nil if the client is not a stream client
+ *      stat()      - return table, server counters:
+ *                    { clients = N, egress_limit = Kbit/s, throttled = N,
+ *                      accepted = N, rejected = N }
  */
 
 #include <astra.h>
+#include <core/mainloop.h>
 #include <core/timer.h>
 #include <luaapi/stream.h>
 
 #include "http.h"
+#include "burst.h"
+#include "route.h"
 
 #define MSG(_msg) "[http_server %s:%d] " _msg, mod->addr, mod->port
 
+#define HTTP_KEEP_ALIVE_MAX 100
+#define HTTP_KEEP_ALIVE_TIMEOUT 15
+
+/* connections accepted per readiness event */
+#define HTTP_ACCEPT_BATCH 64
+
+/* per-address connection rate slots, addresses may share a slot */
+#define HTTP_ADMIT_SLOTS 1024
+
+typedef struct
+{
+    char addr[16];
+    uint64_t time;      // start of the one second window
+    unsigned int count;
+} http_admit_t;
+
 struct module_data_t
 {
     MODULE_LUA_DATA();
@@ -65,9 +154,28 @@ struct module_data_t
     const char *http_version;
 
     asc_list_t *routes;
+    http_route_t *route_table;
+
+    asc_list_t *streams;
+    http_route_t *stream_table;
+    http_upstream_config_t stream_config;
+    http_shaper_t egress;
+    int idx_on_stream;
+    asc_list_t *stream_events;
+
+    unsigned int keep_alive_max;
+    uint64_t keep_alive_timeout;
 
     asc_socket_t *sock;
     asc_list_t *clients;
+    asc_timer_t *timer_idle;
+
+    // admission control
+    unsigned int max_connections;
+    unsigned int connection_rate;
+    http_admit_t *admit;
+    uint64_t accepted;
+    uint64_t rejected;
 };
 
 typedef struct
@@ -76,6 +184,21 @@ typedef struct
     int idx_callback;
 } route_t;
 
+struct http_stream_t
+{
+    char *path;
+    module_stream_t *upstream;
+    unsigned int clients;
+
+    // parent is cleared if the upstream has been destroyed
+    module_stream_t link;
+    // instance that owns the upstream, if the route was given one
+    int idx_owner;
+
+    // keeps the burst buffer between clients
+    http_burst_t *burst;
+};
+
 static const char __method[] = "method";
 static const char __version[] = "version";
 static const char __path[] = "path";
@@ -87,6 +210,7 @@ static const char __message[] = "message";
 
 static const char __content_length[] = "Content-Length: ";
 static const char __connection_close[] = "Connection: close";
+static const char __connection_keep_alive[] = "Connection: keep-alive";
 
 /*
  *   oooooooo8 ooooo       ooooo ooooooooooo oooo   oooo ooooooooooo
@@ -97,8 +221,20 @@ static const char __connection_close[] = "Connection: close";
  *
  */
 
+static void stream_detach(http_client_t *client);
+
 static void callback(lua_State *L, http_client_t *client)
 {
+    if(client->stream)
+    {
+        if(client->status != 3)
+            stream_detach(client);
+        return;
+    }
+
+    if(!client->idx_callback)
+        return;
+
     lua_rawgeti(L, LUA_REGISTRYINDEX, client->idx_callback);
     lua_rawgeti(L, LUA_REGISTRYINDEX, client->mod->idx_self);
     lua_pushlightuserdata(L, client);
@@ -109,14 +245,14 @@ static void callback(lua_State *L, http_client_t *client)
     lua_call(L, 3, 0);
 }
 
-static void on_client_close(void *arg)
+static void client_release(http_client_t *client)
 {
-    http_client_t *const client = (http_client_t *)arg;
     module_data_t *const mod = client->mod;
     lua_State *const L = MODULE_L(mod);
 
-    if(!client->sock)
-        return;
+    // notification needs the client address
+    if(client->stream)
+        stream_detach(client);
 
     asc_socket_close(client->sock);
     client->sock = NULL;
@@ -154,35 +290,332 @@ static void on_client_close(void *arg)
         client->content = NULL;
     }
 
-    asc_list_remove_item(mod->clients, client);
+    ASC_FREE(client->pipeline, free);
+}
+
+static void on_client_close(void *arg)
+{
+    http_client_t *const client = (http_client_t *)arg;
+
+    if(!client->sock)
+        return;
+
+    client_release(client);
+
+    asc_list_remove_item(client->mod->clients, client);
     free(client);
 }
 
-static bool routecmp(const char *path, const char *route)
+/*
+ * Native stream routes: GET requests for these paths are attached to the
+ * stream instance right after the request line is parsed, no Lua on the
+ * request path. Lua only gets deferred notifications through on_stream.
+ */
+
+#define HTTP_STREAM_PATH_SIZE 256
+
+typedef struct
+{
+    char *path;
+    char *addr;
+    int port;
+    bool is_open;
+} stream_event_t;
+
+static void stream_event_free(stream_event_t *event)
+{
+    free(event->path);
+    free(event->addr);
+    free(event);
+}
+
+static void on_stream_event(void *arg)
 {
-    size_t skip = 0;
-    while(1)
+    module_data_t *const mod = (module_data_t *)arg;
+    lua_State *const L = MODULE_L(mod);
+
+    // callback may close clients and queue new events
+    while(mod->stream_events && asc_list_size(mod->stream_events) > 0)
     {
-        const char cp = path[skip];
-        const char cr = route[skip];
+        asc_list_first(mod->stream_events);
+        stream_event_t *const event =
+            (stream_event_t *)asc_list_data(mod->stream_events);
+        asc_list_remove_current(mod->stream_events);
 
-        if(cp == cr)
-        {
-            if(cp == '\0')
-                return true;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, mod->idx_on_stream);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, mod->idx_self);
+        lua_newtable(L);
+        lua_pushstring(L, event->path);
+        lua_setfield(L, -2, "path");
+        lua_pushstring(L, event->addr);
+        lua_setfield(L, -2, "addr");
+        lua_pushinteger(L, event->port);
+        lua_setfield(L, -2, "port");
+        lua_pushstring(L, (event->is_open) ? "open" : "close");
+        lua_setfield(L, -2, "event");
+        stream_event_free(event);
+
+        lua_call(L, 2, 0);
+    }
+}
+
+static void stream_event(http_client_t *client, bool is_open)
+{
+    module_data_t *const mod = client->mod;
+
+    if(!mod->idx_on_stream)
+        return;
+
+    stream_event_t *const event = ASC_ALLOC(1, stream_event_t);
+    event->path = strdup(client->stream->path);
+    event->addr = strdup(asc_socket_addr(client->sock));
+    event->port = asc_socket_port(client->sock);
+    event->is_open = is_open;
+
+    if(asc_list_size(mod->stream_events) == 0)
+        asc_job_queue(mod, on_stream_event, mod);
+
+    asc_list_insert_tail(mod->stream_events, event);
+}
 
-            ++skip;
+static void stream_attach(http_client_t *client, http_stream_t *stream)
+{
+    module_data_t *const mod = client->mod;
+
+    client->stream = stream;
+    ++stream->clients;
+
+    http_upstream_send(client, stream->upstream, &mod->stream_config);
+    stream_event(client, true);
+}
+
+static void stream_detach(http_client_t *client)
+{
+    stream_event(client, false);
+    http_upstream_release(client);
+
+    --client->stream->clients;
+    client->stream = NULL;
+}
+
+static void stream_table_update(module_data_t *mod)
+{
+    ASC_FREE(mod->stream_table, http_route_destroy);
+    if(asc_list_size(mod->streams) == 0)
+        return;
+
+    mod->stream_table = http_route_init();
+    asc_list_for(mod->streams)
+    {
+        http_stream_t *const stream = (http_stream_t *)asc_list_data(mod->streams);
+        asc_assert(http_route_add(mod->stream_table, stream->path, stream)
+                   , MSG("stream path: '*' must be the last character"
+                         " or followed by '/'"));
+    }
+}
+
+/*
+ * Route target is a stream, or a module instance with a stream() method.
+ * The instance is referenced for as long as the route exists.
+ */
+static module_stream_t *stream_arg(lua_State *L, int idx, int *idx_owner)
+{
+    *idx_owner = 0;
+
+    if(lua_islightuserdata(L, idx))
+        return (module_stream_t *)lua_touserdata(L, idx);
+
+    if(!lua_istable(L, idx))
+        return NULL;
+
+    if(idx < 0)
+        idx = lua_gettop(L) + idx + 1;
+
+    lua_getfield(L, idx, "stream");
+    if(!lua_isfunction(L, -1))
+    {
+        lua_pop(L, 1);
+        return NULL;
+    }
+
+    lua_pushvalue(L, idx);
+    lua_call(L, 1, 1);
+    module_stream_t *const upstream = (lua_islightuserdata(L, -1))
+                                    ? (module_stream_t *)lua_touserdata(L, -1)
+                                    : NULL;
+    lua_pop(L, 1);
+
+    if(upstream)
+    {
+        lua_pushvalue(L, idx);
+        *idx_owner = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    return upstream;
+}
+
+static http_stream_t *stream_alloc(module_data_t *mod, const char *path
+                                   , module_stream_t *upstream, int idx_owner)
+{
+    http_stream_t *const stream = ASC_ALLOC(1, http_stream_t);
+    stream->path = strdup(path);
+    stream->upstream = upstream;
+    stream->idx_owner = idx_owner;
+
+    __module_stream_init(&stream->link);
+    __module_stream_attach(upstream, &stream->link);
+
+    if(mod->stream_config.burst_size > 0)
+        stream->burst = http_burst_attach(upstream, mod->stream_config.burst_size);
+
+    return stream;
+}
+
+static void stream_free(module_data_t *mod, http_stream_t *stream)
+{
+    ASC_FREE(stream->burst, http_burst_detach);
+    __module_stream_destroy(&stream->link);
+
+    if(stream->idx_owner)
+        luaL_unref(MODULE_L(mod), LUA_REGISTRYINDEX, stream->idx_owner);
+
+    free(stream->path);
+    free(stream);
+}
+
+static inline bool stream_is_alive(const http_stream_t *stream)
+{
+    return (stream->link.parent == stream->upstream);
+}
+
+static void stream_remove(module_data_t *mod, http_stream_t *stream)
+{
+    // closing a client resets list iterator
+    bool is_found = true;
+    while(is_found && stream->clients > 0)
+    {
+        is_found = false;
+        asc_list_for(mod->clients)
+        {
+            http_client_t *const client = (http_client_t *)asc_list_data(mod->clients);
+            if(client->stream == stream)
+            {
+                on_client_close(client);
+                is_found = true;
+                break;
+            }
         }
-        else
+    }
+
+    asc_list_remove_item(mod->streams, stream);
+    stream_free(mod, stream);
+}
+
+/* drops routes whose upstream instance has been destroyed */
+static void stream_sweep(module_data_t *mod)
+{
+    bool is_changed = false;
+
+    // removing a stream resets list iterator
+    bool is_found = true;
+    while(is_found)
+    {
+        is_found = false;
+        asc_list_for(mod->streams)
         {
-            if(cr == '*')
-                return true;
+            http_stream_t *const stream = (http_stream_t *)asc_list_data(mod->streams);
+            if(!stream_is_alive(stream))
+            {
+                asc_log_warning(MSG("stream %s: upstream is gone, route removed")
+                                , stream->path);
+                stream_remove(mod, stream);
+                is_found = true;
+                is_changed = true;
+                break;
+            }
+        }
+    }
+
+    if(is_changed)
+        stream_table_update(mod);
+}
 
+static void stream_set(module_data_t *mod, const char *path
+                       , module_stream_t *upstream, int idx_owner)
+{
+    asc_list_for(mod->streams)
+    {
+        http_stream_t *const stream = (http_stream_t *)asc_list_data(mod->streams);
+        if(!strcmp(stream->path, path))
+        {
+            stream_remove(mod, stream);
             break;
         }
     }
 
-    return false;
+    if(upstream)
+        asc_list_insert_tail(mod->streams, stream_alloc(mod, path, upstream, idx_owner));
+
+    stream_table_update(mod);
+}
+
+static bool client_stream(http_client_t *client, const parse_match_t *m)
+{
+    module_data_t *const mod = client->mod;
+
+    if(!mod->stream_table)
+        return false;
+
+    const char *const method = &client->buffer[m[1].so];
+    const size_t method_size = m[1].eo - m[1].so;
+
+    bool is_head = false;
+    if(method_size == 4 && !memcmp(method, "HEAD", 4))
+        is_head = true;
+    else if(method_size != 3 || memcmp(method, "GET", 3))
+        return false;
+
+    // plain paths only, anything that needs decoding is left to Lua
+    char path[HTTP_STREAM_PATH_SIZE];
+    size_t size = 0;
+    for(size_t i = m[2].so; i < m[2].eo && client->buffer[i] != '?'; ++i)
+    {
+        const char c = client->buffer[i];
+        if(size + 1 >= sizeof(path) || c == '%' || c == '\\')
+            return false;
+        if(size > 0 && path[size - 1] == '/' && (c == '/' || c == '.'))
+            return false;
+
+        path[size++] = c;
+    }
+
+    if(size == 0 || path[0] != '/')
+        return false;
+    path[size] = '\0';
+
+    http_stream_t *const stream =
+        (http_stream_t *)http_route_find(mod->stream_table, path);
+    if(!stream)
+        return false;
+
+    if(!stream_is_alive(stream))
+    {
+        stream_sweep(mod);
+        return false;
+    }
+
+    ++client->requests;
+    client->idle_time = 0;
+    client->idx_callback = 0;
+    client->is_head = is_head;
+    client->is_keep_alive = false;
+
+    // the rest of the request is not needed, stream ends with the connection
+    client->buffer_skip = 0;
+    client->status = 3;
+
+    stream_attach(client, stream);
+    return true;
 }
 
 /*
@@ -194,11 +627,65 @@ static bool routecmp(const char *path, const char *route)
  *
  */
 
+static void client_parse(http_client_t *client);
+
+static void pipeline_save(http_client_t *client, size_t skip)
+{
+    const size_t size = client->buffer_skip - skip;
+    client->buffer_skip = 0;
+
+    if(size == 0)
+        return;
+
+    if(!client->pipeline)
+        client->pipeline = ASC_ALLOC(HTTP_BUFFER_SIZE, char);
+
+    memcpy(client->pipeline, &client->buffer[skip], size);
+    client->pipeline_skip = size;
+}
+
+static void pipeline_read(http_client_t *client)
+{
+    if(!client->pipeline)
+        client->pipeline = ASC_ALLOC(HTTP_BUFFER_SIZE, char);
+
+    const size_t space = HTTP_BUFFER_SIZE - client->pipeline_skip;
+    if(space == 0 || !client->is_keep_alive)
+    {
+        // nothing more can be queued, but keep reading to notice EOF
+        char drain[1024];
+        if(asc_socket_recv(client->sock, drain, sizeof(drain)) <= 0)
+        {
+            on_client_close(client);
+            return;
+        }
+
+        // too far ahead; answer what is queued and close the connection
+        client->is_keep_alive = false;
+        return;
+    }
+
+    const ssize_t size = asc_socket_recv(  client->sock
+                                         , &client->pipeline[client->pipeline_skip]
+                                         , space);
+    if(size <= 0)
+    {
+        on_client_close(client);
+        return;
+    }
+
+    client->pipeline_skip += size;
+}
+
 static void on_client_read(void *arg)
 {
     http_client_t *const client = (http_client_t *)arg;
-    module_data_t *const mod = client->mod;
-    lua_State *const L = MODULE_L(mod);
+
+    if(client->status == 3)
+    {
+        pipeline_read(client);
+        return;
+    }
 
     ssize_t size = asc_socket_recv(  client->sock
                                    , &client->buffer[client->buffer_skip]
@@ -209,38 +696,192 @@ static void on_client_read(void *arg)
         return;
     }
 
-    if(client->status == 3)
+    client->buffer_skip += size;
+    client_parse(client);
+}
+
+static void request_done(http_client_t *client, size_t skip)
+{
+    lua_State *const L = MODULE_L(client->mod);
+
+    if(client->content)
     {
-        asc_log_warning(MSG("received data after request"));
-        return;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, client->idx_request);
+        string_buffer_push(L, client->content);
+        client->content = NULL;
+        lua_setfield(L, -2, __content);
+        lua_pop(L, 1); // request
+    }
+
+    pipeline_save(client, skip);
+
+    client->status = 3;
+    callback(L, client);
+}
+
+static inline bool is_ows(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+// case-insensitive lookup in a comma separated list
+static bool is_token(const char *value, const char *token)
+{
+    const size_t size = strlen(token);
+
+    while(*value)
+    {
+        while(*value == ',' || is_ows(*value))
+            ++value;
+
+        const char *const begin = value;
+        while(*value && *value != ',')
+            ++value;
+
+        const char *end = value;
+        while(end > begin && is_ows(end[-1]))
+            --end;
+
+        if((size_t)(end - begin) == size && !strncasecmp(begin, token, size))
+            return true;
+    }
+
+    return false;
+}
+
+static bool is_header_token(lua_State *L, int headers, const char *name
+                            , const char *token)
+{
+    lua_getfield(L, headers, name);
+    const char *value = lua_tostring(L, -1);
+    const bool ret = (value && is_token(value, token));
+    lua_pop(L, 1);
+
+    return ret;
+}
+
+/* returns number of bytes consumed, or -1 on error */
+static ssize_t parse_chunked(http_client_t *client, size_t skip, bool *is_done)
+{
+    const size_t begin = skip;
+
+    while(skip < client->buffer_skip)
+    {
+        const char *const data = &client->buffer[skip];
+        const size_t tail = client->buffer_skip - skip;
+
+        if(client->chunk_left > 0)
+        {
+            // chunk data followed by CRLF
+            const size_t data_left = (client->chunk_left > 2)
+                                   ? client->chunk_left - 2
+                                   : 0;
+            const size_t size = (tail < client->chunk_left)
+                              ? tail
+                              : client->chunk_left;
+
+            string_buffer_addlstring(client->content, data
+                                     , (size < data_left) ? size : data_left);
+
+            client->chunk_left -= size;
+            skip += size;
+            continue;
+        }
+
+        const char *const eol = (const char *)memchr(data, '\n', tail);
+        if(!eol)
+            break; // incomplete line
+
+        const size_t line = eol - data + 1;
+
+        if(client->is_trailer)
+        {
+            skip += line;
+            if(line <= 2)
+            { /* empty line */
+                *is_done = true;
+                break;
+            }
+            continue;
+        }
+
+        parse_match_t m[2];
+        if(!http_parse_chunk(data, line, m))
+            return -1;
+
+        size_t chunk_size = 0;
+        for(size_t i = m[1].so; i < m[1].eo; ++i)
+        {
+            const char c = data[i];
+            if(c >= '0' && c <= '9')
+                chunk_size = (chunk_size << 4) | (c - '0');
+            else if(c >= 'a' && c <= 'f')
+                chunk_size = (chunk_size << 4) | (c - 'a' + 0x0A);
+            else if(c >= 'A' && c <= 'F')
+                chunk_size = (chunk_size << 4) | (c - 'A' + 0x0A);
+        }
+        skip += m[0].eo;
+
+        if(chunk_size == 0)
+            client->is_trailer = true;
+        else
+            client->chunk_left = chunk_size + 2;
     }
 
+    return skip - begin;
+}
+
+static void client_parse(http_client_t *client)
+{
+    module_data_t *const mod = client->mod;
+    lua_State *const L = MODULE_L(mod);
+
     char *uri_host = NULL;
     size_t uri_host_size = 0;
 
     size_t eoh = 0; // end of headers
     size_t skip = 0;
-    client->buffer_skip += size;
 
     if(client->status == 0)
     {
-        // check empty line
-        while(skip < client->buffer_skip)
+        // empty lines before the request line are allowed (RFC 7230, 3.5)
+        if(client->scan.skip == 0)
         {
-            if(   client->buffer[skip + 0] == '\r'
-               && client->buffer[skip + 1] == '\n'
-               && client->buffer[skip + 2] == '\r'
-               && client->buffer[skip + 3] == '\n')
+            size_t lead = 0;
+            while(   lead < client->buffer_skip
+                  && (client->buffer[lead] == '\r' || client->buffer[lead] == '\n'))
             {
-                eoh = skip + 4;
-                client->status = 1; // empty line is found
-                break;
+                ++lead;
+            }
+
+            if(lead > 0)
+            {
+                client->buffer_skip -= lead;
+                memmove(client->buffer, &client->buffer[lead], client->buffer_skip);
+                if(client->buffer_skip == 0)
+                    return;
             }
-            ++skip;
         }
 
-        if(client->status != 1)
+        if(!http_scan_head(&client->scan, client->buffer, client->buffer_skip))
+        {
+            asc_log_error(MSG("too many request headers"));
+            on_client_close(client);
             return;
+        }
+
+        if(client->scan.eoh == 0)
+        {
+            if(client->buffer_skip >= HTTP_BUFFER_SIZE)
+            {
+                asc_log_error(MSG("request headers are too large"));
+                on_client_close(client);
+            }
+            return;
+        }
+
+        eoh = client->scan.eoh;
+        client->status = 1; // empty line is found
     }
 
     if(client->status == 1)
@@ -258,13 +899,20 @@ static void on_client_read(void *arg)
  *                                   88o8
  */
 
-        if(!http_parse_request(client->buffer, eoh, m))
+        const http_scan_line_t *line = client->scan.line;
+        if(client->scan.count == 0 || !http_parse_request(client->buffer, line[1].so, m))
         {
             asc_log_error(MSG("failed to parse request line"));
             on_client_close(client);
             return;
         }
 
+        if(client_stream(client, m))
+            return;
+
+        ++client->requests;
+        client->idle_time = 0;
+
         lua_newtable(L);
         const int request = lua_gettop(L);
 
@@ -338,6 +986,7 @@ static void on_client_read(void *arg)
         }
 
         lua_pushlstring(L, &client->buffer[m[3].so], m[3].eo - m[3].so);
+        const bool is_http_1_1 = (strcmp(lua_tostring(L, -1), "HTTP/1.1") == 0);
         lua_setfield(L, request, __version);
 
         skip = m[0].eo;
@@ -356,79 +1005,110 @@ static void on_client_read(void *arg)
         lua_setfield(L, request, __headers);
         const int headers = lua_gettop(L);
 
-        while(skip < eoh)
+        for(unsigned int i = 1; i < client->scan.count; ++i)
         {
-            if(!http_parse_header(&client->buffer[skip], eoh - skip, m))
+            ++line;
+
+            if(line->delim <= line->so)
             {
                 asc_log_error(MSG("failed to parse request headers"));
+                lua_pop(L, 2); // headers + request
                 on_client_close(client);
                 return;
             }
 
-            if(m[1].eo == 0)
-            { /* empty line */
-                skip += m[0].eo;
-                client->status = 2;
-                break;
+            // skip ':' and leading spaces
+            size_t value = line->delim + 1;
+            if(!parse_skip_space(client->buffer, line->eo, &value))
+                value = line->eo;
+
+            // and trailing ones
+            size_t value_end = line->eo;
+            while(   value_end > value
+                  && (client->buffer[value_end - 1] == ' '
+                      || client->buffer[value_end - 1] == '\t'))
+            {
+                --value_end;
             }
 
-            lua_string_to_lower(L, &client->buffer[skip], m[1].eo);
-            lua_pushlstring(L, &client->buffer[skip + m[2].so], m[2].eo - m[2].so);
+            lua_string_to_lower(L, &client->buffer[line->so], line->delim - line->so);
+            lua_pushlstring(L, &client->buffer[value], value_end - value);
             lua_settable(L, headers);
-
-            skip += m[0].eo;
         }
 
+        skip = eoh;
+        client->status = 2;
+
         if(uri_host)
         {
             lua_pushlstring(L, uri_host, uri_host_size);
             lua_setfield(L, headers, "host");
         }
 
-        lua_getfield(L, headers, "content-length");
-        if(lua_isnumber(L, -1))
+        client->is_content_length = false;
+        client->is_chunked = false;
+        client->is_trailer = false;
+        client->chunk_left = 0;
+
+        if(client->content)
         {
-            client->chunk_left = lua_tointeger(L, -1);
-            if(client->chunk_left > 0)
-            {
-                if(client->content)
-                    string_buffer_free(client->content);
-                client->content = string_buffer_alloc();
-                client->is_content_length = true;
-            }
+            string_buffer_free(client->content);
+            client->content = NULL;
         }
-        lua_pop(L, 1); // content-length
-
-        lua_pop(L, 2); // headers + request
 
-        client->idx_callback = 0;
-        asc_list_for(mod->routes)
+        if(is_header_token(L, headers, "transfer-encoding", "chunked"))
         {
-            route_t *route = (route_t *)asc_list_data(mod->routes);
-            if(routecmp(path, route->path))
+            client->content = string_buffer_alloc();
+            client->is_chunked = true;
+        }
+        else
+        {
+            lua_getfield(L, headers, "content-length");
+            if(lua_isnumber(L, -1))
             {
-                client->idx_callback = route->idx_callback;
-                break;
+                client->chunk_left = lua_tointeger(L, -1);
+                if(client->chunk_left > 0)
+                {
+                    client->content = string_buffer_alloc();
+                    client->is_content_length = true;
+                }
             }
+            lua_pop(L, 1); // content-length
         }
 
+        // HTTP/1.1 is persistent by default, HTTP/1.0 only on request
+        client->is_keep_alive = false;
+        if(mod->keep_alive_max > 0 && client->requests < mod->keep_alive_max)
+        {
+            if(is_http_1_1)
+                client->is_keep_alive = !is_header_token(L, headers, "connection", "close");
+            else
+                client->is_keep_alive = is_header_token(L, headers, "connection", "keep-alive");
+        }
+
+        lua_pop(L, 2); // headers + request
+
+        const route_t *const route = (route_t *)http_route_find(mod->route_table, path);
+        client->idx_callback = (route) ? route->idx_callback : 0;
+
         if(!client->idx_callback)
         {
             http_client_warning(client, "route not found %s", path);
+
+            // nothing left to read, the connection may persist
+            if(!client->content)
+            {
+                pipeline_save(client, skip);
+                client->status = 3;
+            }
+
             http_client_abort(client, 404, NULL);
             return;
         }
 
         if(!client->content)
         {
-            client->status = 3;
-            callback(L, client);
-            return;
-        }
-
-        if(skip >= client->buffer_skip)
-        {
-            client->buffer_skip = 0;
+            request_done(client, skip);
             return;
         }
     }
@@ -442,6 +1122,37 @@ static void on_client_read(void *arg)
  *
  */
 
+    // Transfer-Encoding: chunked
+    if(client->is_chunked)
+    {
+        bool is_done = false;
+        const ssize_t size = parse_chunked(client, skip, &is_done);
+        if(size == -1)
+        {
+            asc_log_error(MSG("failed to parse request content"));
+            on_client_close(client);
+            return;
+        }
+        skip += size;
+
+        if(is_done)
+        {
+            request_done(client, skip);
+            return;
+        }
+
+        // keep the incomplete chunk line
+        client->buffer_skip -= skip;
+        memmove(client->buffer, &client->buffer[skip], client->buffer_skip);
+
+        if(client->buffer_skip >= HTTP_BUFFER_SIZE)
+        {
+            asc_log_error(MSG("failed to parse request content"));
+            on_client_close(client);
+        }
+        return;
+    }
+
     // Content-Length: *
     if(client->is_content_length)
     {
@@ -450,23 +1161,18 @@ static void on_client_read(void *arg)
         if(client->chunk_left > tail)
         {
             string_buffer_addlstring(client->content,
-                &client->buffer[skip], client->buffer_skip - skip);
+                &client->buffer[skip], tail);
             client->chunk_left -= tail;
         }
         else
         {
             string_buffer_addlstring(client->content,
                 &client->buffer[skip], client->chunk_left);
+            skip += client->chunk_left;
             client->chunk_left = 0;
 
-            lua_rawgeti(L, LUA_REGISTRYINDEX, client->idx_request);
-            string_buffer_push(L, client->content);
-            client->content = NULL;
-            lua_setfield(L, -2, __content);
-            lua_pop(L, 1); // request
-
-            client->status = 3;
-            callback(L, client);
+            request_done(client, skip);
+            return;
         }
 
         client->buffer_skip = 0;
@@ -515,7 +1221,7 @@ static void on_ready_send_content(void *arg)
     client->chunk_left -= send_size;
 
     if(client->chunk_left == 0)
-        on_client_close(client);
+        http_client_done(client);
 }
 
 /* Stack: 1 - server, 2 - client, 3 - response */
@@ -618,12 +1324,16 @@ static void on_ready_send_response(void *arg)
         {
             client->buffer_skip = 0;
 
-            asc_socket_set_on_read(client->sock, client->on_read);
+            // without a handler of its own, keep watching for EOF
+            // and pipelined requests
+            asc_socket_set_on_read(client->sock, (client->on_read)
+                                                 ? client->on_read
+                                                 : on_client_read);
             asc_socket_set_on_ready(client->sock, client->on_ready);
             return;
         }
 
-        on_client_close(client);
+        http_client_done(client);
     }
 }
 
@@ -632,6 +1342,7 @@ static const char * http_code(int code)
     switch(code)
     {
         case 200: return "Ok";
+        case 206: return "Partial Content";
 
         case 301: return "Moved Permanently";
         case 302: return "Found";
@@ -642,6 +1353,7 @@ static const char * http_code(int code)
         case 403: return "Forbidden";
         case 404: return "Not Found";
         case 405: return "Method Not Allowed";
+        case 416: return "Range Not Satisfiable";
         case 429: return "Too Many Requests";
 
         case 500: return "Internal Server Error";
@@ -666,6 +1378,10 @@ void http_response_code(http_client_t *client, int code, const char *message)
                                    , HTTP_BUFFER_SIZE - client->chunk_left
                                    , "Server: %s\r\n"
                                    , client->mod->server_name);
+
+    // responses without body
+    client->is_response_length = (code == 204 || code == 304);
+    client->is_response_connection = false;
 }
 
 void http_response_header(http_client_t *client, const char *header, ...)
@@ -673,9 +1389,23 @@ void http_response_header(http_client_t *client, const char *header, ...)
     va_list ap;
     va_start(ap, header);
 
+    const char *const line = &client->buffer[client->chunk_left];
     client->chunk_left += vsnprintf(&client->buffer[client->chunk_left]
                                     , HTTP_BUFFER_SIZE - client->chunk_left
                                     , header, ap);
+
+    // persistent connection needs to know where the response ends
+    if(strncasecmp(line, __content_length, sizeof(__content_length) - 2) == 0)
+    {
+        client->is_response_length = true;
+    }
+    else if(strncasecmp(line, "Connection:", 11) == 0)
+    {
+        client->is_response_connection = true;
+        if(is_token(&line[11], "close"))
+            client->is_keep_alive = false;
+    }
+
     client->buffer[client->chunk_left + 0] = '\r';
     client->buffer[client->chunk_left + 1] = '\n';
     client->chunk_left += 2;
@@ -685,6 +1415,19 @@ void http_response_header(http_client_t *client, const char *header, ...)
 
 void http_response_send(http_client_t *client)
 {
+    if(   client->status != 3
+       || !(client->is_response_length || client->is_head))
+    {
+        client->is_keep_alive = false;
+    }
+
+    if(!client->is_response_connection)
+    {
+        http_response_header(client, "%s", (client->is_keep_alive)
+                                           ? __connection_keep_alive
+                                           : __connection_close);
+    }
+
     client->buffer[client->chunk_left + 0] = '\r';
     client->buffer[client->chunk_left + 1] = '\n';
     client->chunk_left += 2;
@@ -728,6 +1471,70 @@ void http_client_close(http_client_t *client)
     on_client_close(client);
 }
 
+void http_client_done(http_client_t *client)
+{
+    module_data_t *const mod = client->mod;
+    lua_State *const L = MODULE_L(mod);
+
+    if(!client->is_keep_alive)
+    {
+        on_client_close(client);
+        return;
+    }
+
+    // release request, like on_client_close() does
+    client->status = 0;
+    callback(L, client);
+
+    if(client->response)
+    {
+        asc_log_error(MSG("client instance is not released"));
+        on_client_close(client);
+        return;
+    }
+
+    if(client->idx_content)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, client->idx_content);
+        client->idx_content = 0;
+    }
+
+    if(client->idx_request)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, client->idx_request);
+        client->idx_request = 0;
+    }
+
+    if(client->idx_data)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, client->idx_data);
+        client->idx_data = 0;
+    }
+
+    client->idx_callback = 0;
+    client->is_head = false;
+    client->chunk_left = 0;
+
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = NULL;
+
+    client->idle_time = asc_utime();
+
+    asc_socket_set_on_ready(client->sock, NULL);
+    asc_socket_set_on_read(client->sock, on_client_read);
+
+    // pipelined request
+    http_scan_reset(&client->scan);
+    client->buffer_skip = client->pipeline_skip;
+    client->pipeline_skip = 0;
+    if(client->buffer_skip > 0)
+    {
+        memcpy(client->buffer, client->pipeline, client->buffer_skip);
+        client_parse(client);
+    }
+}
+
 void http_client_abort(http_client_t *client, int code, const char *text)
 {
     module_data_t *const mod = client->mod;
@@ -763,7 +1570,6 @@ void http_client_abort(http_client_t *client, int code, const char *text)
     http_response_code(client, code, message);
     http_response_header(client, "Content-Type: text/html");
     http_response_header(client, "%s%d", __content_length, content_length);
-    http_response_header(client, __connection_close);
     http_response_send(client);
 }
 
@@ -810,6 +1616,8 @@ static void on_server_close(void *arg)
     asc_socket_close(mod->sock);
     mod->sock = NULL;
 
+    ASC_FREE(mod->timer_idle, asc_timer_destroy);
+
     if(mod->clients)
     {
         http_client_t *prev_client = NULL;
@@ -827,6 +1635,39 @@ static void on_server_close(void *arg)
         mod->clients = NULL;
     }
 
+    ASC_FREE(mod->admit, free);
+    ASC_FREE(mod->route_table, http_route_destroy);
+    ASC_FREE(mod->stream_table, http_route_destroy);
+
+    if(mod->streams)
+    {
+        asc_list_clear(mod->streams)
+        {
+            stream_free(mod, (http_stream_t *)asc_list_data(mod->streams));
+        }
+
+        asc_list_destroy(mod->streams);
+        mod->streams = NULL;
+    }
+
+    if(mod->stream_events)
+    {
+        asc_job_prune(mod);
+        asc_list_clear(mod->stream_events)
+        {
+            stream_event_free((stream_event_t *)asc_list_data(mod->stream_events));
+        }
+
+        asc_list_destroy(mod->stream_events);
+        mod->stream_events = NULL;
+    }
+
+    if(mod->idx_on_stream)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, mod->idx_on_stream);
+        mod->idx_on_stream = 0;
+    }
+
     if(mod->routes)
     {
         asc_list_till_empty(mod->routes)
@@ -848,30 +1689,129 @@ static void on_server_close(void *arg)
     }
 }
 
-static void on_server_accept(void *arg)
+static void timer_idle_callback(void *arg)
 {
     module_data_t *const mod = (module_data_t *)arg;
+    const uint64_t now = asc_utime();
+
+    // idle clients have no request or stream, releasing them doesn't
+    // call Lua and can't touch the list
+    asc_list_first(mod->clients);
+    while(!asc_list_eol(mod->clients))
+    {
+        http_client_t *const client = (http_client_t *)asc_list_data(mod->clients);
+        if(   client->status != 3 && client->idle_time > 0
+           && now - client->idle_time >= mod->keep_alive_timeout)
+        {
+            asc_log_debug(MSG("client timeout %s:%d")
+                          , asc_socket_addr(client->sock)
+                          , asc_socket_port(client->sock));
+            client_release(client);
+            asc_list_remove_current(mod->clients);
+            free(client);
+        }
+        else
+        {
+            asc_list_next(mod->clients);
+        }
+    }
 
-    http_client_t *const client = ASC_ALLOC(1, http_client_t);
-    client->mod = mod;
-    client->idx_server = mod->idx_self;
+    if(mod->streams)
+        stream_sweep(mod);
 
-    if(!asc_socket_accept(mod->sock, &client->sock, client))
+    // fallback if the job queue was flushed
+    if(mod->stream_events && asc_list_size(mod->stream_events) > 0)
+        on_stream_event(mod);
+}
+
+static bool server_admit(module_data_t *mod, asc_socket_t *sock)
+{
+    if(mod->max_connections > 0 && asc_list_size(mod->clients) >= mod->max_connections)
+        return false;
+
+    if(mod->connection_rate == 0)
+        return true;
+
+    const char *const addr = asc_socket_addr(sock);
+
+    uint32_t hash = 2166136261U;
+    for(const char *p = addr; *p; ++p)
+        hash = (hash ^ (uint8_t)*p) * 16777619U;
+
+    http_admit_t *const slot = &mod->admit[hash % HTTP_ADMIT_SLOTS];
+    const uint64_t now = asc_utime();
+
+    if(strcmp(slot->addr, addr) != 0 || now - slot->time >= 1000000)
     {
-        free(client);
-        on_server_close(mod);
-        asc_lib_abort(); // TODO: try to restart server
+        strncpy(slot->addr, addr, sizeof(slot->addr) - 1);
+        slot->time = now;
+        slot->count = 0;
     }
 
-    asc_list_insert_tail(mod->clients, client);
+    return (++slot->count <= mod->connection_rate);
+}
 
-    asc_log_debug(MSG("client connected %s:%d (%zu clients)")
-                      , asc_socket_addr(client->sock)
-                      , asc_socket_port(client->sock)
-                      , asc_list_size(mod->clients));
+static void on_server_accept(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
 
-    asc_socket_set_on_read(client->sock, on_client_read);
-    asc_socket_set_on_close(client->sock, on_client_close);
+    static const char busy[] =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Connection: close\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n";
+
+    // drain the backlog, but leave some time for the other sockets
+    for(unsigned int i = 0; i < HTTP_ACCEPT_BATCH; i++)
+    {
+        http_client_t *const client = ASC_ALLOC(1, http_client_t);
+        client->mod = mod;
+        client->idx_server = mod->idx_self;
+
+        if(!asc_socket_accept(mod->sock, &client->sock, client))
+        {
+            free(client);
+
+            if(asc_socket_would_block())
+                return;
+
+            on_server_close(mod);
+            asc_lib_abort(); // TODO: try to restart server
+        }
+
+        // reject before any request processing
+        if(!server_admit(mod, client->sock))
+        {
+            ++mod->rejected;
+            asc_log_debug(MSG("client rejected %s:%d (%zu clients)")
+                          , asc_socket_addr(client->sock)
+                          , asc_socket_port(client->sock)
+                          , asc_list_size(mod->clients));
+
+            const ssize_t ret = asc_socket_send(client->sock, busy, sizeof(busy) - 1);
+            __uarg(ret);
+
+            asc_socket_close(client->sock);
+            free(client);
+            continue;
+        }
+
+        ++mod->accepted;
+
+        if(mod->egress.rate > 0)
+            client->shaper = &mod->egress;
+
+        asc_list_insert_tail(mod->clients, client);
+        client->idle_time = asc_utime();
+
+        asc_log_debug(MSG("client connected %s:%d (%zu clients)")
+                          , asc_socket_addr(client->sock)
+                          , asc_socket_port(client->sock)
+                          , asc_list_size(mod->clients));
+
+        asc_socket_set_on_read(client->sock, on_client_read);
+        asc_socket_set_on_close(client->sock, on_client_close);
+    }
 }
 
 /*
@@ -913,6 +1853,55 @@ static int method_close(lua_State *L, module_data_t *mod)
     return 0;
 }
 
+static int method_stream(lua_State *L, module_data_t *mod)
+{
+    asc_assert(lua_isstring(L, 2), MSG(":stream() path required"));
+
+    const char *path = lua_tostring(L, 2);
+
+    int idx_owner = 0;
+    module_stream_t *upstream = NULL;
+    if(!lua_isnoneornil(L, 3))
+    {
+        upstream = stream_arg(L, 3, &idx_owner);
+        asc_assert(upstream != NULL, MSG(":stream() stream instance required"));
+    }
+
+    if(mod->streams)
+        stream_set(mod, path, upstream, idx_owner);
+    else if(idx_owner)
+        luaL_unref(L, LUA_REGISTRYINDEX, idx_owner);
+
+    return 0;
+}
+
+static int method_stat(lua_State *L, module_data_t *mod)
+{
+    if(lua_gettop(L) == 1)
+    {
+        lua_newtable(L);
+        lua_pushnumber(L, (mod->clients) ? asc_list_size(mod->clients) : 0);
+        lua_setfield(L, -2, "clients");
+        lua_pushnumber(L, mod->egress.rate * 8 / 1000);
+        lua_setfield(L, -2, "egress_limit");
+        lua_pushnumber(L, mod->egress.throttled);
+        lua_setfield(L, -2, "throttled");
+        lua_pushnumber(L, mod->accepted);
+        lua_setfield(L, -2, "accepted");
+        lua_pushnumber(L, mod->rejected);
+        lua_setfield(L, -2, "rejected");
+        return 1;
+    }
+
+    asc_assert(lua_islightuserdata(L, 2), MSG(":stat() client instance required"));
+    http_client_t *client = (http_client_t *)lua_touserdata(L, 2);
+
+    if(!http_upstream_stat(L, client))
+        lua_pushnil(L);
+
+    return 1;
+}
+
 static int method_redirect(lua_State *L, module_data_t *mod)
 {
     asc_assert(lua_islightuserdata(L, 2), MSG(":redirect() client instance required"));
@@ -966,8 +1955,30 @@ static void module_init(lua_State *L, module_data_t *mod)
     mod->http_version = "HTTP/1.1";
     module_option_string(L, "http_version", &mod->http_version, NULL);
 
+    int keep_alive = HTTP_KEEP_ALIVE_MAX;
+    module_option_integer(L, "keep_alive", &keep_alive);
+    mod->keep_alive_max = (keep_alive > 0) ? keep_alive : 0;
+
+    int timeout = HTTP_KEEP_ALIVE_TIMEOUT;
+    module_option_integer(L, "keep_alive_timeout", &timeout);
+    if(timeout <= 0)
+        timeout = HTTP_KEEP_ALIVE_TIMEOUT;
+    mod->keep_alive_timeout = timeout * 1000000ULL;
+
+    int value = 0;
+    if(module_option_integer(L, "max_connections", &value) && value > 0)
+        mod->max_connections = value;
+
+    value = 0;
+    if(module_option_integer(L, "connection_rate", &value) && value > 0)
+    {
+        mod->connection_rate = value;
+        mod->admit = ASC_ALLOC(HTTP_ADMIT_SLOTS, http_admit_t);
+    }
+
     // store routes in registry
     mod->routes = asc_list_init();
+    mod->route_table = http_route_init();
     lua_getfield(L, MODULE_OPTIONS_IDX, "route");
     asc_assert(lua_istable(L, -1), MSG("option 'route' is required"));
     for(lua_pushnil(L); lua_next(L, -2); lua_pop(L, 1))
@@ -997,9 +2008,52 @@ static void module_init(lua_State *L, module_data_t *mod)
         lua_pop(L, 1); // path
 
         asc_list_insert_tail(mod->routes, route);
+        asc_assert(http_route_add(mod->route_table, route->path, route)
+                   , MSG("route path: '*' must be the last character"
+                         " or followed by '/'"));
     }
     lua_pop(L, 1); // route
 
+    // native stream routes
+    mod->streams = asc_list_init();
+    mod->stream_events = asc_list_init();
+
+    const char *const error = http_upstream_config(L, MODULE_OPTIONS_IDX
+                                                   , &mod->stream_config);
+    asc_assert(error == NULL, MSG("%s"), error);
+
+    int egress_limit = 0;
+    module_option_integer(L, "egress_limit", &egress_limit);
+    if(egress_limit > 0)
+        http_shaper_set_rate(&mod->egress, egress_limit * 1000ULL / 8);
+
+    lua_getfield(L, MODULE_OPTIONS_IDX, "on_stream");
+    if(lua_isfunction(L, -1))
+        mod->idx_on_stream = luaL_ref(L, LUA_REGISTRYINDEX);
+    else
+        lua_pop(L, 1);
+
+    lua_getfield(L, MODULE_OPTIONS_IDX, "streams");
+    if(lua_istable(L, -1))
+    {
+        lua_foreach(L, -2)
+        {
+            int idx_owner = 0;
+            module_stream_t *const upstream = (lua_type(L, -2) == LUA_TSTRING)
+                                            ? stream_arg(L, -1, &idx_owner)
+                                            : NULL;
+            asc_assert(upstream != NULL
+                       , MSG("streams format: { [\"/path\"] = stream, ... }"));
+
+            http_stream_t *const stream =
+                stream_alloc(mod, lua_tostring(L, -2), upstream, idx_owner);
+            asc_list_insert_tail(mod->streams, stream);
+        }
+    }
+    lua_pop(L, 1); // streams
+
+    stream_table_update(mod);
+
     // store self in registry
     lua_pushvalue(L, 3);
     mod->idx_self = luaL_ref(L, LUA_REGISTRYINDEX);
@@ -1014,12 +2068,20 @@ static void module_init(lua_State *L, module_data_t *mod)
         mod->sock = asc_socket_open_tcp4(mod);
 
     asc_socket_set_reuseaddr(mod->sock, 1);
+
+    bool reuseport = false;
+    module_option_boolean(L, "reuseport", &reuseport);
+    if(reuseport)
+        asc_socket_set_reuseport(mod->sock, 1);
+
     if(!asc_socket_bind(mod->sock, mod->addr, mod->port))
     {
         on_server_close(mod);
         asc_lib_abort(); // TODO: try to restart server
     }
     asc_socket_listen(mod->sock, on_server_accept, on_server_close);
+
+    mod->timer_idle = asc_timer_init(1000, timer_idle_callback, mod);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -1037,5 +2099,7 @@ MODULE_LUA_METHODS()
     { "data", method_data },
     { "redirect", method_redirect },
     { "abort", method_abort },
+    { "stream", method_stream },
+    { "stat", method_stat },
 };
 MODULE_LUA_REGISTER(http_server)
@@ -0,0 +1,82 @@
+/*
+ * Astra Module: HTTP (Egress shaper)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "shaper.h"
+
+void http_shaper_set_rate(http_shaper_t *shaper, uint64_t rate)
+{
+    shaper->rate = rate;
+    shaper->size = rate * HTTP_SHAPER_DEPTH / 1000;
+
+    // a single send should always fit
+    if(shaper->size < 2 * HTTP_SHAPER_CHUNK)
+        shaper->size = 2 * HTTP_SHAPER_CHUNK;
+
+    if(shaper->tokens > shaper->size)
+        shaper->tokens = shaper->size;
+}
+
+/* returns number of bytes that can be sent now */
+size_t http_shaper_get(http_shaper_t *shaper, uint64_t now)
+{
+    if(shaper->rate == 0)
+        return SIZE_MAX;
+
+    if(shaper->time == 0)
+    {
+        shaper->time = now;
+        shaper->tokens = shaper->size;
+    }
+    else if(now > shaper->time)
+    {
+        const uint64_t tokens = (now - shaper->time) * shaper->rate / 1000000;
+
+        // keep the remainder for the next refill
+        if(tokens > 0)
+        {
+            shaper->time += tokens * 1000000 / shaper->rate;
+
+            if(shaper->tokens + tokens < shaper->size)
+                shaper->tokens += tokens;
+            else
+                shaper->tokens = shaper->size;
+        }
+    }
+
+    return shaper->tokens;
+}
+
+void http_shaper_put(http_shaper_t *shaper, size_t size)
+{
+    if(shaper->rate == 0)
+        return;
+
+    shaper->tokens = (size < shaper->tokens) ? shaper->tokens - size : 0;
+}
+
+/* returns milliseconds until the bucket has size bytes */
+unsigned int http_shaper_delay(const http_shaper_t *shaper, size_t size)
+{
+    if(shaper->rate == 0 || shaper->tokens >= size)
+        return 0;
+
+    const uint64_t ms = (size - shaper->tokens) * 1000 / shaper->rate + 1;
+    return (ms < 1000) ? ms : 1000;
+}
@@ -0,0 +1,57 @@
+/*
+ * Astra Module: HTTP (Egress shaper)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HTTP_SHAPER_H_
+#define _HTTP_SHAPER_H_ 1
+
+#include <astra.h>
+
+/*
+ * Token bucket.
+ *
+ * Tokens are bytes, refilled at `rate' bytes per second up to the bucket
+ * size. The bucket holds HTTP_SHAPER_DEPTH milliseconds of traffic, so a
+ * sender that has been waiting may catch up with a short burst but never
+ * runs ahead of the rate. Zero rate means no limit.
+ */
+
+#define HTTP_SHAPER_DEPTH 100
+
+/* smallest send worth waking up for */
+#define HTTP_SHAPER_CHUNK (16 * 1024)
+
+typedef struct
+{
+    uint64_t rate;          // bytes per second, 0 - unlimited
+    size_t size;
+    size_t tokens;
+    uint64_t time;          // last refill
+
+    uint64_t throttled;     // times the sender had to wait
+} http_shaper_t;
+
+void http_shaper_set_rate(http_shaper_t *shaper, uint64_t rate);
+
+size_t http_shaper_get(http_shaper_t *shaper, uint64_t now) __wur;
+void http_shaper_put(http_shaper_t *shaper, size_t size);
+
+unsigned int http_shaper_delay(const http_shaper_t *shaper, size_t size) __wur;
+
+#endif /* _HTTP_SHAPER_H_ */
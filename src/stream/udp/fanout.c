@@ -0,0 +1,377 @@
+/*
+ * Astra Module: UDP (unicast fan-out)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <astra.h>
+#include "rtp.h"
+#include "fanout.h"
+
+#ifndef _WIN32
+#   include <arpa/inet.h>
+#   include <netinet/in.h>
+#endif
+
+/* messages per sendmmsg() call */
+#define FANOUT_BATCH 64
+
+/* minimum interval between error messages for a destination, us */
+#define FANOUT_ERROR_INTERVAL (1 * 1000 * 1000)
+
+typedef struct
+{
+    struct sockaddr_in addr;
+    uint16_t seq;
+    uint8_t rtp[RTP_HEADER_SIZE];
+
+    unsigned int errors;
+    uint64_t error_time;
+} fanout_dest_t;
+
+struct udp_fanout_t
+{
+    bool is_rtp;
+
+    fanout_dest_t *dest;
+    unsigned int count;
+    unsigned int alloc;
+
+    /* datagram interrupted by a full socket buffer */
+    uint8_t *pending;
+    size_t pending_size;
+    size_t pending_len;
+    bool is_pending;
+    unsigned int next;
+
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msg[FANOUT_BATCH];
+    struct iovec iov[FANOUT_BATCH][2];
+#else
+    uint8_t *buffer;
+    size_t buffer_size;
+#endif /* HAVE_SENDMMSG */
+};
+
+/*
+ * create and destroy
+ */
+
+udp_fanout_t *udp_fanout_init(bool is_rtp)
+{
+    udp_fanout_t *const f = ASC_ALLOC(1, udp_fanout_t);
+    f->is_rtp = is_rtp;
+
+    return f;
+}
+
+void udp_fanout_destroy(udp_fanout_t *f)
+{
+#ifndef HAVE_SENDMMSG
+    free(f->buffer);
+#endif
+    free(f->pending);
+    free(f->dest);
+    free(f);
+}
+
+/*
+ * destination list
+ */
+
+static bool dest_addr(struct sockaddr_in *sa, const char *addr, int port)
+{
+    if (port <= 0 || port > 0xFFFF)
+        return false;
+
+    memset(sa, 0, sizeof(*sa));
+    sa->sin_family = AF_INET;
+    sa->sin_port = htons(port);
+    sa->sin_addr.s_addr = inet_addr(addr);
+
+    return (sa->sin_addr.s_addr != INADDR_NONE);
+}
+
+static int dest_find(const udp_fanout_t *f, const struct sockaddr_in *sa)
+{
+    for (unsigned int i = 0; i < f->count; i++)
+    {
+        const struct sockaddr_in *const item = &f->dest[i].addr;
+
+        if (item->sin_addr.s_addr == sa->sin_addr.s_addr
+            && item->sin_port == sa->sin_port)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool udp_fanout_add(udp_fanout_t *f, const char *addr, int port)
+{
+    struct sockaddr_in sa;
+    if (!dest_addr(&sa, addr, port) || dest_find(f, &sa) != -1)
+        return false;
+
+    if (f->count >= f->alloc)
+    {
+        f->alloc = (f->alloc > 0) ? f->alloc * 2 : 8;
+        f->dest = (fanout_dest_t *)realloc(f->dest
+                                           , f->alloc * sizeof(*f->dest));
+        asc_assert(f->dest != NULL, "[udp_fanout] realloc() failed");
+    }
+
+    fanout_dest_t *const dest = &f->dest[f->count++];
+    memset(dest, 0, sizeof(*dest));
+    memcpy(&dest->addr, &sa, sizeof(sa));
+
+    if (f->is_rtp)
+    {
+        const uint32_t ssrc = (uint32_t)rand();
+
+        dest->seq = (uint16_t)rand();
+        dest->rtp[0] = 0x80; // RTP version
+        dest->rtp[1] = RTP_PT_MP2T;
+        dest->rtp[8] = (ssrc >> 24) & 0xFF;
+        dest->rtp[9] = (ssrc >> 16) & 0xFF;
+        dest->rtp[10] = (ssrc >> 8) & 0xFF;
+        dest->rtp[11] = (ssrc) & 0xFF;
+    }
+
+    return true;
+}
+
+bool udp_fanout_remove(udp_fanout_t *f, const char *addr, int port)
+{
+    struct sockaddr_in sa;
+    if (!dest_addr(&sa, addr, port))
+        return false;
+
+    const int idx = dest_find(f, &sa);
+    if (idx == -1)
+        return false;
+
+    --f->count;
+
+    if (f->is_pending)
+    {
+        /*
+         * A datagram is half way through the list. Keep the order, so
+         * the resume picks up with the same destinations.
+         */
+        memmove(&f->dest[idx], &f->dest[idx + 1]
+                , (f->count - idx) * sizeof(*f->dest));
+
+        if ((unsigned int)idx < f->next)
+            f->next--;
+    }
+    else if ((unsigned int)idx != f->count)
+    {
+        /* order doesn't matter; move the last entry into the hole */
+        memcpy(&f->dest[idx], &f->dest[f->count], sizeof(*f->dest));
+    }
+
+    return true;
+}
+
+unsigned int udp_fanout_count(const udp_fanout_t *f)
+{
+    return f->count;
+}
+
+void udp_fanout_get(const udp_fanout_t *f, unsigned int idx
+                    , char *addr, size_t size, int *port)
+{
+    const fanout_dest_t *const dest = &f->dest[idx];
+
+    snprintf(addr, size, "%s", inet_ntoa(dest->addr.sin_addr));
+    *port = ntohs(dest->addr.sin_port);
+}
+
+/*
+ * sending
+ */
+
+static inline
+void dest_header(fanout_dest_t *dest, const uint8_t *data)
+{
+    /* flags and timestamp are shared, sequence number is per destination */
+    memcpy(&dest->rtp[0], &data[0], 2);
+    dest->rtp[2] = (dest->seq >> 8) & 0xFF;
+    dest->rtp[3] = (dest->seq) & 0xFF;
+    memcpy(&dest->rtp[4], &data[4], 4);
+}
+
+static void dest_error(fanout_dest_t *dest)
+{
+    /* a dead receiver fails every datagram; don't flood the log */
+    const uint64_t now = asc_utime();
+
+    dest->errors++;
+    if (now - dest->error_time < FANOUT_ERROR_INTERVAL)
+        return;
+
+    asc_log_warning("[udp_fanout] sendto() %s:%d: %s (%u errors)"
+                    , inet_ntoa(dest->addr.sin_addr)
+                    , ntohs(dest->addr.sin_port)
+                    , asc_error_msg(), dest->errors);
+
+    dest->errors = 0;
+    dest->error_time = now;
+}
+
+#ifdef HAVE_SENDMMSG
+/* send to destinations starting at f->next; -1 if the socket is full */
+static int dest_send(udp_fanout_t *f, int fd
+                     , const uint8_t *data, size_t len)
+{
+    const size_t skip = (f->is_rtp) ? RTP_HEADER_SIZE : 0;
+
+    while (f->next < f->count)
+    {
+        unsigned int batch = f->count - f->next;
+        if (batch > FANOUT_BATCH)
+            batch = FANOUT_BATCH;
+
+        for (unsigned int j = 0; j < batch; j++)
+        {
+            fanout_dest_t *const dest = &f->dest[f->next + j];
+            struct msghdr *const hdr = &f->msg[j].msg_hdr;
+
+            if (f->is_rtp)
+                dest_header(dest, data);
+
+            f->iov[j][0].iov_base = dest->rtp;
+            f->iov[j][0].iov_len = skip;
+            f->iov[j][1].iov_base = (void *)&data[skip];
+            f->iov[j][1].iov_len = len - skip;
+
+            memset(hdr, 0, sizeof(*hdr));
+            hdr->msg_name = &dest->addr;
+            hdr->msg_namelen = sizeof(dest->addr);
+            hdr->msg_iov = f->iov[j];
+            hdr->msg_iovlen = 2;
+        }
+
+        int ret = sendmmsg(fd, f->msg, batch, 0);
+        if (ret == -1)
+        {
+            if (asc_socket_would_block())
+                return -1;
+
+            /* skip the destination that failed */
+            dest_error(&f->dest[f->next]);
+            ret = 1;
+        }
+
+        for (int j = 0; j < ret; j++)
+            f->dest[f->next++].seq++;
+    }
+
+    return 0;
+}
+#else /* HAVE_SENDMMSG */
+static int dest_send(udp_fanout_t *f, int fd
+                     , const uint8_t *data, size_t len)
+{
+    const size_t skip = (f->is_rtp) ? RTP_HEADER_SIZE : 0;
+
+    if (f->buffer_size < len)
+    {
+        free(f->buffer);
+        f->buffer = ASC_ALLOC(len, uint8_t);
+        f->buffer_size = len;
+    }
+    memcpy(f->buffer, data, len);
+
+    for (; f->next < f->count; f->next++)
+    {
+        fanout_dest_t *const dest = &f->dest[f->next];
+
+        if (f->is_rtp)
+        {
+            dest_header(dest, data);
+            memcpy(f->buffer, dest->rtp, skip);
+        }
+
+        const ssize_t ret = sendto(fd, (const char *)f->buffer, len, 0
+                                   , (struct sockaddr *)&dest->addr
+                                   , sizeof(dest->addr));
+        if (ret == -1)
+        {
+            if (asc_socket_would_block())
+                return -1;
+
+            dest_error(dest);
+        }
+
+        dest->seq++;
+    }
+
+    return 0;
+}
+#endif /* HAVE_SENDMMSG */
+
+ssize_t udp_fanout_resume(udp_fanout_t *f, asc_socket_t *sock)
+{
+    if (!f->is_pending)
+        return 0;
+
+    if (dest_send(f, asc_socket_fd(sock), f->pending, f->pending_len) == -1)
+        return -1;
+
+    f->is_pending = false;
+
+    return f->count;
+}
+
+ssize_t udp_fanout_send(udp_fanout_t *f, asc_socket_t *sock
+                        , const uint8_t *data, size_t len)
+{
+    const size_t skip = (f->is_rtp) ? RTP_HEADER_SIZE : 0;
+
+    if (len < skip)
+        return 0;
+
+    /* finish the previous datagram first to keep destinations in step */
+    if (udp_fanout_resume(f, sock) == -1)
+        return -1;
+
+    f->next = 0;
+    if (dest_send(f, asc_socket_fd(sock), data, len) == -1)
+    {
+        /* keep a copy; the caller's buffer is reused */
+        const int error = errno;
+
+        if (f->pending_size < len)
+        {
+            free(f->pending);
+            f->pending = ASC_ALLOC(len, uint8_t);
+            f->pending_size = len;
+        }
+        memcpy(f->pending, data, len);
+        f->pending_len = len;
+        f->is_pending = true;
+
+        errno = error;
+        return -1;
+    }
+
+    return f->count;
+}
@@ -0,0 +1,63 @@
+/*
+ * Astra Module: UDP (unicast fan-out)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _UDP_FANOUT_H_
+#define _UDP_FANOUT_H_ 1
+
+#ifndef _ASTRA_H_
+#   error "Please include <astra.h> first"
+#endif /* !_ASTRA_H_ */
+
+#include <core/socket.h>
+
+/*
+ * Unicast fan-out
+ *
+ * Sends every datagram to a list of destinations in as few system
+ * calls as possible. The payload is shared; with RTP, each destination
+ * gets its own 12 byte header with a private SSRC and sequence number,
+ * so receivers see an independent stream. Destinations can be added
+ * and removed at any time without affecting the others.
+ */
+typedef struct udp_fanout_t udp_fanout_t;
+
+udp_fanout_t *udp_fanout_init(bool is_rtp) __wur;
+void udp_fanout_destroy(udp_fanout_t *f);
+
+bool udp_fanout_add(udp_fanout_t *f, const char *addr, int port);
+bool udp_fanout_remove(udp_fanout_t *f, const char *addr, int port);
+
+unsigned int udp_fanout_count(const udp_fanout_t *f) __func_pure;
+void udp_fanout_get(const udp_fanout_t *f, unsigned int idx
+                    , char *addr, size_t size, int *port);
+
+/*
+ * Returns -1 with errno set if the socket buffer filled up partway
+ * through the destination list. The datagram is kept and the rest of
+ * the list gets it on udp_fanout_resume(), which should be called when
+ * the socket becomes writable again. Errors on a single destination
+ * are logged, at most once a second, and don't stop the others.
+ */
+ssize_t udp_fanout_send(udp_fanout_t *f, asc_socket_t *sock
+                        , const uint8_t *data, size_t len);
+ssize_t udp_fanout_resume(udp_fanout_t *f, asc_socket_t *sock);
+
+#endif /* _UDP_FANOUT_H_ */
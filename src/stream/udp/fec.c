@@ -0,0 +1,587 @@
+/*
+ * Astra Module: UDP (SMPTE 2022-1 FEC)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <astra.h>
+#include "fec.h"
+
+/* media history size; must cover two full matrices */
+#define FEC_HISTORY 256
+
+/* maximum number of FEC datagrams waiting for media */
+#define FEC_MAX_PENDING 64
+
+typedef struct
+{
+    size_t len;
+    uint16_t seq;
+    bool used;
+} fec_slot_t;
+
+struct rtp_fec_dec_t
+{
+    size_t size;
+
+    /* recently received media datagrams */
+    fec_slot_t media[FEC_HISTORY];
+    uint8_t *media_buf;
+    bool started;
+    uint16_t max;
+
+    /* FEC datagrams that can't be applied yet */
+    fec_slot_t pending[FEC_MAX_PENDING];
+    uint8_t *pending_buf;
+    unsigned int pending_cnt;
+
+    rtp_fec_dec_stat_t stat;
+
+    void *arg;
+    rtp_callback_t on_packet;
+};
+
+static void media_added(rtp_fec_dec_t *dec, uint16_t seq);
+
+/*
+ * create and destroy
+ */
+
+rtp_fec_dec_t *rtp_fec_dec_init(size_t size)
+{
+    rtp_fec_dec_t *const dec = ASC_ALLOC(1, rtp_fec_dec_t);
+
+    dec->size = size;
+    dec->media_buf = ASC_ALLOC(FEC_HISTORY * size, uint8_t);
+    dec->pending_buf = ASC_ALLOC(FEC_MAX_PENDING * size, uint8_t);
+
+    return dec;
+}
+
+void rtp_fec_dec_destroy(rtp_fec_dec_t *dec)
+{
+    free(dec->pending_buf);
+    free(dec->media_buf);
+    free(dec);
+}
+
+/*
+ * setters and getters
+ */
+
+void rtp_fec_dec_set_on_packet(rtp_fec_dec_t *dec, rtp_callback_t on_packet)
+{
+    dec->on_packet = on_packet;
+}
+
+void rtp_fec_dec_set_arg(rtp_fec_dec_t *dec, void *arg)
+{
+    dec->arg = arg;
+}
+
+void rtp_fec_dec_query(const rtp_fec_dec_t *dec, rtp_fec_dec_stat_t *out)
+{
+    memcpy(out, &dec->stat, sizeof(*out));
+}
+
+/*
+ * media history
+ */
+
+static inline
+fec_slot_t *media_get(rtp_fec_dec_t *dec, uint16_t seq)
+{
+    return &dec->media[seq % FEC_HISTORY];
+}
+
+static inline
+uint8_t *media_data(rtp_fec_dec_t *dec, const fec_slot_t *slot)
+{
+    return &dec->media_buf[(slot - dec->media) * dec->size];
+}
+
+static inline
+bool media_check(rtp_fec_dec_t *dec, uint16_t seq)
+{
+    const fec_slot_t *const slot = media_get(dec, seq);
+    return (slot->used && slot->seq == seq);
+}
+
+/*
+ * FEC matrix
+ */
+
+static inline
+uint8_t *pending_data(rtp_fec_dec_t *dec, const fec_slot_t *slot)
+{
+    return &dec->pending_buf[(slot - dec->pending) * dec->size];
+}
+
+static inline
+const uint8_t *pending_header(rtp_fec_dec_t *dec, const fec_slot_t *slot)
+{
+    const uint8_t *const data = pending_data(dec, slot);
+    return &data[rtp_payload_offset(data, slot->len)];
+}
+
+static void pending_drop(rtp_fec_dec_t *dec, fec_slot_t *slot)
+{
+    slot->used = false;
+    dec->pending_cnt--;
+}
+
+static bool pending_stale(rtp_fec_dec_t *dec, const uint8_t *hdr)
+{
+    /* first member of the group is no longer in history */
+    return (dec->started
+            && RTP_SEQ_DIFF(dec->max, FEC_GET_SNBASE(hdr)) >= FEC_HISTORY);
+}
+
+static bool pending_member(const uint8_t *hdr, uint16_t seq)
+{
+    const uint16_t delta = seq - FEC_GET_SNBASE(hdr);
+    const unsigned int offset = FEC_GET_OFFSET(hdr);
+
+    return (delta % offset == 0 && delta / offset < FEC_GET_NA(hdr));
+}
+
+static void recover(rtp_fec_dec_t *dec, fec_slot_t *fec, uint16_t seq)
+{
+    const uint8_t *const data = pending_data(dec, fec);
+    const size_t off = rtp_payload_offset(data, fec->len) + FEC_HEADER_SIZE;
+    const uint8_t *const hdr = &data[off - FEC_HEADER_SIZE];
+    const size_t fec_len = fec->len - off;
+
+    if (RTP_HEADER_SIZE + fec_len > dec->size)
+    {
+        dec->stat.unrecoverable++;
+        return;
+    }
+
+    const uint16_t base = FEC_GET_SNBASE(hdr);
+    const unsigned int offset = FEC_GET_OFFSET(hdr);
+    const unsigned int na = FEC_GET_NA(hdr);
+
+    uint16_t length = FEC_GET_LENGTH(hdr);
+    uint8_t pt = FEC_GET_PT(hdr);
+    uint32_t ts = FEC_GET_TS(hdr);
+    const uint8_t *ssrc = NULL;
+
+    fec_slot_t *const slot = media_get(dec, seq);
+    uint8_t *const buf = media_data(dec, slot);
+    uint8_t *const payload = &buf[RTP_HEADER_SIZE];
+
+    memcpy(payload, &data[off], fec_len);
+
+    for (unsigned int i = 0; i < na; i++)
+    {
+        const uint16_t member = base + i * offset;
+        if (member == seq)
+            continue;
+
+        const fec_slot_t *const m = media_get(dec, member);
+        const uint8_t *const m_data = media_data(dec, m);
+        const size_t m_off = rtp_payload_offset(m_data, m->len);
+        const size_t m_len = m->len - m_off;
+
+        length ^= m_len;
+        pt ^= RTP_GET_PT(m_data);
+        ts ^= RTP_GET_TS(m_data);
+        ssrc = &m_data[8];
+
+        const size_t n = (m_len < fec_len) ? m_len : fec_len;
+        for (size_t j = 0; j < n; j++)
+            payload[j] ^= m_data[m_off + j];
+    }
+
+    if (length > fec_len || ssrc == NULL)
+    {
+        dec->stat.unrecoverable++;
+        return;
+    }
+
+    buf[0] = 0x80;
+    buf[1] = pt & 0x7F;
+    buf[2] = (seq >> 8) & 0xFF;
+    buf[3] = (seq     ) & 0xFF;
+    buf[4] = (ts >> 24) & 0xFF;
+    buf[5] = (ts >> 16) & 0xFF;
+    buf[6] = (ts >>  8) & 0xFF;
+    buf[7] = (ts      ) & 0xFF;
+    memcpy(&buf[8], ssrc, 4);
+
+    slot->len = RTP_HEADER_SIZE + length;
+    slot->seq = seq;
+    slot->used = true;
+
+    dec->stat.recovered++;
+    dec->on_packet(dec->arg, buf, slot->len);
+
+    media_added(dec, seq);
+}
+
+static void pending_check(rtp_fec_dec_t *dec, fec_slot_t *fec)
+{
+    const uint8_t *const hdr = pending_header(dec, fec);
+    const uint16_t base = FEC_GET_SNBASE(hdr);
+    const unsigned int offset = FEC_GET_OFFSET(hdr);
+    const unsigned int na = FEC_GET_NA(hdr);
+
+    unsigned int missing = 0;
+    uint16_t seq = 0;
+
+    for (unsigned int i = 0; i < na && missing < 2; i++)
+    {
+        const uint16_t member = base + i * offset;
+        if (!media_check(dec, member))
+        {
+            seq = member;
+            missing++;
+        }
+    }
+
+    if (missing >= 2)
+        return;
+
+    /* don't let recursive recovery see this FEC datagram again */
+    pending_drop(dec, fec);
+
+    if (missing == 1)
+        recover(dec, fec, seq);
+}
+
+static void media_added(rtp_fec_dec_t *dec, uint16_t seq)
+{
+    if (!dec->started)
+    {
+        dec->started = true;
+        dec->max = seq;
+    }
+    else if (RTP_SEQ_DIFF(seq, dec->max) > 0)
+    {
+        dec->max = seq;
+    }
+
+    for (unsigned int i = 0; i < FEC_MAX_PENDING && dec->pending_cnt > 0; i++)
+    {
+        fec_slot_t *const fec = &dec->pending[i];
+        if (!fec->used)
+            continue;
+
+        const uint8_t *const hdr = pending_header(dec, fec);
+
+        if (pending_stale(dec, hdr))
+        {
+            dec->stat.unrecoverable++;
+            pending_drop(dec, fec);
+        }
+        else if (pending_member(hdr, seq))
+        {
+            pending_check(dec, fec);
+        }
+    }
+}
+
+void rtp_fec_dec_media(rtp_fec_dec_t *dec, const uint8_t *data, size_t len)
+{
+    if (len > dec->size || rtp_payload_offset(data, len) == 0)
+        return;
+
+    const uint16_t seq = RTP_GET_SEQ(data);
+    fec_slot_t *const slot = media_get(dec, seq);
+
+    if (slot->used && slot->seq == seq)
+        return;
+
+    memcpy(media_data(dec, slot), data, len);
+    slot->len = len;
+    slot->seq = seq;
+    slot->used = true;
+
+    media_added(dec, seq);
+}
+
+void rtp_fec_dec_push(rtp_fec_dec_t *dec, const uint8_t *data, size_t len)
+{
+    if (len > dec->size || len < RTP_HEADER_SIZE)
+        return;
+
+    const size_t off = rtp_payload_offset(data, len);
+    if (off == 0 || off + FEC_HEADER_SIZE > len)
+        return;
+
+    const uint8_t *const hdr = &data[off];
+    const unsigned int offset = FEC_GET_OFFSET(hdr);
+    const unsigned int na = FEC_GET_NA(hdr);
+
+    if (offset == 0 || na == 0 || offset * na > FEC_MAX_LD)
+        return;
+
+    dec->stat.received++;
+
+    if (pending_stale(dec, hdr))
+        return;
+
+    /* find a free slot, evicting the oldest group if necessary */
+    fec_slot_t *fec = NULL;
+    fec_slot_t *oldest = NULL;
+    int oldest_age = -1;
+
+    for (unsigned int i = 0; i < FEC_MAX_PENDING; i++)
+    {
+        fec_slot_t *const slot = &dec->pending[i];
+        if (!slot->used)
+        {
+            fec = slot;
+            break;
+        }
+
+        const int age = RTP_SEQ_DIFF(dec->max
+                                     , FEC_GET_SNBASE(pending_header(dec, slot)));
+        if (age > oldest_age)
+        {
+            oldest = slot;
+            oldest_age = age;
+        }
+    }
+
+    if (fec == NULL)
+    {
+        dec->stat.unrecoverable++;
+        pending_drop(dec, oldest);
+        fec = oldest;
+    }
+
+    memcpy(pending_data(dec, fec), data, len);
+    fec->len = len;
+    fec->seq = RTP_GET_SEQ(data);
+    fec->used = true;
+    dec->pending_cnt++;
+
+    pending_check(dec, fec);
+}
+
+/*
+ * FEC encoder
+ */
+
+typedef struct
+{
+    uint8_t *payload;
+    size_t max;
+    uint16_t length;
+    uint8_t pt;
+    uint32_t ts;
+} fec_acc_t;
+
+struct rtp_fec_enc_t
+{
+    unsigned int cols;
+    unsigned int rows;
+    bool row_fec;
+    size_t size;
+
+    /* position in the matrix */
+    unsigned int pos;
+    uint16_t base;
+
+    fec_acc_t row;
+    fec_acc_t *col;
+
+    /* outgoing FEC datagram */
+    uint8_t *buffer;
+    uint16_t seq_col;
+    uint16_t seq_row;
+
+    void *arg;
+    rtp_callback_t on_column;
+    rtp_callback_t on_row;
+};
+
+rtp_fec_enc_t *rtp_fec_enc_init(unsigned int cols, unsigned int rows
+                                , bool row_fec, size_t size)
+{
+    rtp_fec_enc_t *const enc = ASC_ALLOC(1, rtp_fec_enc_t);
+
+    enc->cols = cols;
+    enc->rows = rows;
+    enc->row_fec = row_fec;
+    enc->size = size;
+
+    enc->col = ASC_ALLOC(cols, fec_acc_t);
+    for (unsigned int i = 0; i < cols; i++)
+        enc->col[i].payload = ASC_ALLOC(size, uint8_t);
+
+    enc->row.payload = ASC_ALLOC(size, uint8_t);
+    enc->buffer = ASC_ALLOC(RTP_HEADER_SIZE + FEC_HEADER_SIZE + size
+                            , uint8_t);
+
+    enc->seq_col = (uint16_t)rand();
+    enc->seq_row = (uint16_t)rand();
+
+    return enc;
+}
+
+void rtp_fec_enc_destroy(rtp_fec_enc_t *enc)
+{
+    for (unsigned int i = 0; i < enc->cols; i++)
+        free(enc->col[i].payload);
+
+    free(enc->col);
+    free(enc->row.payload);
+    free(enc->buffer);
+    free(enc);
+}
+
+void rtp_fec_enc_set_on_column(rtp_fec_enc_t *enc, rtp_callback_t on_column)
+{
+    enc->on_column = on_column;
+}
+
+void rtp_fec_enc_set_on_row(rtp_fec_enc_t *enc, rtp_callback_t on_row)
+{
+    enc->on_row = on_row;
+}
+
+void rtp_fec_enc_set_arg(rtp_fec_enc_t *enc, void *arg)
+{
+    enc->arg = arg;
+}
+
+static void acc_add(fec_acc_t *acc, const uint8_t *data, size_t off
+                    , size_t len)
+{
+    const size_t plen = len - off;
+
+    /* bytes past the previous maximum are still zero */
+    for (size_t i = 0; i < plen; i++)
+        acc->payload[i] ^= data[off + i];
+
+    if (plen > acc->max)
+        acc->max = plen;
+
+    acc->length ^= plen;
+    acc->pt ^= RTP_GET_PT(data);
+    acc->ts ^= RTP_GET_TS(data);
+}
+
+static void acc_emit(rtp_fec_enc_t *enc, fec_acc_t *acc, bool is_row
+                     , uint16_t base)
+{
+    uint8_t *const buf = enc->buffer;
+    uint8_t *const hdr = &buf[RTP_HEADER_SIZE];
+    const uint16_t seq = (is_row) ? enc->seq_row++ : enc->seq_col++;
+
+    /* RTP header */
+    memset(buf, 0, RTP_HEADER_SIZE + FEC_HEADER_SIZE);
+    buf[0] = 0x80;
+    buf[1] = FEC_PT;
+    buf[2] = (seq >> 8) & 0xFF;
+    buf[3] = (seq     ) & 0xFF;
+
+    /* FEC header */
+    hdr[0] = (base >> 8) & 0xFF;
+    hdr[1] = (base     ) & 0xFF;
+    hdr[2] = (acc->length >> 8) & 0xFF;
+    hdr[3] = (acc->length     ) & 0xFF;
+    hdr[4] = 0x80 | (acc->pt & 0x7F);
+    hdr[8] = (acc->ts >> 24) & 0xFF;
+    hdr[9] = (acc->ts >> 16) & 0xFF;
+    hdr[10] = (acc->ts >> 8) & 0xFF;
+    hdr[11] = (acc->ts     ) & 0xFF;
+
+    if (is_row)
+    {
+        hdr[12] = 0x40;
+        hdr[13] = 1;
+        hdr[14] = enc->cols;
+    }
+    else
+    {
+        hdr[13] = enc->cols;
+        hdr[14] = enc->rows;
+    }
+
+    memcpy(&hdr[FEC_HEADER_SIZE], acc->payload, acc->max);
+
+    const size_t len = RTP_HEADER_SIZE + FEC_HEADER_SIZE + acc->max;
+    const rtp_callback_t cb = (is_row) ? enc->on_row : enc->on_column;
+
+    if (cb != NULL)
+        cb(enc->arg, buf, len);
+
+    /* reset accumulator */
+    memset(acc->payload, 0, acc->max);
+    acc->max = 0;
+    acc->length = 0;
+    acc->pt = 0;
+    acc->ts = 0;
+}
+
+void rtp_fec_enc_push(rtp_fec_enc_t *enc, const uint8_t *data, size_t len)
+{
+    const size_t off = rtp_payload_offset(data, len);
+    if (off == 0 || len - off > enc->size)
+        return;
+
+    const uint16_t seq = RTP_GET_SEQ(data);
+    if (enc->pos == 0)
+        enc->base = seq;
+
+    const unsigned int col = enc->pos % enc->cols;
+    const unsigned int row = enc->pos / enc->cols;
+
+    acc_add(&enc->col[col], data, off, len);
+    if (enc->row_fec)
+    {
+        acc_add(&enc->row, data, off, len);
+        if (col == enc->cols - 1)
+            acc_emit(enc, &enc->row, true, seq - col);
+    }
+
+    if (row == enc->rows - 1)
+        acc_emit(enc, &enc->col[col], false, enc->base + col);
+
+    if (++enc->pos >= enc->cols * enc->rows)
+        enc->pos = 0;
+}
+
+bool rtp_fec_parse_opts(const char *opts, unsigned int *cols
+                        , unsigned int *rows)
+{
+    char *end = NULL;
+
+    const long l = strtol(opts, &end, 10);
+    if (end == opts || *end != ',')
+        return false;
+
+    const char *const d_str = end + 1;
+    const long d = strtol(d_str, &end, 10);
+    if (end == d_str || *end != '\0')
+        return false;
+
+    if (l < FEC_MIN_L || l > FEC_MAX_L || d < FEC_MIN_D || d > FEC_MAX_D
+        || l * d > FEC_MAX_LD)
+    {
+        return false;
+    }
+
+    *cols = l;
+    *rows = d;
+
+    return true;
+}
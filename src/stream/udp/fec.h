@@ -0,0 +1,128 @@
+/*
+ * Astra Module: UDP (SMPTE 2022-1 FEC)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UDP_FEC_H_
+#define _UDP_FEC_H_ 1
+
+#ifndef _ASTRA_H_
+#   error "Please include <astra.h> first"
+#endif /* !_ASTRA_H_ */
+
+#include "rtp.h"
+
+/*
+ * FEC header, follows the RTP header of every FEC datagram:
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |      SNBase low bits          |        Length recovery        |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |E| PT recovery |                    Mask                       |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                          TS recovery                          |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |X|D|type |index|    Offset     |       NA      |SNBase ext bits|
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * Column FEC (D = 0) is sent to media port + 2, row FEC (D = 1)
+ * to media port + 4.
+ */
+#define FEC_HEADER_SIZE 16
+#define FEC_PT 96
+
+#define FEC_PORT_COLUMN 2
+#define FEC_PORT_ROW 4
+
+/* matrix size limits */
+#define FEC_MIN_L 1
+#define FEC_MAX_L 20
+#define FEC_MIN_D 4
+#define FEC_MAX_D 20
+#define FEC_MAX_LD 100
+
+#define FEC_GET_SNBASE(_fec) ((uint16_t)((_fec[0] << 8) | _fec[1]))
+#define FEC_GET_LENGTH(_fec) ((uint16_t)((_fec[2] << 8) | _fec[3]))
+#define FEC_GET_PT(_fec) ((_fec[4] & 0x7F))
+#define FEC_GET_TS(_fec) \
+    ((uint32_t)((_fec[8] << 24) | (_fec[9] << 16) | (_fec[10] << 8) | _fec[11]))
+#define FEC_IS_ROW(_fec) ((_fec[12] & 0x40))
+#define FEC_GET_OFFSET(_fec) ((_fec[13]))
+#define FEC_GET_NA(_fec) ((_fec[14]))
+
+/*
+ * FEC decoder
+ *
+ * Keeps a short history of media datagrams and the FEC datagrams
+ * that can't be applied yet. Whenever a row or column ends up missing
+ * exactly one media datagram, that datagram is rebuilt and passed
+ * to the callback as if it were received from the network.
+ */
+typedef struct rtp_fec_dec_t rtp_fec_dec_t;
+
+typedef struct
+{
+    uint64_t received;      /* FEC datagrams */
+    uint64_t recovered;     /* rebuilt media datagrams */
+    uint64_t unrecoverable; /* FEC datagrams dropped with 2+ losses */
+} rtp_fec_dec_stat_t;
+
+rtp_fec_dec_t *rtp_fec_dec_init(size_t size) __wur;
+void rtp_fec_dec_destroy(rtp_fec_dec_t *dec);
+
+void rtp_fec_dec_set_on_packet(rtp_fec_dec_t *dec, rtp_callback_t on_packet);
+void rtp_fec_dec_set_arg(rtp_fec_dec_t *dec, void *arg);
+
+void rtp_fec_dec_media(rtp_fec_dec_t *dec, const uint8_t *data, size_t len);
+void rtp_fec_dec_push(rtp_fec_dec_t *dec, const uint8_t *data, size_t len);
+
+void rtp_fec_dec_query(const rtp_fec_dec_t *dec, rtp_fec_dec_stat_t *out);
+
+/*
+ * FEC encoder
+ *
+ * Media datagrams are XORed into the row and column accumulators as
+ * they are sent. A row FEC datagram goes out as soon as its row is
+ * complete, and each column FEC datagram follows the last datagram
+ * of that column, so no media is ever held back.
+ */
+typedef struct rtp_fec_enc_t rtp_fec_enc_t;
+
+rtp_fec_enc_t *rtp_fec_enc_init(unsigned int cols, unsigned int rows
+                                , bool row_fec, size_t size) __wur;
+void rtp_fec_enc_destroy(rtp_fec_enc_t *enc);
+
+void rtp_fec_enc_set_on_column(rtp_fec_enc_t *enc, rtp_callback_t on_column);
+void rtp_fec_enc_set_on_row(rtp_fec_enc_t *enc, rtp_callback_t on_row);
+void rtp_fec_enc_set_arg(rtp_fec_enc_t *enc, void *arg);
+
+void rtp_fec_enc_push(rtp_fec_enc_t *enc, const uint8_t *data, size_t len);
+
+/*
+ * Option string format:
+ *    L,D
+ *
+ * L is the number of columns (1 to 20), D is the number of rows
+ * (4 to 20), and L * D must not exceed 100.
+ */
+bool rtp_fec_parse_opts(const char *opts, unsigned int *cols
+                        , unsigned int *rows);
+
+#endif /* _UDP_FEC_H_ */
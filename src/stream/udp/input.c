@@ -29,9 +29,20 @@
  *      socket_size - number, socket buffer size
  *      renew       - number, renewing multicast subscription interval in seconds
  *      rtp         - boolean, use RTP instead of RAW UDP
+ *      packets     - number, maximum TS packets per RTP datagram, default 7
+ *      reorder     - number, initial RTP reorder buffer depth in datagrams;
+ *                    the buffer grows as needed to cover `latency'
+ *      latency     - number, maximum time in ms to wait for a missing datagram
+ *      fec         - boolean, receive SMPTE 2022-1 FEC on ports +2 and +4
+ *      rist        - boolean, RIST Simple Profile: request missing datagrams
+ *                    with RTCP NACKs on port + 1
+ *      rist_retries - number, requests per missing datagram, default 7
+ *
+ * Null packets removed by udp_output (strip_null) are put back in place.
  *
  * Module Methods:
  *      port()      - return number, random port number
+ *      stat()      - return table, RTP sequence, FEC, RIST and MDI counters
  */
 
 #include <astra.h>
@@ -39,12 +50,34 @@
 #include <core/timer.h>
 #include <luaapi/stream.h>
 
-#define UDP_BUFFER_SIZE 1460
-#define RTP_HEADER_SIZE 12
+#include "udp.h"
+#include "rtp.h"
+#include "fec.h"
+#include "mdi.h"
+#include "rist.h"
+
+#define UDP_BUFFER_SIZE UDP_DATAGRAM_SIZE(UDP_MAX_PACKETS)
+
+/* kernel arrival timestamps and socket queue drop counter */
+#if defined(SO_RXQ_OVFL) && defined(SO_TIMESTAMPNS)
+#   define UDP_KERNEL_STAT 1
+#endif
+
+/* default reorder latency, ms */
+#define RTP_REORDER_LATENCY 50
+
+/* FEC needs to hold back datagrams for up to two matrices;
+ * reorder depths are powers of two */
+#define RTP_FEC_REORDER 256
+#define RTP_FEC_LATENCY 250
+
+/* RIST retransmissions need a full round trip or more */
+#define RTP_RIST_REORDER 1024
+#define RTP_RIST_LATENCY 1000
+#define RTP_RIST_RETRIES 7
 
-#define RTP_IS_EXT(_data) ((_data[0] & 0x10))
-#define RTP_EXT_SIZE(_data) \
-    (((_data[RTP_HEADER_SIZE + 2] << 8) | _data[RTP_HEADER_SIZE + 3]) * 4 + 4)
+/* how often due NACKs are sent, ms */
+#define RTP_RIST_INTERVAL 10
 
 #define MSG(_msg) "[udp_input %s:%d] " _msg, mod->config.addr, mod->config.port
 
@@ -58,6 +91,11 @@ struct module_data_t
         int port;
         const char *localaddr;
         bool rtp;
+        int packets;
+        int reorder;
+        int latency;
+        bool fec;
+        bool rist;
     } config;
 
     bool is_error_message;
@@ -65,9 +103,33 @@ struct module_data_t
     asc_socket_t *sock;
     asc_timer_t *timer_renew;
 
+    rtp_reorder_t *reorder;
+    asc_timer_t *timer_reorder;
+
+    rtp_fec_dec_t *fec;
+    asc_socket_t *sock_fec_col;
+    asc_socket_t *sock_fec_row;
+
+    rist_receiver_t *rist;
+    asc_socket_t *sock_rtcp;
+    asc_timer_t *timer_rtcp;
+    bool is_rtcp_peer;
+
+    udp_mdi_t *mdi;
+
     uint8_t buffer[UDP_BUFFER_SIZE];
 };
 
+static void aux_close(asc_socket_t **sock)
+{
+    if(*sock)
+    {
+        asc_socket_multicast_leave(*sock);
+        asc_socket_close(*sock);
+        *sock = NULL;
+    }
+}
+
 static void on_close(void *arg)
 {
     module_data_t *const mod = (module_data_t *)arg;
@@ -84,14 +146,145 @@ static void on_close(void *arg)
         asc_timer_destroy(mod->timer_renew);
         mod->timer_renew = NULL;
     }
+
+    aux_close(&mod->sock_fec_col);
+    aux_close(&mod->sock_fec_row);
+    ASC_FREE(mod->fec, rtp_fec_dec_destroy);
+
+    ASC_FREE(mod->timer_rtcp, asc_timer_destroy);
+    aux_close(&mod->sock_rtcp);
+    ASC_FREE(mod->rist, rist_receiver_destroy);
+
+    ASC_FREE(mod->timer_reorder, asc_timer_destroy);
+    ASC_FREE(mod->reorder, rtp_reorder_destroy);
+
+    ASC_FREE(mod->mdi, udp_mdi_destroy);
+}
+
+static void on_rtp(void *arg, const uint8_t *data, size_t len)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    size_t i = rtp_payload_offset(data, len);
+    if(i == 0)
+        return;
+
+    unsigned int count;
+    uint8_t npd;
+    if(rtp_npd_get(data, len, &count, &npd))
+    {
+        /* put back the null packets removed by the sender */
+        for(unsigned int n = 0; n < count; n++)
+        {
+            if(npd & (0x40 >> n))
+            {
+                module_stream_send(mod, null_ts);
+            }
+            else if(i + TS_PACKET_SIZE <= len)
+            {
+                module_stream_send(mod, &data[i]);
+                i += TS_PACKET_SIZE;
+            }
+        }
+    }
+
+    for(; i + TS_PACKET_SIZE <= len; i += TS_PACKET_SIZE)
+        module_stream_send(mod, &data[i]);
+
+    if(i != len && !mod->is_error_message)
+    {
+        asc_log_error(MSG("wrong stream format. drop %zu bytes"), len - i);
+        mod->is_error_message = true;
+    }
+}
+
+#ifdef UDP_KERNEL_STAT
+static void kernel_stat_enable(module_data_t *mod)
+{
+    const int fd = asc_socket_fd(mod->sock);
+    const int on = 1;
+
+    if(setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) != 0)
+        asc_log_warning(MSG("failed to set SO_RXQ_OVFL: %s"), asc_error_msg());
+
+    if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0)
+        asc_log_warning(MSG("failed to set SO_TIMESTAMPNS: %s"), asc_error_msg());
 }
 
+static uint64_t realtime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000ULL);
+}
+
+static ssize_t input_recv(module_data_t *mod, uint64_t *time)
+{
+    uint8_t control[CMSG_SPACE(sizeof(struct timespec))
+                    + CMSG_SPACE(sizeof(uint32_t))];
+
+    struct iovec iov;
+    iov.iov_base = mod->buffer;
+    iov.iov_len = UDP_BUFFER_SIZE;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    const ssize_t ret = recvmsg(asc_socket_fd(mod->sock), &msg, 0);
+    if(ret <= 0)
+        return ret;
+
+    bool has_time = false;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    for(; cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if(cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+
+        if(cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+
+            *time = (ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000ULL);
+            has_time = true;
+        }
+        else if(cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+
+            udp_mdi_set_drops(mod->mdi, drops);
+        }
+    }
+
+    /* kernel timestamps are wall clock time */
+    if(!has_time)
+        *time = realtime();
+
+    return ret;
+}
+#else
+static ssize_t input_recv(module_data_t *mod, uint64_t *time)
+{
+    *time = asc_utime();
+    return asc_socket_recv(mod->sock, mod->buffer, UDP_BUFFER_SIZE);
+}
+#endif /* UDP_KERNEL_STAT */
+
 static void on_read(void *arg)
 {
     module_data_t *const mod = (module_data_t *)arg;
 
     /* TODO: read until it fails with EAGAIN */
-    const ssize_t ret = asc_socket_recv(mod->sock, mod->buffer, UDP_BUFFER_SIZE);
+    uint64_t time = 0;
+    const ssize_t ret = input_recv(mod, &time);
     if(ret <= 0)
     {
         if(ret == 0 || asc_socket_would_block())
@@ -104,20 +297,29 @@ static void on_read(void *arg)
     }
 
     const size_t len = ret;
-    size_t i = 0;
+    udp_mdi_push(mod->mdi, time, mod->buffer, len, mod->config.rtp);
 
-    if(mod->config.rtp)
+    if(mod->reorder)
     {
-        i = RTP_HEADER_SIZE;
-        if(RTP_IS_EXT(mod->buffer))
+        if(len > UDP_DATAGRAM_SIZE(mod->config.packets)
+           && !mod->is_error_message)
         {
-            if(len < RTP_HEADER_SIZE + 4)
-                return;
-
-            i += RTP_EXT_SIZE(mod->buffer);
+            asc_log_error(MSG("datagram is too large (%zu bytes), "
+                              "check option 'packets'"), len);
+            mod->is_error_message = true;
         }
+
+        if(mod->rist)
+            rist_receiver_media(mod->rist, mod->buffer, len);
+
+        rtp_reorder_push(mod->reorder, mod->buffer, len);
+        if(mod->fec)
+            rtp_fec_dec_media(mod->fec, mod->buffer, len);
+
+        return;
     }
 
+    size_t i = 0;
     for(; i + TS_PACKET_SIZE <= len; i += TS_PACKET_SIZE)
         module_stream_send(mod, &mod->buffer[i]);
 
@@ -128,10 +330,128 @@ static void on_read(void *arg)
     }
 }
 
+static void on_fec_packet(void *arg, const uint8_t *data, size_t len)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    if(mod->rist)
+        rist_receiver_media(mod->rist, data, len);
+
+    rtp_reorder_push(mod->reorder, data, len);
+}
+
+static void fec_read(module_data_t *mod, asc_socket_t **sock)
+{
+    const ssize_t ret = asc_socket_recv(*sock, mod->buffer, UDP_BUFFER_SIZE);
+    if(ret <= 0)
+    {
+        if(ret == 0 || asc_socket_would_block())
+            return;
+
+        asc_log_error(MSG("recv() on FEC port %d: %s")
+                      , asc_socket_port(*sock), asc_error_msg());
+        aux_close(sock);
+
+        return;
+    }
+
+    rtp_fec_dec_push(mod->fec, mod->buffer, ret);
+}
+
+static void on_read_fec_col(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+    fec_read(mod, &mod->sock_fec_col);
+}
+
+static void on_read_fec_row(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+    fec_read(mod, &mod->sock_fec_row);
+}
+
+static asc_socket_t *aux_open(module_data_t *mod, int offset
+                              , event_callback_t on_read_aux)
+{
+    const int port = mod->config.port + offset;
+
+    asc_socket_t *const sock = asc_socket_open_udp4(mod);
+    asc_socket_set_reuseaddr(sock, 1);
+#if defined(_WIN32) || defined(__CYGWIN__)
+    if(!asc_socket_bind(sock, NULL, port))
+#else
+    if(!asc_socket_bind(sock, mod->config.addr, port))
+#endif
+    {
+        asc_socket_close(sock);
+        return NULL;
+    }
+
+    asc_socket_set_on_read(sock, on_read_aux);
+    asc_socket_multicast_join(sock, mod->config.addr, mod->config.localaddr);
+
+    return sock;
+}
+
+static void on_read_rtcp(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    /* replies go back to the address of the last sender report */
+    const ssize_t ret = asc_socket_recvfrom(mod->sock_rtcp, mod->buffer
+                                            , UDP_BUFFER_SIZE);
+    if(ret <= 0)
+    {
+        if(ret == 0 || asc_socket_would_block())
+            return;
+
+        asc_log_error(MSG("recv() on RTCP port %d: %s")
+                      , asc_socket_port(mod->sock_rtcp), asc_error_msg());
+        aux_close(&mod->sock_rtcp);
+
+        return;
+    }
+
+    mod->is_rtcp_peer = true;
+    rist_receiver_rtcp(mod->rist, mod->buffer, ret);
+}
+
+static void timer_rtcp_callback(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    if(!mod->is_rtcp_peer || !mod->sock_rtcp)
+        return;
+
+    uint8_t buffer[RIST_RTCP_SIZE];
+    const size_t len = rist_receiver_report(mod->rist, buffer, sizeof(buffer));
+
+    if(len > 0 && asc_socket_sendto(mod->sock_rtcp, buffer, len) == -1
+       && !asc_socket_would_block())
+    {
+        asc_log_warning(MSG("sendto() RTCP: %s"), asc_error_msg());
+    }
+}
+
 static void timer_renew_callback(void *arg)
 {
     module_data_t *const mod = (module_data_t *)arg;
     asc_socket_multicast_renew(mod->sock);
+
+    if(mod->sock_fec_col)
+        asc_socket_multicast_renew(mod->sock_fec_col);
+
+    if(mod->sock_fec_row)
+        asc_socket_multicast_renew(mod->sock_fec_row);
+
+    if(mod->sock_rtcp)
+        asc_socket_multicast_renew(mod->sock_rtcp);
+}
+
+static void timer_reorder_callback(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+    rtp_reorder_flush(mod->reorder, false);
 }
 
 static int method_port(lua_State *L, module_data_t *mod)
@@ -142,6 +462,89 @@ static int method_port(lua_State *L, module_data_t *mod)
     return 1;
 }
 
+static int method_stat(lua_State *L, module_data_t *mod)
+{
+    lua_newtable(L);
+
+    if(mod->reorder)
+    {
+        rtp_reorder_stat_t st;
+        rtp_reorder_query(mod->reorder, &st);
+
+        lua_newtable(L);
+        lua_pushnumber(L, st.received);
+        lua_setfield(L, -2, "received");
+        lua_pushnumber(L, st.lost);
+        lua_setfield(L, -2, "lost");
+        lua_pushnumber(L, st.reordered);
+        lua_setfield(L, -2, "reordered");
+        lua_pushnumber(L, st.duplicate);
+        lua_setfield(L, -2, "duplicate");
+        lua_pushnumber(L, st.late);
+        lua_setfield(L, -2, "late");
+        lua_pushnumber(L, st.resync);
+        lua_setfield(L, -2, "resync");
+        lua_pushinteger(L, rtp_reorder_depth(mod->reorder));
+        lua_setfield(L, -2, "depth");
+        lua_setfield(L, -2, "rtp");
+    }
+
+    if(mod->fec)
+    {
+        rtp_fec_dec_stat_t st;
+        rtp_fec_dec_query(mod->fec, &st);
+
+        lua_newtable(L);
+        lua_pushnumber(L, st.received);
+        lua_setfield(L, -2, "received");
+        lua_pushnumber(L, st.recovered);
+        lua_setfield(L, -2, "recovered");
+        lua_pushnumber(L, st.unrecoverable);
+        lua_setfield(L, -2, "unrecoverable");
+        lua_setfield(L, -2, "fec");
+    }
+
+    if(mod->rist)
+    {
+        rist_receiver_stat_t st;
+        rist_receiver_query(mod->rist, &st);
+
+        lua_newtable(L);
+        lua_pushnumber(L, st.requested);
+        lua_setfield(L, -2, "requested");
+        lua_pushnumber(L, st.recovered);
+        lua_setfield(L, -2, "recovered");
+        lua_pushnumber(L, st.lost);
+        lua_setfield(L, -2, "lost");
+        lua_pushnumber(L, st.reports);
+        lua_setfield(L, -2, "reports");
+        lua_setfield(L, -2, "rist");
+    }
+
+    if(mod->mdi)
+    {
+        udp_mdi_stat_t st;
+        udp_mdi_query(mod->mdi, &st);
+
+        lua_newtable(L);
+        lua_pushnumber(L, st.df);
+        lua_setfield(L, -2, "df");
+        lua_pushnumber(L, st.mlr);
+        lua_setfield(L, -2, "mlr");
+        lua_pushnumber(L, st.jitter);
+        lua_setfield(L, -2, "jitter");
+        lua_pushinteger(L, st.bitrate);
+        lua_setfield(L, -2, "bitrate");
+        lua_pushnumber(L, st.lost);
+        lua_setfield(L, -2, "lost");
+        lua_pushnumber(L, st.drops);
+        lua_setfield(L, -2, "drops");
+        lua_setfield(L, -2, "mdi");
+    }
+
+    return 1;
+}
+
 static void module_init(lua_State *L, module_data_t *mod)
 {
     module_stream_init(mod, NULL);
@@ -165,7 +568,82 @@ static void module_init(lua_State *L, module_data_t *mod)
     if(module_option_integer(L, "socket_size", &value))
         asc_socket_set_buffer(mod->sock, value, 0);
 
+    mod->mdi = udp_mdi_init();
+#ifdef UDP_KERNEL_STAT
+    kernel_stat_enable(mod);
+#endif
+
     module_option_boolean(L, "rtp", &mod->config.rtp);
+    if(mod->config.rtp)
+    {
+        mod->config.packets = UDP_PACKETS;
+        module_option_integer(L, "packets", &mod->config.packets);
+        if(mod->config.packets < 1 || mod->config.packets > UDP_MAX_PACKETS)
+            luaL_error(L, MSG("option 'packets' is out of range"));
+
+        module_option_boolean(L, "fec", &mod->config.fec);
+        module_option_boolean(L, "rist", &mod->config.rist);
+        if(mod->config.rist)
+        {
+            mod->config.reorder = RTP_RIST_REORDER;
+            mod->config.latency = RTP_RIST_LATENCY;
+        }
+        else if(mod->config.fec)
+        {
+            mod->config.reorder = RTP_FEC_REORDER;
+            mod->config.latency = RTP_FEC_LATENCY;
+        }
+        else
+        {
+            mod->config.latency = RTP_REORDER_LATENCY;
+        }
+
+        module_option_integer(L, "reorder", &mod->config.reorder);
+        if(mod->config.reorder < 0
+           || mod->config.reorder > RTP_REORDER_MAX_DEPTH)
+        {
+            luaL_error(L, MSG("option 'reorder' is out of range"));
+        }
+
+        module_option_integer(L, "latency", &mod->config.latency);
+        if(mod->config.latency < 0)
+            luaL_error(L, MSG("option 'latency' is out of range"));
+
+        mod->reorder = rtp_reorder_init(mod->config.reorder
+                                        , mod->config.latency
+                                        , UDP_DATAGRAM_SIZE(mod->config.packets));
+        rtp_reorder_set_on_packet(mod->reorder, on_rtp);
+        rtp_reorder_set_arg(mod->reorder, mod);
+
+        if(mod->config.reorder > 0 && mod->config.latency > 0)
+        {
+            rtp_reorder_set_max_depth(mod->reorder, RTP_REORDER_MAX_DEPTH);
+
+            const unsigned int ms = (mod->config.latency + 1) / 2;
+            mod->timer_reorder = asc_timer_init(ms, timer_reorder_callback
+                                                , mod);
+        }
+
+        if(mod->config.rist)
+        {
+            if(mod->config.reorder == 0 || mod->config.latency == 0)
+                luaL_error(L, MSG("option 'rist' requires the reorder buffer"));
+
+            int retries = RTP_RIST_RETRIES;
+            module_option_integer(L, "rist_retries", &retries);
+            if(retries < 0 || retries > 100)
+                luaL_error(L, MSG("option 'rist_retries' is out of range"));
+
+            mod->rist = rist_receiver_init(retries, mod->config.latency);
+        }
+    }
+    else
+    {
+        bool rist_on = false;
+        module_option_boolean(L, "rist", &rist_on);
+        if(rist_on)
+            luaL_error(L, MSG("option 'rist' requires RTP"));
+    }
 
     asc_socket_set_on_read(mod->sock, on_read);
     asc_socket_set_on_close(mod->sock, on_close);
@@ -173,6 +651,34 @@ static void module_init(lua_State *L, module_data_t *mod)
     module_option_string(L, "localaddr", &mod->config.localaddr, NULL);
     asc_socket_multicast_join(mod->sock, mod->config.addr, mod->config.localaddr);
 
+    if(mod->config.fec)
+    {
+        mod->fec = rtp_fec_dec_init(UDP_DATAGRAM_SIZE(mod->config.packets));
+        rtp_fec_dec_set_on_packet(mod->fec, on_fec_packet);
+        rtp_fec_dec_set_arg(mod->fec, mod);
+
+        mod->sock_fec_col = aux_open(mod, FEC_PORT_COLUMN, on_read_fec_col);
+        if(mod->sock_fec_col == NULL)
+            asc_log_error(MSG("failed to bind FEC column port %d")
+                          , mod->config.port + FEC_PORT_COLUMN);
+
+        mod->sock_fec_row = aux_open(mod, FEC_PORT_ROW, on_read_fec_row);
+        if(mod->sock_fec_row == NULL)
+            asc_log_error(MSG("failed to bind FEC row port %d")
+                          , mod->config.port + FEC_PORT_ROW);
+    }
+
+    if(mod->rist)
+    {
+        mod->sock_rtcp = aux_open(mod, RIST_PORT_RTCP, on_read_rtcp);
+        if(mod->sock_rtcp == NULL)
+            asc_log_error(MSG("failed to bind RTCP port %d")
+                          , mod->config.port + RIST_PORT_RTCP);
+
+        mod->timer_rtcp = asc_timer_init(RTP_RIST_INTERVAL
+                                         , timer_rtcp_callback, mod);
+    }
+
     if(module_option_integer(L, "renew", &value))
         mod->timer_renew = asc_timer_init(value * 1000, timer_renew_callback, mod);
 }
@@ -188,5 +694,6 @@ MODULE_LUA_METHODS()
 {
     MODULE_STREAM_METHODS_REF(),
     { "port", method_port },
+    { "stat", method_stat },
 };
 MODULE_LUA_REGISTER(udp_input)
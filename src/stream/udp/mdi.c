@@ -0,0 +1,200 @@
+/*
+ * Astra Module: UDP (Media Delivery Index)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <astra.h>
+#include "rtp.h"
+#include "mdi.h"
+
+/* RTP clock for MPEG-TS, Hz */
+#define MDI_RTP_CLOCK 90000
+
+#define MDI_CC_UNKNOWN 0xFF
+
+struct udp_mdi_t
+{
+    /* current interval */
+    uint64_t start;
+    uint64_t bytes;
+    uint64_t lost;
+    double vb_min;
+    double vb_max;
+
+    /* drain rate, bytes per us */
+    double rate;
+
+    /* inter-arrival jitter */
+    bool started;
+    uint64_t last_time;
+    uint32_t last_rtp_ts;
+    double mean_iat;
+    double jitter;
+
+    udp_mdi_stat_t stat;
+
+    uint8_t cc[MAX_PID];
+};
+
+udp_mdi_t *udp_mdi_init(void)
+{
+    udp_mdi_t *const mdi = ASC_ALLOC(1, udp_mdi_t);
+    memset(mdi->cc, MDI_CC_UNKNOWN, sizeof(mdi->cc));
+
+    return mdi;
+}
+
+void udp_mdi_destroy(udp_mdi_t *mdi)
+{
+    free(mdi);
+}
+
+void udp_mdi_query(const udp_mdi_t *mdi, udp_mdi_stat_t *out)
+{
+    memcpy(out, &mdi->stat, sizeof(*out));
+    out->jitter = mdi->jitter / 1000.0;
+}
+
+void udp_mdi_set_drops(udp_mdi_t *mdi, uint32_t drops)
+{
+    /* the kernel counter is cumulative for the socket */
+    mdi->stat.drops = drops;
+}
+
+static void interval_close(udp_mdi_t *mdi, uint64_t time)
+{
+    const uint64_t duration = time - mdi->start;
+
+    if (mdi->rate > 0)
+        mdi->stat.df = (mdi->vb_max - mdi->vb_min) / mdi->rate / 1000.0;
+
+    mdi->stat.mlr = mdi->lost * 1000000.0 / duration;
+    mdi->stat.bitrate = mdi->bytes * 8 * 1000 / duration;
+
+    mdi->rate = (double)mdi->bytes / duration;
+
+    mdi->start = time;
+    mdi->bytes = 0;
+    mdi->lost = 0;
+    mdi->vb_min = 0;
+    mdi->vb_max = 0;
+}
+
+static void check_cc(udp_mdi_t *mdi, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+    if (pid == NULL_TS_PID)
+        return;
+
+    /* discontinuity indicator */
+    if (TS_IS_AF(ts) && ts[4] > 0 && (ts[5] & 0x80))
+    {
+        mdi->cc[pid] = TS_GET_CC(ts);
+        return;
+    }
+
+    if (!TS_IS_PAYLOAD(ts))
+        return;
+
+    const uint8_t cc = TS_GET_CC(ts);
+    const uint8_t last = mdi->cc[pid];
+    mdi->cc[pid] = cc;
+
+    if (last == MDI_CC_UNKNOWN || cc == last)
+        return;
+
+    const unsigned int gap = (cc - last - 1) & 0x0F;
+    mdi->lost += gap;
+    mdi->stat.lost += gap;
+}
+
+static void update_jitter(udp_mdi_t *mdi, uint64_t time
+                          , const uint8_t *data, bool is_rtp)
+{
+    const uint32_t rtp_ts = (is_rtp) ? RTP_GET_TS(data) : 0;
+
+    if (!mdi->started)
+    {
+        mdi->started = true;
+        mdi->last_time = time;
+        mdi->last_rtp_ts = rtp_ts;
+        return;
+    }
+
+    const double iat = (double)(int64_t)(time - mdi->last_time);
+    double d;
+
+    if (is_rtp)
+    {
+        /* RFC 3550, transit time difference */
+        const int32_t ts_delta = (int32_t)(rtp_ts - mdi->last_rtp_ts);
+        d = iat - ts_delta * (1000000.0 / MDI_RTP_CLOCK);
+    }
+    else
+    {
+        /* no media clock; deviation from the mean inter-arrival time */
+        mdi->mean_iat += (iat - mdi->mean_iat) / 16.0;
+        d = iat - mdi->mean_iat;
+    }
+
+    if (d < 0)
+        d = -d;
+
+    mdi->jitter += (d - mdi->jitter) / 16.0;
+
+    mdi->last_time = time;
+    mdi->last_rtp_ts = rtp_ts;
+}
+
+void udp_mdi_push(udp_mdi_t *mdi, uint64_t time
+                  , const uint8_t *data, size_t len, bool is_rtp)
+{
+    size_t skip = 0;
+
+    if (is_rtp)
+    {
+        skip = rtp_payload_offset(data, len);
+        if (skip == 0)
+            return;
+    }
+
+    if (mdi->start == 0 || time < mdi->start)
+        mdi->start = time;
+    else if (time - mdi->start >= MDI_INTERVAL)
+        interval_close(mdi, time);
+
+    update_jitter(mdi, time, data, is_rtp);
+
+    /* virtual buffer, before and after this datagram */
+    const size_t payload = len - skip;
+    const double vb = mdi->bytes - mdi->rate * (time - mdi->start);
+
+    if (vb < mdi->vb_min)
+        mdi->vb_min = vb;
+    if (vb + payload > mdi->vb_max)
+        mdi->vb_max = vb + payload;
+
+    mdi->bytes += payload;
+
+    for (size_t i = skip; i + TS_PACKET_SIZE <= len; i += TS_PACKET_SIZE)
+    {
+        if (TS_IS_SYNC((&data[i])))
+            check_cc(mdi, &data[i]);
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * Astra Module: UDP (Media Delivery Index)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _UDP_MDI_H_
+#define _UDP_MDI_H_ 1
+
+#ifndef _ASTRA_H_
+#   error "Please include <astra.h> first"
+#endif /* !_ASTRA_H_ */
+
+/* measurement interval, us */
+#define MDI_INTERVAL 1000000
+
+/*
+ * Media Delivery Index (RFC 4445)
+ *
+ * Datagrams are pushed with their arrival time. The delay factor is
+ * the spread of a virtual buffer that fills with every datagram and
+ * drains at the bitrate measured over the previous interval. The media
+ * loss rate counts TS packets missing from the continuity counters.
+ * Both are reported for the last complete interval.
+ */
+typedef struct udp_mdi_t udp_mdi_t;
+
+typedef struct
+{
+    double df;          /* delay factor, ms */
+    double mlr;         /* media loss rate, TS packets per second */
+    double jitter;      /* inter-arrival jitter, ms */
+    uint32_t bitrate;   /* Kbit/s */
+
+    uint64_t lost;      /* TS packets lost, total */
+    uint64_t drops;     /* datagrams dropped by the kernel, total */
+} udp_mdi_stat_t;
+
+udp_mdi_t *udp_mdi_init(void) __wur;
+void udp_mdi_destroy(udp_mdi_t *mdi);
+
+void udp_mdi_push(udp_mdi_t *mdi, uint64_t time
+                  , const uint8_t *data, size_t len, bool is_rtp);
+void udp_mdi_set_drops(udp_mdi_t *mdi, uint32_t drops);
+
+void udp_mdi_query(const udp_mdi_t *mdi, udp_mdi_stat_t *out);
+
+#endif /* _UDP_MDI_H_ */
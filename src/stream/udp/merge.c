@@ -0,0 +1,397 @@
+/*
+ * Astra Module: UDP (SMPTE 2022-7 merge)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      rtp_merge
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      paths       - list, RTP sources carrying the same stream,
+ *                    item format: { addr = "...", port = N, localaddr = "..." }
+ *      socket_size - number, socket buffer size
+ *      renew       - number, renewing multicast subscription interval in seconds
+ *      packets     - number, maximum TS packets per RTP datagram, default 7
+ *      reorder     - number, merge buffer depth in datagrams, rounded up to
+ *                    a power of two
+ *      latency     - number, maximum skew between paths in ms
+ *
+ * Module Methods:
+ *      stat()      - return table, merged and per-path counters
+ *
+ * Every datagram is taken from whichever path delivers it first; copies
+ * arriving from the other paths are discarded. A gap on one path is held
+ * in the merge buffer for up to `latency' milliseconds, which gives the
+ * other paths time to fill it.
+ */
+
+#include <astra.h>
+#include <core/socket.h>
+#include <core/timer.h>
+#include <luaapi/stream.h>
+
+#include "udp.h"
+#include "rtp.h"
+
+#define UDP_BUFFER_SIZE UDP_DATAGRAM_SIZE(UDP_MAX_PACKETS)
+
+#define MERGE_MAX_PATHS 8
+
+/* defaults */
+#define MERGE_REORDER 512
+#define MERGE_LATENCY 100
+
+/* first arrival times, used to measure path skew */
+#define MERGE_HISTORY 2048
+
+#define MSG(_msg) "[rtp_merge %s] " _msg, mod->config.name
+
+typedef struct
+{
+    module_data_t *mod;
+
+    const char *addr;
+    int port;
+    const char *localaddr;
+
+    asc_socket_t *sock;
+    rtp_reorder_t *seq;
+
+    uint64_t first;     /* datagrams this path delivered first */
+    uint64_t skew;      /* smoothed delay behind the first copy, us */
+    uint64_t skew_max;
+} merge_path_t;
+
+typedef struct
+{
+    uint64_t time;
+    uint16_t seq;
+    bool used;
+} merge_arrival_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    struct
+    {
+        const char *name;
+        int packets;
+        int reorder;
+        int latency;
+    } config;
+
+    bool is_error_message;
+
+    merge_path_t path[MERGE_MAX_PATHS];
+    unsigned int path_count;
+
+    rtp_reorder_t *merge;
+    asc_timer_t *timer_merge;
+    asc_timer_t *timer_renew;
+
+    merge_arrival_t arrival[MERGE_HISTORY];
+
+    uint8_t buffer[UDP_BUFFER_SIZE];
+};
+
+static void path_close(merge_path_t *path)
+{
+    if(path->sock)
+    {
+        asc_socket_multicast_leave(path->sock);
+        asc_socket_close(path->sock);
+        path->sock = NULL;
+    }
+}
+
+static void on_merge(void *arg, const uint8_t *data, size_t len)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    size_t i = rtp_payload_offset(data, len);
+    if(i == 0)
+        return;
+
+    for(; i + TS_PACKET_SIZE <= len; i += TS_PACKET_SIZE)
+        module_stream_send(mod, &data[i]);
+
+    if(i != len && !mod->is_error_message)
+    {
+        asc_log_error(MSG("wrong stream format. drop %zu bytes"), len - i);
+        mod->is_error_message = true;
+    }
+}
+
+static void on_path(void *arg, const uint8_t *data, size_t len)
+{
+    merge_path_t *const path = (merge_path_t *)arg;
+    module_data_t *const mod = path->mod;
+
+    const uint16_t seq = RTP_GET_SEQ(data);
+    const uint64_t now = asc_utime();
+
+    merge_arrival_t *const item = &mod->arrival[seq % MERGE_HISTORY];
+    if(item->used && item->seq == seq && now >= item->time)
+    {
+        const uint64_t skew = now - item->time;
+
+        path->skew = (path->skew * 15 + skew) / 16;
+        if(skew > path->skew_max)
+            path->skew_max = skew;
+    }
+    else
+    {
+        item->time = now;
+        item->seq = seq;
+        item->used = true;
+
+        path->first++;
+        path->skew = (path->skew * 15) / 16;
+    }
+
+    rtp_reorder_push(mod->merge, data, len);
+}
+
+static void on_read(void *arg)
+{
+    merge_path_t *const path = (merge_path_t *)arg;
+    module_data_t *const mod = path->mod;
+
+    const ssize_t ret = asc_socket_recv(path->sock, mod->buffer, UDP_BUFFER_SIZE);
+    if(ret <= 0)
+    {
+        if(ret == 0 || asc_socket_would_block())
+            return;
+
+        asc_log_error(MSG("recv() on %s:%d: %s")
+                      , path->addr, path->port, asc_error_msg());
+        path_close(path);
+
+        return;
+    }
+
+    const size_t len = ret;
+    if(len > UDP_DATAGRAM_SIZE(mod->config.packets) && !mod->is_error_message)
+    {
+        asc_log_error(MSG("datagram is too large (%zu bytes), "
+                          "check option 'packets'"), len);
+        mod->is_error_message = true;
+    }
+
+    rtp_reorder_push(path->seq, mod->buffer, len);
+}
+
+static void timer_merge_callback(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+    rtp_reorder_flush(mod->merge, false);
+}
+
+static void timer_renew_callback(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    for(unsigned int i = 0; i < mod->path_count; i++)
+    {
+        if(mod->path[i].sock)
+            asc_socket_multicast_renew(mod->path[i].sock);
+    }
+}
+
+static void push_reorder_stat(lua_State *L, const rtp_reorder_stat_t *st)
+{
+    lua_pushnumber(L, st->received);
+    lua_setfield(L, -2, "received");
+    lua_pushnumber(L, st->lost);
+    lua_setfield(L, -2, "lost");
+    lua_pushnumber(L, st->reordered);
+    lua_setfield(L, -2, "reordered");
+    lua_pushnumber(L, st->duplicate);
+    lua_setfield(L, -2, "duplicate");
+    lua_pushnumber(L, st->late);
+    lua_setfield(L, -2, "late");
+    lua_pushnumber(L, st->resync);
+    lua_setfield(L, -2, "resync");
+}
+
+static int method_stat(lua_State *L, module_data_t *mod)
+{
+    rtp_reorder_stat_t st;
+    rtp_reorder_query(mod->merge, &st);
+
+    lua_newtable(L);
+    push_reorder_stat(L, &st);
+
+    lua_newtable(L);
+    for(unsigned int i = 0; i < mod->path_count; i++)
+    {
+        const merge_path_t *const path = &mod->path[i];
+        rtp_reorder_query(path->seq, &st);
+
+        lua_newtable(L);
+        lua_pushstring(L, path->addr);
+        lua_setfield(L, -2, "addr");
+        lua_pushinteger(L, path->port);
+        lua_setfield(L, -2, "port");
+        lua_pushboolean(L, (path->sock != NULL));
+        lua_setfield(L, -2, "active");
+        push_reorder_stat(L, &st);
+        lua_pushnumber(L, path->first);
+        lua_setfield(L, -2, "first");
+        lua_pushnumber(L, path->skew / 1000.0);
+        lua_setfield(L, -2, "skew");
+        lua_pushnumber(L, path->skew_max / 1000.0);
+        lua_setfield(L, -2, "skew_max");
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "paths");
+
+    return 1;
+}
+
+static void path_open(lua_State *L, module_data_t *mod, merge_path_t *path
+                      , int socket_size)
+{
+    path->mod = mod;
+    path->seq = rtp_reorder_init(0, 0, UDP_DATAGRAM_SIZE(mod->config.packets));
+    rtp_reorder_set_on_packet(path->seq, on_path);
+    rtp_reorder_set_arg(path->seq, path);
+
+    path->sock = asc_socket_open_udp4(path);
+    asc_socket_set_reuseaddr(path->sock, 1);
+#if defined(_WIN32) || defined(__CYGWIN__)
+    if(!asc_socket_bind(path->sock, NULL, path->port))
+#else
+    if(!asc_socket_bind(path->sock, path->addr, path->port))
+#endif
+    {
+        asc_socket_close(path->sock);
+        path->sock = NULL;
+        luaL_error(L, MSG("failed to bind %s:%d"), path->addr, path->port);
+    }
+
+    if(socket_size > 0)
+        asc_socket_set_buffer(path->sock, socket_size, 0);
+
+    asc_socket_set_on_read(path->sock, on_read);
+    asc_socket_multicast_join(path->sock, path->addr, path->localaddr);
+}
+
+static void module_init(lua_State *L, module_data_t *mod)
+{
+    module_stream_init(mod, NULL);
+
+    module_option_string(L, "name", &mod->config.name, NULL);
+    if(mod->config.name == NULL)
+        luaL_error(L, "[rtp_merge] option 'name' is required");
+
+    mod->config.packets = UDP_PACKETS;
+    module_option_integer(L, "packets", &mod->config.packets);
+    if(mod->config.packets < 1 || mod->config.packets > UDP_MAX_PACKETS)
+        luaL_error(L, MSG("option 'packets' is out of range"));
+
+    mod->config.reorder = MERGE_REORDER;
+    module_option_integer(L, "reorder", &mod->config.reorder);
+    if(mod->config.reorder < 1
+       || mod->config.reorder > RTP_REORDER_MAX_DEPTH)
+    {
+        luaL_error(L, MSG("option 'reorder' is out of range"));
+    }
+
+    mod->config.latency = MERGE_LATENCY;
+    module_option_integer(L, "latency", &mod->config.latency);
+    if(mod->config.latency < 1)
+        luaL_error(L, MSG("option 'latency' is out of range"));
+
+    mod->merge = rtp_reorder_init(mod->config.reorder, mod->config.latency
+                                  , UDP_DATAGRAM_SIZE(mod->config.packets));
+    rtp_reorder_set_on_packet(mod->merge, on_merge);
+    rtp_reorder_set_arg(mod->merge, mod);
+
+    int socket_size = 0;
+    module_option_integer(L, "socket_size", &socket_size);
+
+    lua_getfield(L, MODULE_OPTIONS_IDX, "paths");
+    if(lua_istable(L, -1))
+    {
+        lua_foreach(L, -2)
+        {
+            if(lua_type(L, -1) != LUA_TTABLE)
+                luaL_error(L, MSG("option 'paths': wrong type"));
+
+            if(mod->path_count >= MERGE_MAX_PATHS)
+                luaL_error(L, MSG("option 'paths': too many paths"));
+
+            merge_path_t *const path = &mod->path[mod->path_count];
+
+            lua_getfield(L, -1, "addr");
+            path->addr = lua_tostring(L, -1);
+            lua_pop(L, 1);
+            if(path->addr == NULL)
+                luaL_error(L, MSG("option 'paths': 'addr' is required"));
+
+            lua_getfield(L, -1, "port");
+            path->port = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+
+            lua_getfield(L, -1, "localaddr");
+            path->localaddr = lua_tostring(L, -1);
+            lua_pop(L, 1);
+
+            mod->path_count++;
+            path_open(L, mod, path, socket_size);
+        }
+    }
+    lua_pop(L, 1); // paths
+
+    if(mod->path_count < 2)
+        luaL_error(L, MSG("option 'paths' requires at least two sources"));
+
+    const unsigned int ms = (mod->config.latency + 1) / 2;
+    mod->timer_merge = asc_timer_init(ms, timer_merge_callback, mod);
+
+    int value;
+    if(module_option_integer(L, "renew", &value))
+        mod->timer_renew = asc_timer_init(value * 1000, timer_renew_callback, mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    for(unsigned int i = 0; i < mod->path_count; i++)
+    {
+        path_close(&mod->path[i]);
+        ASC_FREE(mod->path[i].seq, rtp_reorder_destroy);
+    }
+
+    ASC_FREE(mod->timer_renew, asc_timer_destroy);
+    ASC_FREE(mod->timer_merge, asc_timer_destroy);
+    ASC_FREE(mod->merge, rtp_reorder_destroy);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(rtp_merge)
@@ -30,8 +30,28 @@
  *      localaddr   - string, IP address of the local interface
  *      socket_size - number, socket buffer size
  *      rtp         - boolean, use RTP instead of RAW UDP
+ *      packets     - number, TS packets per datagram (1 to 47), default 7
+ *      max_hold    - number, send a partial datagram after this many ms
+ *      strip_null  - boolean, remove null packets, mark their positions in
+ *                    an RTP header extension
  *      sync        - boolean, use MPEG-TS syncing
  *      sync_opts   - string, sync buffer options
+ *      fec         - string, SMPTE 2022-1 FEC matrix size, "L,D"
+ *      fec_1d      - boolean, send column FEC only
+ *      txtime      - boolean, schedule datagrams by PCR with SO_TXTIME
+ *      txtime_horizon - number, how far ahead to schedule datagrams, ms
+ *      txtime_clock - string, SO_TXTIME clock: "monotonic" (fq) or "tai" (etf)
+ *      destinations - list, send to many unicast destinations instead of
+ *                    addr:port, item format: { addr = "...", port = N }
+ *      rist        - boolean, RIST Simple Profile: answer NACKs on port + 1
+ *      rist_buffer - number, datagrams kept for retransmission, rounded up
+ *                    to a power of two. default 2048
+ *
+ * Module Methods:
+ *      add_destination(addr, port)     - add a fan-out destination
+ *      remove_destination(addr, port)  - remove a fan-out destination
+ *      destinations()  - return list of fan-out destinations
+ *      stat()      - return table, RIST counters
  */
 
 #include <astra.h>
@@ -40,10 +60,21 @@
 #include <luaapi/stream.h>
 #include <mpegts/sync.h>
 
+#include "udp.h"
+#include "rtp.h"
+#include "fec.h"
+#include "pacer.h"
+#include "fanout.h"
+#include "rist.h"
+
 #define MSG(_msg) "[udp_output %s:%d] " _msg, mod->addr, mod->port
 
-#define UDP_BUFFER_SIZE 1460
-#define RTP_PT_MP2T 33 /* RFC2250 */
+/* default departure time horizon, ms */
+#define UDP_TXTIME_HORIZON 100
+
+/* default RIST retransmission buffer, datagrams */
+#define UDP_RIST_BUFFER 2048
+#define UDP_RIST_MAX_BUFFER 32768
 
 struct module_data_t
 {
@@ -59,20 +90,48 @@ struct module_data_t
     bool can_send;
     size_t dropped;
 
+    unsigned int packets;
+    bool strip_null;
+    uint64_t max_hold;
+    asc_timer_t *timer_hold;
+
     struct
     {
         uint32_t skip;
-        uint8_t buffer[UDP_BUFFER_SIZE];
+        unsigned int count;
+        uint8_t npd;
+        uint64_t time;
+        uint8_t buffer[UDP_DATAGRAM_SIZE(UDP_MAX_PACKETS)];
     } packet;
 
     mpegts_sync_t *sync;
     asc_timer_t *sync_loop;
+
+    rtp_fec_enc_t *fec;
+    asc_socket_t *sock_fec_col;
+    asc_socket_t *sock_fec_row;
+
+    udp_pacer_t *pacer;
+    bool is_txtime;
+    int txtime_clock;
+    uint64_t txtime;
+    uint64_t pacing_rate;
+
+    udp_fanout_t *fanout;
+
+    rist_sender_t *rist;
+    asc_socket_t *sock_rtcp;
+    asc_timer_t *timer_rtcp;
 };
 
 static void on_ready(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
+    /* finish the datagram the full buffer interrupted */
+    if(mod->fanout && udp_fanout_resume(mod->fanout, mod->sock) == -1)
+        return;
+
     if(mod->dropped > 0)
     {
         asc_log_error(MSG("socket buffer full, dropped %zu packets"), mod->dropped);
@@ -94,9 +153,189 @@ static void on_sync_ts(module_data_t *mod, const uint8_t *ts)
     }
 }
 
-static void on_output_ts(module_data_t *mod, const uint8_t *ts)
+/* convert asc_utime() to nanoseconds on the SO_TXTIME clock */
+static uint64_t txtime_ns(module_data_t *mod, uint64_t time)
+{
+    if(time == 0 || !mod->is_txtime)
+        return 0;
+
+    uint64_t ns = time * 1000ULL;
+
+#ifdef CLOCK_TAI
+    if(mod->txtime_clock == CLOCK_TAI)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_TAI, &ts);
+
+        const uint64_t tai = (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+        ns += tai - asc_utime() * 1000ULL;
+    }
+#endif /* CLOCK_TAI */
+
+    return ns;
+}
+
+static void on_fec_column(void *arg, const uint8_t *data, size_t len)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    const uint64_t txtime = txtime_ns(mod, mod->txtime);
+    if(asc_socket_sendto_at(mod->sock_fec_col, data, len, txtime) == -1
+       && !asc_socket_would_block())
+    {
+        asc_log_warning(MSG("sendto() column FEC: %s"), asc_error_msg());
+    }
+}
+
+static void on_fec_row(void *arg, const uint8_t *data, size_t len)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    const uint64_t txtime = txtime_ns(mod, mod->txtime);
+    if(asc_socket_sendto_at(mod->sock_fec_row, data, len, txtime) == -1
+       && !asc_socket_would_block())
+    {
+        asc_log_warning(MSG("sendto() row FEC: %s"), asc_error_msg());
+    }
+}
+
+static void send_datagram(module_data_t *mod, const uint8_t *data, size_t len
+                          , uint64_t time)
+{
+    ssize_t ret;
+
+    if(mod->rist)
+        rist_sender_push(mod->rist, data, len);
+
+    if(mod->fanout)
+        ret = udp_fanout_send(mod->fanout, mod->sock, data, len);
+    else
+        ret = asc_socket_sendto_at(mod->sock, data, len, txtime_ns(mod, time));
+
+    if(ret == -1)
+    {
+        if(asc_socket_would_block())
+        {
+            mod->can_send = false;
+            asc_socket_set_on_ready(mod->sock, on_ready);
+        }
+        else
+            asc_log_warning(MSG("sendto(): %s"), asc_error_msg());
+    }
+
+    if(mod->fec)
+    {
+        mod->txtime = time;
+        rtp_fec_enc_push(mod->fec, data, len);
+    }
+}
+
+static void on_pacer_send(void *arg, const uint8_t *data, size_t len
+                          , uint64_t time)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    if(!mod->can_send)
+    {
+        mod->dropped++;
+        return;
+    }
+
+    if(!mod->is_txtime)
+    {
+        /* fallback: let the kernel spread each block at the PCR bitrate */
+        const uint64_t rate = udp_pacer_byterate(mod->pacer);
+        if(rate > 0 && (rate > mod->pacing_rate * 21 / 20
+                        || rate < mod->pacing_rate * 19 / 20))
+        {
+            mod->pacing_rate = rate;
+            asc_socket_set_pacing_rate(mod->sock, rate * 21 / 20);
+        }
+    }
+
+    send_datagram(mod, data, len, time);
+}
+
+static void on_rist_retransmit(void *arg, const uint8_t *data, size_t len)
 {
+    module_data_t *const mod = (module_data_t *)arg;
+
     if(!mod->can_send)
+        return;
+
+    if(asc_socket_sendto(mod->sock, data, len) == -1
+       && !asc_socket_would_block())
+    {
+        asc_log_warning(MSG("sendto() retransmission: %s"), asc_error_msg());
+    }
+}
+
+static void on_read_rtcp(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    uint8_t buffer[RIST_RTCP_SIZE];
+    const ssize_t ret = asc_socket_recv(mod->sock_rtcp, buffer, sizeof(buffer));
+    if(ret <= 0)
+    {
+        if(ret == -1 && !asc_socket_would_block())
+            asc_log_warning(MSG("recv() RTCP: %s"), asc_error_msg());
+
+        return;
+    }
+
+    rist_sender_rtcp(mod->rist, buffer, ret);
+}
+
+static void timer_rtcp_callback(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    uint8_t buffer[RIST_RTCP_SIZE];
+    const size_t len = rist_sender_report(mod->rist, buffer, sizeof(buffer));
+
+    if(len > 0 && asc_socket_sendto(mod->sock_rtcp, buffer, len) == -1
+       && !asc_socket_would_block())
+    {
+        asc_log_warning(MSG("sendto() RTCP: %s"), asc_error_msg());
+    }
+}
+
+static void packet_flush(module_data_t *mod)
+{
+    if(mod->strip_null)
+    {
+        rtp_npd_set(mod->packet.buffer, mod->packet.count, mod->packet.npd);
+        mod->packet.npd = 0;
+    }
+
+    if(mod->pacer)
+        udp_pacer_push(mod->pacer, mod->packet.buffer, mod->packet.skip);
+    else
+        send_datagram(mod, mod->packet.buffer, mod->packet.skip, 0);
+
+    mod->packet.skip = 0;
+    mod->packet.count = 0;
+}
+
+static void timer_hold_callback(void *arg)
+{
+    module_data_t *const mod = (module_data_t *)arg;
+
+    if(mod->packet.count > 0
+       && asc_utime() - mod->packet.time >= mod->max_hold / 2)
+    {
+        packet_flush(mod);
+    }
+}
+
+static void on_output_ts(module_data_t *mod, const uint8_t *ts)
+{
+    if(mod->pacer)
+    {
+        udp_pacer_ts(mod->pacer, ts);
+    }
+    else if(!mod->can_send)
     {
         mod->dropped++;
         return;
@@ -119,45 +358,185 @@ static void on_output_ts(module_data_t *mod, const uint8_t *ts)
         ++mod->rtpseq;
 
         mod->packet.skip += 12;
+        if(mod->strip_null)
+            mod->packet.skip += RTP_NPD_EXT_SIZE;
     }
 
-    memcpy(&mod->packet.buffer[mod->packet.skip], ts, TS_PACKET_SIZE);
-    mod->packet.skip += TS_PACKET_SIZE;
+    if(mod->packet.count == 0 && mod->timer_hold)
+        mod->packet.time = asc_utime();
 
-    if(mod->packet.skip > UDP_BUFFER_SIZE - TS_PACKET_SIZE)
+    if(mod->strip_null && TS_GET_PID(ts) == NULL_TS_PID)
+    {
+        mod->packet.npd |= 0x40 >> mod->packet.count;
+    }
+    else
     {
-        const ssize_t ret = asc_socket_sendto(mod->sock
-                                              , mod->packet.buffer
-                                              , mod->packet.skip);
+        memcpy(&mod->packet.buffer[mod->packet.skip], ts, TS_PACKET_SIZE);
+        mod->packet.skip += TS_PACKET_SIZE;
+    }
 
-        if(ret == -1)
-        {
-            if(asc_socket_would_block())
-            {
-                mod->can_send = false;
-                asc_socket_set_on_ready(mod->sock, on_ready);
-            }
-            else
-                asc_log_warning(MSG("sendto(): %s"), asc_error_msg());
-        }
+    if(++mod->packet.count >= mod->packets)
+        packet_flush(mod);
+}
+
+static asc_socket_t *open_socket(lua_State *L, module_data_t *mod, int port)
+{
+    asc_socket_t *const sock = asc_socket_open_udp4(mod);
+    asc_socket_set_reuseaddr(sock, 1);
+    if(!asc_socket_bind(sock, NULL, 0))
+        luaL_error(L, MSG("couldn't bind socket"));
+
+    int value;
+    if(module_option_integer(L, "socket_size", &value))
+        asc_socket_set_buffer(sock, 0, value);
+
+    const char *localaddr = NULL;
+    module_option_string(L, "localaddr", &localaddr, NULL);
+    if(localaddr)
+        asc_socket_set_multicast_if(sock, localaddr);
+
+    value = 32;
+    module_option_integer(L, "ttl", &value);
+    asc_socket_set_multicast_ttl(sock, value);
+
+    if(!mod->fanout)
+    {
+        asc_socket_multicast_join(sock, mod->addr, NULL);
+        asc_socket_set_sockaddr(sock, mod->addr, port);
+    }
+
+    return sock;
+}
+
+static void fanout_init(lua_State *L, module_data_t *mod)
+{
+    mod->fanout = udp_fanout_init(mod->is_rtp);
+
+    lua_foreach(L, -2)
+    {
+        if(lua_type(L, -1) != LUA_TTABLE)
+            luaL_error(L, MSG("option 'destinations': wrong type"));
+
+        lua_getfield(L, -1, "addr");
+        const char *const addr = lua_tostring(L, -1);
+        lua_pop(L, 1);
+
+        lua_getfield(L, -1, "port");
+        const int port = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+
+        if(addr == NULL || !udp_fanout_add(mod->fanout, addr, port))
+            luaL_error(L, MSG("option 'destinations': wrong destination"));
+    }
+}
+
+static int method_add_destination(lua_State *L, module_data_t *mod)
+{
+    const char *const addr = luaL_checkstring(L, 2);
+    const int port = luaL_checkinteger(L, 3);
+
+    if(mod->fanout == NULL)
+        luaL_error(L, MSG("option 'destinations' is not set"));
+
+    lua_pushboolean(L, udp_fanout_add(mod->fanout, addr, port));
+    return 1;
+}
+
+static int method_remove_destination(lua_State *L, module_data_t *mod)
+{
+    const char *const addr = luaL_checkstring(L, 2);
+    const int port = luaL_checkinteger(L, 3);
+
+    if(mod->fanout == NULL)
+        luaL_error(L, MSG("option 'destinations' is not set"));
 
-        mod->packet.skip = 0;
+    lua_pushboolean(L, udp_fanout_remove(mod->fanout, addr, port));
+    return 1;
+}
+
+static int method_destinations(lua_State *L, module_data_t *mod)
+{
+    lua_newtable(L);
+
+    if(mod->fanout == NULL)
+        return 1;
+
+    const unsigned int count = udp_fanout_count(mod->fanout);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        char addr[32];
+        int port;
+        udp_fanout_get(mod->fanout, i, addr, sizeof(addr), &port);
+
+        lua_newtable(L);
+        lua_pushstring(L, addr);
+        lua_setfield(L, -2, "addr");
+        lua_pushinteger(L, port);
+        lua_setfield(L, -2, "port");
+        lua_rawseti(L, -2, i + 1);
     }
+
+    return 1;
+}
+
+static int method_stat(lua_State *L, module_data_t *mod)
+{
+    lua_newtable(L);
+
+    if(mod->rist)
+    {
+        rist_sender_stat_t st;
+        rist_sender_query(mod->rist, &st);
+
+        lua_newtable(L);
+        lua_pushnumber(L, st.sent);
+        lua_setfield(L, -2, "sent");
+        lua_pushnumber(L, st.requested);
+        lua_setfield(L, -2, "requested");
+        lua_pushnumber(L, st.retransmitted);
+        lua_setfield(L, -2, "retransmitted");
+        lua_pushnumber(L, st.expired);
+        lua_setfield(L, -2, "expired");
+        lua_setfield(L, -2, "rist");
+    }
+
+    return 1;
 }
 
 static void module_init(lua_State *L, module_data_t *mod)
 {
+    module_option_boolean(L, "rtp", &mod->is_rtp);
+
+    lua_getfield(L, MODULE_OPTIONS_IDX, "destinations");
+    const bool is_fanout = lua_istable(L, -1);
+
     module_option_string(L, "addr", &mod->addr, NULL);
     if(mod->addr == NULL)
-        luaL_error(L, "[udp_output] option 'addr' is required");
+    {
+        if(!is_fanout)
+            luaL_error(L, "[udp_output] option 'addr' is required");
+
+        mod->addr = "fanout";
+    }
 
     mod->port = 1234;
     module_option_integer(L, "port", &mod->port);
 
-    module_option_boolean(L, "rtp", &mod->is_rtp);
+    if(is_fanout)
+        fanout_init(L, mod);
+    lua_pop(L, 1); // destinations
+
+    bool rist_on = false;
+    module_option_boolean(L, "rist", &rist_on);
+    if(rist_on && !mod->is_rtp)
+        luaL_error(L, MSG("option 'rist' requires RTP"));
+
     if(mod->is_rtp)
     {
-        const uint32_t rtpssrc = (uint32_t)rand();
+        /* RIST marks retransmissions with the low bit of the SSRC */
+        uint32_t rtpssrc = (uint32_t)rand();
+        if(rist_on)
+            rtpssrc &= ~1U;
 
         mod->packet.buffer[0 ] = 0x80; // RTP version
         mod->packet.buffer[1 ] = RTP_PT_MP2T;
@@ -167,26 +546,83 @@ static void module_init(lua_State *L, module_data_t *mod)
         mod->packet.buffer[11] = (rtpssrc      ) & 0xFF;
     }
 
-    mod->sock = asc_socket_open_udp4(mod);
-    asc_socket_set_reuseaddr(mod->sock, 1);
-    if(!asc_socket_bind(mod->sock, NULL, 0))
-        luaL_error(L, MSG("couldn't bind socket"));
+    int packets = UDP_PACKETS;
+    module_option_integer(L, "packets", &packets);
+    if(packets < 1 || packets > UDP_MAX_PACKETS)
+        luaL_error(L, MSG("option 'packets' is out of range"));
+    mod->packets = packets;
 
-    int value;
-    if(module_option_integer(L, "socket_size", &value))
-        asc_socket_set_buffer(mod->sock, 0, value);
+    const size_t size = UDP_DATAGRAM_SIZE(mod->packets);
 
-    const char *localaddr = NULL;
-    module_option_string(L, "localaddr", &localaddr, NULL);
-    if(localaddr)
-        asc_socket_set_multicast_if(mod->sock, localaddr);
+    module_option_boolean(L, "strip_null", &mod->strip_null);
+    if(mod->strip_null)
+    {
+        if(!mod->is_rtp)
+            luaL_error(L, MSG("option 'strip_null' requires RTP"));
 
-    value = 32;
-    module_option_integer(L, "ttl", &value);
-    asc_socket_set_multicast_ttl(mod->sock, value);
+        if(mod->packets > RTP_NPD_MAX_PACKETS)
+            luaL_error(L, MSG("option 'strip_null' supports up to %d packets")
+                       , RTP_NPD_MAX_PACKETS);
+
+        rtp_npd_init(mod->packet.buffer);
+    }
+
+    mod->sock = open_socket(L, mod, mod->port);
+
+    const char *fec_opts = NULL;
+    module_option_string(L, "fec", &fec_opts, NULL);
+    if(fec_opts != NULL)
+    {
+        unsigned int cols = 0, rows = 0;
+
+        if(!mod->is_rtp)
+            luaL_error(L, MSG("option 'fec' requires RTP"));
+
+        if(mod->fanout)
+            luaL_error(L, MSG("option 'fec' is not available with fan-out"));
+
+        if(mod->strip_null)
+            luaL_error(L, MSG("option 'fec' is not available with 'strip_null'"));
+
+        if(!rtp_fec_parse_opts(fec_opts, &cols, &rows))
+            luaL_error(L, MSG("invalid value for option 'fec'"));
+
+        bool fec_1d = false;
+        module_option_boolean(L, "fec_1d", &fec_1d);
+
+        mod->fec = rtp_fec_enc_init(cols, rows, !fec_1d, size);
+        rtp_fec_enc_set_arg(mod->fec, mod);
+
+        mod->sock_fec_col = open_socket(L, mod, mod->port + FEC_PORT_COLUMN);
+        rtp_fec_enc_set_on_column(mod->fec, on_fec_column);
+
+        if(!fec_1d)
+        {
+            mod->sock_fec_row = open_socket(L, mod, mod->port + FEC_PORT_ROW);
+            rtp_fec_enc_set_on_row(mod->fec, on_fec_row);
+        }
+    }
+
+    if(rist_on)
+    {
+        if(mod->fanout)
+            luaL_error(L, MSG("option 'rist' is not available with fan-out"));
+
+        int count = UDP_RIST_BUFFER;
+        module_option_integer(L, "rist_buffer", &count);
+        if(count < 1 || count > UDP_RIST_MAX_BUFFER)
+            luaL_error(L, MSG("option 'rist_buffer' is out of range"));
 
-    asc_socket_multicast_join(mod->sock, mod->addr, NULL);
-    asc_socket_set_sockaddr(mod->sock, mod->addr, mod->port);
+        mod->rist = rist_sender_init(count, size);
+        rist_sender_set_on_retransmit(mod->rist, on_rist_retransmit);
+        rist_sender_set_arg(mod->rist, mod);
+
+        mod->sock_rtcp = open_socket(L, mod, mod->port + RIST_PORT_RTCP);
+        asc_socket_set_on_read(mod->sock_rtcp, on_read_rtcp);
+
+        mod->timer_rtcp = asc_timer_init(RIST_RTCP_INTERVAL
+                                         , timer_rtcp_callback, mod);
+    }
 
     mod->can_send = false;
     asc_socket_set_on_ready(mod->sock, on_ready);
@@ -195,7 +631,56 @@ static void module_init(lua_State *L, module_data_t *mod)
     bool sync_on = false;
     module_option_boolean(L, "sync", &sync_on);
 
-    if(sync_on)
+    bool txtime_on = false;
+    module_option_boolean(L, "txtime", &txtime_on);
+
+    if(txtime_on)
+    {
+        if(sync_on)
+            luaL_error(L, MSG("options 'sync' and 'txtime' are exclusive"));
+
+        if(mod->fanout)
+            luaL_error(L, MSG("option 'txtime' is not available with fan-out"));
+
+        int horizon = UDP_TXTIME_HORIZON;
+        module_option_integer(L, "txtime_horizon", &horizon);
+        if(horizon < 1 || horizon > 1000)
+            luaL_error(L, MSG("option 'txtime_horizon' is out of range"));
+
+        mod->txtime_clock = CLOCK_MONOTONIC;
+
+        const char *clock = NULL;
+        module_option_string(L, "txtime_clock", &clock, NULL);
+        if(clock != NULL)
+        {
+#ifdef CLOCK_TAI
+            if(!strcmp(clock, "tai"))
+                mod->txtime_clock = CLOCK_TAI;
+            else
+#endif /* CLOCK_TAI */
+            if(strcmp(clock, "monotonic"))
+                luaL_error(L, MSG("invalid value for option 'txtime_clock'"));
+        }
+
+        mod->is_txtime = asc_socket_set_txtime(mod->sock, mod->txtime_clock);
+        if(mod->is_txtime)
+        {
+            if(mod->sock_fec_col)
+                asc_socket_set_txtime(mod->sock_fec_col, mod->txtime_clock);
+            if(mod->sock_fec_row)
+                asc_socket_set_txtime(mod->sock_fec_row, mod->txtime_clock);
+        }
+        else
+        {
+            asc_log_warning(MSG("SO_TXTIME is not available, "
+                                "using SO_MAX_PACING_RATE"));
+        }
+
+        mod->pacer = udp_pacer_init(horizon, size);
+        udp_pacer_set_on_send(mod->pacer, on_pacer_send);
+        udp_pacer_set_arg(mod->pacer, mod);
+    }
+    else if(sync_on)
     {
         mod->sync = mpegts_sync_init();
 
@@ -215,6 +700,18 @@ static void module_init(lua_State *L, module_data_t *mod)
         on_ts = on_sync_ts;
     }
 
+    int max_hold = 0;
+    module_option_integer(L, "max_hold", &max_hold);
+    if(max_hold < 0)
+        luaL_error(L, MSG("option 'max_hold' is out of range"));
+
+    if(max_hold > 0 && mod->packets > 1)
+    {
+        mod->max_hold = max_hold * 1000ULL;
+        mod->timer_hold = asc_timer_init((max_hold + 1) / 2
+                                         , timer_hold_callback, mod);
+    }
+
     module_stream_init(mod, on_ts);
 }
 
@@ -222,8 +719,17 @@ static void module_destroy(module_data_t *mod)
 {
     module_stream_destroy(mod);
 
+    ASC_FREE(mod->timer_rtcp, asc_timer_destroy);
+    ASC_FREE(mod->sock_rtcp, asc_socket_close);
+    ASC_FREE(mod->rist, rist_sender_destroy);
+    ASC_FREE(mod->timer_hold, asc_timer_destroy);
     ASC_FREE(mod->sync_loop, asc_timer_destroy);
     ASC_FREE(mod->sync, mpegts_sync_destroy);
+    ASC_FREE(mod->fanout, udp_fanout_destroy);
+    ASC_FREE(mod->pacer, udp_pacer_destroy);
+    ASC_FREE(mod->fec, rtp_fec_enc_destroy);
+    ASC_FREE(mod->sock_fec_row, asc_socket_close);
+    ASC_FREE(mod->sock_fec_col, asc_socket_close);
     ASC_FREE(mod->sock, asc_socket_close);
 }
 
@@ -231,5 +737,9 @@ MODULE_STREAM_METHODS()
 MODULE_LUA_METHODS()
 {
     MODULE_STREAM_METHODS_REF(),
+    { "add_destination", method_add_destination },
+    { "remove_destination", method_remove_destination },
+    { "destinations", method_destinations },
+    { "stat", method_stat },
 };
 MODULE_LUA_REGISTER(udp_output)
@@ -0,0 +1,256 @@
+/*
+ * Astra Module: UDP (PCR pacing)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <astra.h>
+#include <mpegts/pcr.h>
+#include "pacer.h"
+
+/* maximum allowed PCR spacing */
+#define PACER_MAX_PCR_DELTA ((PCR_TIME_BASE * 150) / 1000) /* 150ms */
+
+/* queue limits, datagrams */
+#define PACER_MIN_QUEUE 64
+#define PACER_MAX_QUEUE 4096
+
+typedef struct
+{
+    uint64_t idx;
+    size_t len;
+} pacer_slot_t;
+
+struct udp_pacer_t
+{
+    uint64_t horizon;
+    size_t size;
+
+    /* datagrams waiting for the next PCR */
+    pacer_slot_t *slots;
+    uint8_t *data;
+    unsigned int count;
+    unsigned int alloc;
+
+    /* TS packets seen so far */
+    uint64_t idx;
+
+    /* last PCR */
+    unsigned int pcr_pid;
+    bool anchored;
+    uint64_t pcr;
+    uint64_t time;
+    uint64_t pcr_idx;
+
+    uint64_t byterate;
+
+    void *arg;
+    udp_pacer_callback_t on_send;
+};
+
+/*
+ * create and destroy
+ */
+
+udp_pacer_t *udp_pacer_init(unsigned int horizon, size_t size)
+{
+    udp_pacer_t *const p = ASC_ALLOC(1, udp_pacer_t);
+
+    p->horizon = horizon * 1000ULL;
+    p->size = size;
+
+    p->alloc = PACER_MIN_QUEUE;
+    p->slots = ASC_ALLOC(p->alloc, pacer_slot_t);
+    p->data = ASC_ALLOC(p->alloc * size, uint8_t);
+
+    return p;
+}
+
+void udp_pacer_destroy(udp_pacer_t *p)
+{
+    free(p->data);
+    free(p->slots);
+    free(p);
+}
+
+/*
+ * setters and getters
+ */
+
+void udp_pacer_set_on_send(udp_pacer_t *p, udp_pacer_callback_t on_send)
+{
+    p->on_send = on_send;
+}
+
+void udp_pacer_set_arg(udp_pacer_t *p, void *arg)
+{
+    p->arg = arg;
+}
+
+uint64_t udp_pacer_byterate(const udp_pacer_t *p)
+{
+    return p->byterate;
+}
+
+/*
+ * pacing
+ */
+
+static void queue_flush(udp_pacer_t *p, uint64_t time)
+{
+    for (unsigned int i = 0; i < p->count; i++)
+    {
+        const pacer_slot_t *const slot = &p->slots[i];
+        uint64_t txtime = time;
+
+        if (p->anchored)
+        {
+            /* interpolate between the last PCR and this one */
+            const uint64_t packets = p->idx - p->pcr_idx;
+            const uint64_t offset = slot->idx - p->pcr_idx;
+
+            txtime = p->time + ((time - p->time) * offset) / packets;
+        }
+
+        p->on_send(p->arg, &p->data[i * p->size], slot->len, txtime);
+    }
+
+    p->count = 0;
+}
+
+/* earliest departure time that keeps the queue in order */
+static uint64_t next_time(const udp_pacer_t *p, uint64_t time)
+{
+    return (time > p->time) ? time : p->time;
+}
+
+static void restart(udp_pacer_t *p, uint64_t now)
+{
+    /* nothing to interpolate against; send the backlog in one go */
+    p->anchored = false;
+    queue_flush(p, next_time(p, now));
+}
+
+static void anchor(udp_pacer_t *p, uint64_t pcr, uint64_t time)
+{
+    p->anchored = true;
+    p->pcr = pcr;
+    p->time = time;
+    p->pcr_idx = p->idx;
+}
+
+static void on_pcr(udp_pacer_t *p, uint64_t pcr)
+{
+    const uint64_t now = asc_utime();
+
+    if (!p->anchored)
+    {
+        restart(p, now);
+        anchor(p, pcr, next_time(p, now + p->horizon));
+
+        return;
+    }
+
+    int64_t delta = pcr - p->pcr;
+    if (delta < 0)
+        /* clock reset or wrap around */
+        delta += PCR_MAX + 1;
+
+    if (delta <= 0 || delta >= PACER_MAX_PCR_DELTA)
+    {
+        asc_log_debug("[udp_pacer] PCR discontinuity, restarting");
+
+        restart(p, now);
+        anchor(p, pcr, next_time(p, now + p->horizon));
+
+        return;
+    }
+
+    uint64_t time = p->time + (delta * 1000000) / PCR_TIME_BASE;
+
+    /*
+     * Source and local clocks drift apart and input jitter moves the
+     * PCR arrival around; start over if we're about to send late or
+     * too far ahead. Departure times never go backwards though, or
+     * the qdisc would reorder datagrams.
+     */
+    if (time < now || time > now + p->horizon * 2)
+    {
+        asc_log_debug("[udp_pacer] departure time drifted by %" PRId64 "us"
+                      ", restarting", (int64_t)(time - (now + p->horizon)));
+
+        time = next_time(p, now + p->horizon);
+    }
+
+    const uint64_t bytes = (p->idx - p->pcr_idx) * TS_PACKET_SIZE;
+    p->byterate = (bytes * PCR_TIME_BASE) / delta;
+
+    queue_flush(p, time);
+    anchor(p, pcr, time);
+}
+
+void udp_pacer_ts(udp_pacer_t *p, const uint8_t *ts)
+{
+    p->idx++;
+
+    if (!TS_IS_PCR(ts))
+        return;
+
+    const unsigned int pid = TS_GET_PID(ts);
+
+    if (!p->pcr_pid && pid != NULL_TS_PID)
+        /* latch onto first PCR pid we see */
+        p->pcr_pid = pid;
+
+    if (pid == p->pcr_pid)
+        on_pcr(p, TS_GET_PCR(ts));
+}
+
+void udp_pacer_push(udp_pacer_t *p, const uint8_t *data, size_t len)
+{
+    if (len > p->size)
+        return;
+
+    if (p->count >= p->alloc)
+    {
+        if (p->alloc >= PACER_MAX_QUEUE)
+        {
+            /* PCR is gone; send everything and look for a new one */
+            asc_log_debug("[udp_pacer] no PCR, queue overflow");
+
+            restart(p, asc_utime());
+            p->pcr_pid = 0;
+        }
+        else
+        {
+            p->alloc *= 2;
+            p->slots = (pacer_slot_t *)realloc(p->slots
+                                               , p->alloc * sizeof(*p->slots));
+            p->data = (uint8_t *)realloc(p->data, p->alloc * p->size);
+            asc_assert(p->slots != NULL && p->data != NULL
+                       , "[udp_pacer] realloc() failed");
+        }
+    }
+
+    pacer_slot_t *const slot = &p->slots[p->count];
+    slot->idx = p->idx;
+    slot->len = len;
+    memcpy(&p->data[p->count * p->size], data, len);
+
+    p->count++;
+}
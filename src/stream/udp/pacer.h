@@ -0,0 +1,55 @@
+/*
+ * Astra Module: UDP (PCR pacing)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _UDP_PACER_H_
+#define _UDP_PACER_H_ 1
+
+#ifndef _ASTRA_H_
+#   error "Please include <astra.h> first"
+#endif /* !_ASTRA_H_ */
+
+/*
+ * PCR pacer
+ *
+ * Datagrams are queued until the next PCR on the selected PID arrives.
+ * Each queued datagram is then given a departure time interpolated
+ * between the two PCRs, offset by `horizon' milliseconds from the
+ * moment the first PCR was seen. Departure times are in asc_utime()
+ * microseconds and never go backwards: before the first PCR and after
+ * a discontinuity the backlog is sent at the current time or the last
+ * departure time, whichever is later.
+ */
+typedef struct udp_pacer_t udp_pacer_t;
+typedef void (*udp_pacer_callback_t)(void *, const uint8_t *, size_t, uint64_t);
+
+udp_pacer_t *udp_pacer_init(unsigned int horizon, size_t size) __wur;
+void udp_pacer_destroy(udp_pacer_t *p);
+
+void udp_pacer_set_on_send(udp_pacer_t *p, udp_pacer_callback_t on_send);
+void udp_pacer_set_arg(udp_pacer_t *p, void *arg);
+
+void udp_pacer_ts(udp_pacer_t *p, const uint8_t *ts);
+void udp_pacer_push(udp_pacer_t *p, const uint8_t *data, size_t len);
+
+/* stream rate between the last two PCRs, bytes per second */
+uint64_t udp_pacer_byterate(const udp_pacer_t *p) __func_pure;
+
+#endif /* _UDP_PACER_H_ */
@@ -0,0 +1,558 @@
+/*
+ * Astra Module: UDP (RIST Simple Profile)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <astra.h>
+#include "rist.h"
+
+/* RTCP packet types and feedback formats */
+#define RTCP_PT_SR 200
+#define RTCP_PT_RR 201
+#define RTCP_PT_SDES 202
+#define RTCP_PT_APP 204
+#define RTCP_PT_RTPFB 205
+
+#define RTCP_FMT_NACK 1
+#define RTCP_SDES_CNAME 1
+
+#define RTCP_GET_LENGTH(_rtcp) \
+    ((size_t)((((_rtcp[2] << 8) | _rtcp[3]) + 1) * 4))
+
+/* canonical name sent in SDES */
+#define RIST_CNAME "astra"
+
+/* seconds between 1900 (NTP epoch) and 1970 */
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+/* gaps tracked by the receiver; larger jumps are a discontinuity */
+#define RIST_MAX_GAPS 1024
+
+/* shortest time between two requests for the same datagram, us */
+#define RIST_MIN_RETRY 5000
+
+static inline
+void put_u16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = (value >> 8) & 0xFF;
+    buffer[1] = (value) & 0xFF;
+}
+
+static inline
+void put_u32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (value >> 24) & 0xFF;
+    buffer[1] = (value >> 16) & 0xFF;
+    buffer[2] = (value >> 8) & 0xFF;
+    buffer[3] = (value) & 0xFF;
+}
+
+static inline
+uint32_t get_u32(const uint8_t *buffer)
+{
+    return (uint32_t)((buffer[0] << 24) | (buffer[1] << 16)
+                      | (buffer[2] << 8) | buffer[3]);
+}
+
+static inline
+void rtcp_header(uint8_t *buffer, uint8_t count, uint8_t pt, size_t len)
+{
+    buffer[0] = 0x80 | (count & 0x1F);
+    buffer[1] = pt;
+    put_u16(&buffer[2], (uint16_t)(len / 4 - 1));
+}
+
+/* appends SDES with a single CNAME item, returns its size */
+static size_t rtcp_sdes(uint8_t *buffer, size_t size, uint32_t ssrc)
+{
+    const size_t cname = sizeof(RIST_CNAME) - 1;
+    const size_t len = (8 + 2 + cname + 1 + 3) & ~3;
+
+    if (size < len)
+        return 0;
+
+    memset(buffer, 0, len);
+    rtcp_header(buffer, 1, RTCP_PT_SDES, len);
+    put_u32(&buffer[4], ssrc);
+    buffer[8] = RTCP_SDES_CNAME;
+    buffer[9] = cname;
+    memcpy(&buffer[10], RIST_CNAME, cname);
+
+    return len;
+}
+
+/* NTP timestamp of the current wall clock time */
+static uint64_t ntp_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    const uint64_t sec = ts.tv_sec + NTP_UNIX_OFFSET;
+    const uint64_t frac = ((uint64_t)ts.tv_nsec << 32) / 1000000000ULL;
+
+    return (sec << 32) | frac;
+}
+
+/*
+ * sender
+ */
+
+typedef struct
+{
+    size_t len;
+    uint16_t seq;
+    bool used;
+} rist_slot_t;
+
+struct rist_sender_t
+{
+    unsigned int count;
+    size_t size;
+
+    rist_slot_t *slots;
+    uint8_t *data;
+
+    uint32_t ssrc;
+    uint32_t rtp_ts;
+    uint64_t octets;
+
+    rist_sender_stat_t stat;
+
+    void *arg;
+    rtp_callback_t on_retransmit;
+};
+
+rist_sender_t *rist_sender_init(unsigned int count, size_t size)
+{
+    rist_sender_t *const s = ASC_ALLOC(1, rist_sender_t);
+
+    /* slots are indexed by seq % count, which needs a power of two to
+     * stay consistent across the sequence number wrap */
+    s->count = 1;
+    while (s->count < count)
+        s->count *= 2;
+
+    s->size = size;
+    s->slots = ASC_ALLOC(s->count, rist_slot_t);
+    s->data = ASC_ALLOC(s->count * size, uint8_t);
+
+    return s;
+}
+
+void rist_sender_destroy(rist_sender_t *s)
+{
+    free(s->data);
+    free(s->slots);
+    free(s);
+}
+
+void rist_sender_set_on_retransmit(rist_sender_t *s, rtp_callback_t on_retransmit)
+{
+    s->on_retransmit = on_retransmit;
+}
+
+void rist_sender_set_arg(rist_sender_t *s, void *arg)
+{
+    s->arg = arg;
+}
+
+void rist_sender_query(const rist_sender_t *s, rist_sender_stat_t *out)
+{
+    memcpy(out, &s->stat, sizeof(*out));
+}
+
+void rist_sender_push(rist_sender_t *s, const uint8_t *data, size_t len)
+{
+    if (len < RTP_HEADER_SIZE || len > s->size)
+        return;
+
+    const uint16_t seq = RTP_GET_SEQ(data);
+    rist_slot_t *const slot = &s->slots[seq % s->count];
+    uint8_t *const dst = &s->data[(slot - s->slots) * s->size];
+
+    /* keep a copy that is ready to go out as a retransmission */
+    memcpy(dst, data, len);
+    dst[11] |= 0x01;
+
+    slot->len = len;
+    slot->seq = seq;
+    slot->used = true;
+
+    s->ssrc = RTP_GET_SSRC(data) & ~1U;
+    s->rtp_ts = RTP_GET_TS(data);
+    s->octets += len - RTP_HEADER_SIZE;
+    s->stat.sent++;
+}
+
+static void sender_retransmit(rist_sender_t *s, uint16_t seq)
+{
+    const rist_slot_t *const slot = &s->slots[seq % s->count];
+
+    s->stat.requested++;
+
+    if (!slot->used || slot->seq != seq)
+    {
+        s->stat.expired++;
+        return;
+    }
+
+    s->stat.retransmitted++;
+    s->on_retransmit(s->arg, &s->data[(slot - s->slots) * s->size], slot->len);
+}
+
+void rist_sender_rtcp(rist_sender_t *s, const uint8_t *data, size_t len)
+{
+    while (len >= 4)
+    {
+        const size_t plen = RTCP_GET_LENGTH(data);
+        if (plen > len || (data[0] & 0xC0) != 0x80)
+            break;
+
+        const uint8_t fmt = data[0] & 0x1F;
+        const uint8_t pt = data[1];
+
+        if (pt == RTCP_PT_RTPFB && fmt == RTCP_FMT_NACK)
+        {
+            /* generic NACK: PID and a bitmask of the following 16 */
+            for (size_t i = 12; i + 4 <= plen; i += 4)
+            {
+                const uint16_t pid = (data[i] << 8) | data[i + 1];
+                const uint16_t blp = (data[i + 2] << 8) | data[i + 3];
+
+                sender_retransmit(s, pid);
+                for (unsigned int b = 0; b < 16; b++)
+                {
+                    if (blp & (1 << b))
+                        sender_retransmit(s, pid + 1 + b);
+                }
+            }
+        }
+        else if (pt == RTCP_PT_APP && fmt == 0 && plen >= 12
+                 && !memcmp(&data[8], "RIST", 4))
+        {
+            /* range NACK: first sequence number and number of the following */
+            for (size_t i = 12; i + 4 <= plen; i += 4)
+            {
+                const uint16_t seq = (data[i] << 8) | data[i + 1];
+                unsigned int extra = (data[i + 2] << 8) | data[i + 3];
+
+                if (extra >= s->count)
+                    extra = s->count - 1;
+
+                for (unsigned int k = 0; k <= extra; k++)
+                    sender_retransmit(s, seq + k);
+            }
+        }
+
+        data += plen;
+        len -= plen;
+    }
+}
+
+size_t rist_sender_report(rist_sender_t *s, uint8_t *buffer, size_t size)
+{
+    static const size_t sr_len = 28;
+
+    if (size < sr_len)
+        return 0;
+
+    const uint64_t ntp = ntp_time();
+
+    rtcp_header(buffer, 0, RTCP_PT_SR, sr_len);
+    put_u32(&buffer[4], s->ssrc);
+    put_u32(&buffer[8], (uint32_t)(ntp >> 32));
+    put_u32(&buffer[12], (uint32_t)ntp);
+    put_u32(&buffer[16], s->rtp_ts);
+    put_u32(&buffer[20], (uint32_t)s->stat.sent);
+    put_u32(&buffer[24], (uint32_t)s->octets);
+
+    return sr_len + rtcp_sdes(&buffer[sr_len], size - sr_len, s->ssrc);
+}
+
+/*
+ * receiver
+ */
+
+typedef struct
+{
+    uint64_t time;      /* next request is due */
+    uint16_t seq;
+    uint8_t retries;
+    bool used;
+} rist_gap_t;
+
+struct rist_receiver_t
+{
+    /* configuration */
+    unsigned int retries;
+    uint64_t interval;
+
+    /* media stream */
+    bool started;
+    uint16_t max;
+    uint16_t cycles;
+    uint32_t source;
+    uint32_t ssrc;
+
+    /* last sender report, for round trip time at the sender */
+    uint32_t lsr;
+    uint64_t lsr_time;
+
+    rist_gap_t gaps[RIST_MAX_GAPS];
+    unsigned int gap_count;
+
+    uint64_t report_time;
+
+    rist_receiver_stat_t stat;
+};
+
+rist_receiver_t *rist_receiver_init(unsigned int retries, unsigned int latency)
+{
+    rist_receiver_t *const r = ASC_ALLOC(1, rist_receiver_t);
+
+    r->retries = retries;
+    r->interval = (latency * 1000ULL) / (retries + 1);
+    if (r->interval < RIST_MIN_RETRY)
+        r->interval = RIST_MIN_RETRY;
+
+    r->ssrc = (uint32_t)rand() & ~1U;
+
+    return r;
+}
+
+void rist_receiver_destroy(rist_receiver_t *r)
+{
+    free(r);
+}
+
+void rist_receiver_query(const rist_receiver_t *r, rist_receiver_stat_t *out)
+{
+    memcpy(out, &r->stat, sizeof(*out));
+}
+
+static void gaps_reset(rist_receiver_t *r)
+{
+    for (unsigned int i = 0; i < RIST_MAX_GAPS; i++)
+        r->gaps[i].used = false;
+
+    r->gap_count = 0;
+}
+
+static inline
+void gap_remove(rist_receiver_t *r, rist_gap_t *gap)
+{
+    gap->used = false;
+    r->gap_count--;
+}
+
+void rist_receiver_media(rist_receiver_t *r, const uint8_t *data, size_t len)
+{
+    if (len < RTP_HEADER_SIZE)
+        return;
+
+    const uint16_t seq = RTP_GET_SEQ(data);
+    r->source = RTP_GET_SSRC(data) & ~1U;
+
+    if (!r->started)
+    {
+        r->started = true;
+        r->max = seq;
+        return;
+    }
+
+    const int diff = RTP_SEQ_DIFF(seq, r->max);
+
+    if (diff > 0)
+    {
+        if (diff >= RIST_MAX_GAPS)
+        {
+            /* discontinuity, nothing to request */
+            gaps_reset(r);
+        }
+        else
+        {
+            const uint64_t now = asc_utime();
+
+            for (uint16_t s = r->max + 1; ; s++)
+            {
+                rist_gap_t *const gap = &r->gaps[s % RIST_MAX_GAPS];
+
+                /* whatever was here is a full cycle behind */
+                if (gap->used)
+                {
+                    gap_remove(r, gap);
+                    r->stat.lost++;
+                }
+
+                if (s == seq)
+                    break;
+
+                gap->time = now;
+                gap->seq = s;
+                gap->retries = 0;
+                gap->used = true;
+                r->gap_count++;
+            }
+        }
+
+        if (seq < r->max)
+            r->cycles++;
+
+        r->max = seq;
+    }
+    else if (diff < 0)
+    {
+        rist_gap_t *const gap = &r->gaps[seq % RIST_MAX_GAPS];
+
+        if (gap->used && gap->seq == seq)
+        {
+            if (gap->retries > 0)
+                r->stat.recovered++;
+
+            gap_remove(r, gap);
+        }
+    }
+}
+
+void rist_receiver_rtcp(rist_receiver_t *r, const uint8_t *data, size_t len)
+{
+    while (len >= 4)
+    {
+        const size_t plen = RTCP_GET_LENGTH(data);
+        if (plen > len || (data[0] & 0xC0) != 0x80)
+            break;
+
+        if (data[1] == RTCP_PT_SR && plen >= 28)
+        {
+            /* middle 32 bits of the NTP timestamp */
+            r->lsr = (get_u32(&data[8]) << 16) | (get_u32(&data[12]) >> 16);
+            r->lsr_time = asc_utime();
+            r->stat.reports++;
+        }
+
+        data += plen;
+        len -= plen;
+    }
+}
+
+/* appends a generic NACK for the due gaps, returns its size */
+static size_t rtcp_nack(rist_receiver_t *r, uint8_t *buffer, size_t size)
+{
+    if (r->gap_count == 0 || size < 16)
+        return 0;
+
+    const uint64_t now = asc_utime();
+    const size_t max_len = size & ~3;
+
+    size_t len = 12;
+    uint16_t pid = 0;
+    uint16_t blp = 0;
+    bool is_pid = false;
+
+    /* oldest first */
+    for (unsigned int i = RIST_MAX_GAPS - 1; i > 0; i--)
+    {
+        const uint16_t seq = r->max - i;
+        rist_gap_t *const gap = &r->gaps[seq % RIST_MAX_GAPS];
+
+        if (!gap->used || gap->seq != seq || gap->time > now)
+            continue;
+
+        if (gap->retries >= r->retries)
+        {
+            gap_remove(r, gap);
+            r->stat.lost++;
+            continue;
+        }
+
+        const uint16_t delta = seq - pid;
+        if (is_pid && delta >= 1 && delta <= 16)
+        {
+            blp |= 1 << (delta - 1);
+        }
+        else
+        {
+            if (is_pid)
+            {
+                if (len + 4 > max_len)
+                    break;
+
+                put_u16(&buffer[len], pid);
+                put_u16(&buffer[len + 2], blp);
+                len += 4;
+            }
+
+            pid = seq;
+            blp = 0;
+            is_pid = true;
+        }
+
+        gap->retries++;
+        gap->time = now + r->interval;
+        r->stat.requested++;
+    }
+
+    if (!is_pid || len + 4 > max_len)
+        return 0;
+
+    put_u16(&buffer[len], pid);
+    put_u16(&buffer[len + 2], blp);
+    len += 4;
+
+    rtcp_header(buffer, RTCP_FMT_NACK, RTCP_PT_RTPFB, len);
+    put_u32(&buffer[4], r->ssrc);
+    put_u32(&buffer[8], r->source);
+
+    return len;
+}
+
+size_t rist_receiver_report(rist_receiver_t *r, uint8_t *buffer, size_t size)
+{
+    static const size_t rr_len = 32;
+
+    if (size < rr_len)
+        return 0;
+
+    /* receiver report with a single report block */
+    const uint64_t now = asc_utime();
+    const uint32_t lost = (r->stat.lost > 0x7FFFFF)
+                        ? 0x7FFFFF : (uint32_t)r->stat.lost;
+
+    rtcp_header(buffer, 1, RTCP_PT_RR, rr_len);
+    put_u32(&buffer[4], r->ssrc);
+    put_u32(&buffer[8], r->source);
+    put_u32(&buffer[12], lost);
+    put_u32(&buffer[16], ((uint32_t)r->cycles << 16) | r->max);
+    put_u32(&buffer[20], 0);
+    put_u32(&buffer[24], r->lsr);
+    put_u32(&buffer[28], (r->lsr_time > 0)
+                         ? (uint32_t)(((now - r->lsr_time) << 16) / 1000000)
+                         : 0);
+
+    size_t len = rr_len;
+    len += rtcp_sdes(&buffer[len], size - len, r->ssrc);
+
+    const size_t nack = rtcp_nack(r, &buffer[len], size - len);
+    if (nack == 0 && now - r->report_time < RIST_RTCP_INTERVAL * 1000ULL)
+        return 0;
+
+    r->report_time = now;
+
+    return len + nack;
+}
@@ -0,0 +1,107 @@
+/*
+ * Astra Module: UDP (RIST Simple Profile)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _UDP_RIST_H_
+#define _UDP_RIST_H_ 1
+
+#ifndef _ASTRA_H_
+#   error "Please include <astra.h> first"
+#endif /* !_ASTRA_H_ */
+
+#include "rtp.h"
+
+/*
+ * RIST Simple Profile (VSF TR-06-1)
+ *
+ * Media goes to an even port P, RTCP to P + 1. The sender transmits
+ * sender reports from its RTCP socket and answers NACKs that come back
+ * to it; the receiver replies to whatever address its RTCP arrives
+ * from. Retransmitted datagrams carry the original SSRC with the least
+ * significant bit set.
+ */
+#define RIST_PORT_RTCP 1
+
+/* RTCP report interval, ms */
+#define RIST_RTCP_INTERVAL 100
+
+/* largest RTCP compound packet we build */
+#define RIST_RTCP_SIZE 1200
+
+/*
+ * Sender
+ *
+ * Keeps the last `count' datagrams, indexed by sequence number, and
+ * passes the requested ones back to the callback for retransmission.
+ * Both generic NACKs (RFC 4585) and RIST range NACKs are understood.
+ */
+typedef struct rist_sender_t rist_sender_t;
+
+typedef struct
+{
+    uint64_t sent;          /* media datagrams */
+    uint64_t requested;     /* sequence numbers asked for in NACKs */
+    uint64_t retransmitted; /* datagrams sent again */
+    uint64_t expired;       /* requested, but already out of the buffer */
+} rist_sender_stat_t;
+
+rist_sender_t *rist_sender_init(unsigned int count, size_t size) __wur;
+void rist_sender_destroy(rist_sender_t *s);
+
+void rist_sender_set_on_retransmit(rist_sender_t *s, rtp_callback_t on_retransmit);
+void rist_sender_set_arg(rist_sender_t *s, void *arg);
+
+void rist_sender_push(rist_sender_t *s, const uint8_t *data, size_t len);
+void rist_sender_rtcp(rist_sender_t *s, const uint8_t *data, size_t len);
+size_t rist_sender_report(rist_sender_t *s, uint8_t *buffer, size_t size);
+
+void rist_sender_query(const rist_sender_t *s, rist_sender_stat_t *out);
+
+/*
+ * Receiver
+ *
+ * Watches media sequence numbers and keeps a list of the missing ones.
+ * rist_receiver_report() builds a receiver report with a NACK for every
+ * gap whose retry timer is due; it returns zero if there are no NACKs
+ * to send and the next periodic report isn't due yet. Each gap is
+ * requested up to `retries' times, evenly spread over `latency'
+ * milliseconds.
+ */
+typedef struct rist_receiver_t rist_receiver_t;
+
+typedef struct
+{
+    uint64_t requested;     /* NACKed sequence numbers, including retries */
+    uint64_t recovered;     /* gaps filled after a NACK */
+    uint64_t lost;          /* gaps given up on */
+    uint64_t reports;       /* sender reports received */
+} rist_receiver_stat_t;
+
+rist_receiver_t *rist_receiver_init(unsigned int retries
+                                    , unsigned int latency) __wur;
+void rist_receiver_destroy(rist_receiver_t *r);
+
+void rist_receiver_media(rist_receiver_t *r, const uint8_t *data, size_t len);
+void rist_receiver_rtcp(rist_receiver_t *r, const uint8_t *data, size_t len);
+size_t rist_receiver_report(rist_receiver_t *r, uint8_t *buffer, size_t size);
+
+void rist_receiver_query(const rist_receiver_t *r, rist_receiver_stat_t *out);
+
+#endif /* _UDP_RIST_H_ */
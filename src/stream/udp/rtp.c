@@ -0,0 +1,422 @@
+/*
+ * Astra Module: UDP (RTP helpers)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <astra.h>
+#include "rtp.h"
+
+/* sequence number validation thresholds (RFC 3550, appendix A.1) */
+#define RTP_SEQ_MOD (1 << 16)
+#define RTP_MAX_DROPOUT 3000
+#define RTP_MAX_MISORDER 100
+
+typedef struct
+{
+    uint64_t time;
+    size_t len;
+    uint16_t seq;
+    bool used;
+} rtp_slot_t;
+
+struct rtp_reorder_t
+{
+    /* configuration */
+    unsigned int depth;
+    unsigned int max_depth;
+    uint64_t latency;
+    size_t size;
+
+    /* queued datagrams */
+    rtp_slot_t *slots;
+    uint8_t *data;
+    unsigned int count;
+
+    /* sequence tracking */
+    bool started;
+    uint16_t next;
+    uint16_t max;
+    uint32_t bad_seq;
+    uint8_t seen[RTP_SEQ_MOD / 8];
+
+    rtp_reorder_stat_t stat;
+
+    void *arg;
+    rtp_callback_t on_packet;
+};
+
+/*
+ * create and destroy
+ */
+
+/* slots are indexed by seq % depth, which only wraps cleanly if the
+ * depth divides the 16-bit sequence space */
+static unsigned int depth_align(unsigned int depth)
+{
+    if (depth > RTP_REORDER_MAX_DEPTH)
+        return RTP_REORDER_MAX_DEPTH;
+
+    unsigned int aligned = 1;
+    while (aligned < depth)
+        aligned *= 2;
+
+    return aligned;
+}
+
+rtp_reorder_t *rtp_reorder_init(unsigned int depth, unsigned int latency
+                                , size_t size)
+{
+    rtp_reorder_t *const r = ASC_ALLOC(1, rtp_reorder_t);
+
+    if (depth > 0)
+        depth = depth_align(depth);
+
+    r->depth = depth;
+    r->max_depth = depth;
+    r->latency = latency * 1000ULL;
+    r->size = size;
+    r->bad_seq = RTP_SEQ_MOD + 1;
+
+    if (depth > 0)
+    {
+        r->slots = ASC_ALLOC(depth, rtp_slot_t);
+        r->data = ASC_ALLOC(depth * size, uint8_t);
+    }
+
+    return r;
+}
+
+void rtp_reorder_destroy(rtp_reorder_t *r)
+{
+    free(r->data);
+    free(r->slots);
+    free(r);
+}
+
+/*
+ * setters and getters
+ */
+
+void rtp_reorder_set_on_packet(rtp_reorder_t *r, rtp_callback_t on_packet)
+{
+    r->on_packet = on_packet;
+}
+
+void rtp_reorder_set_arg(rtp_reorder_t *r, void *arg)
+{
+    r->arg = arg;
+}
+
+void rtp_reorder_set_max_depth(rtp_reorder_t *r, unsigned int max_depth)
+{
+    max_depth = depth_align(max_depth);
+
+    if (r->depth > 0 && max_depth > r->depth)
+        r->max_depth = max_depth;
+}
+
+unsigned int rtp_reorder_depth(const rtp_reorder_t *r)
+{
+    return r->depth;
+}
+
+void rtp_reorder_query(const rtp_reorder_t *r, rtp_reorder_stat_t *out)
+{
+    memcpy(out, &r->stat, sizeof(*out));
+}
+
+/*
+ * sequence number history
+ */
+
+static inline
+bool seen_check(const rtp_reorder_t *r, uint16_t seq)
+{
+    return (r->seen[seq >> 3] & (1 << (seq & 7)));
+}
+
+static inline
+void seen_set(rtp_reorder_t *r, uint16_t seq)
+{
+    r->seen[seq >> 3] |= (1 << (seq & 7));
+}
+
+static inline
+void seen_clear(rtp_reorder_t *r, uint16_t seq)
+{
+    r->seen[seq >> 3] &= ~(1 << (seq & 7));
+}
+
+static void seq_advance(rtp_reorder_t *r, uint16_t seq)
+{
+    /* forget sequence numbers that are now half a cycle behind */
+    while (r->max != seq)
+    {
+        r->max++;
+        seen_clear(r, r->max + (RTP_SEQ_MOD / 2));
+    }
+}
+
+static void seq_start(rtp_reorder_t *r, uint16_t seq)
+{
+    memset(r->seen, 0, sizeof(r->seen));
+
+    r->started = true;
+    r->next = seq;
+    r->max = seq;
+    r->bad_seq = RTP_SEQ_MOD + 1;
+}
+
+/*
+ * reordering
+ */
+
+static inline
+rtp_slot_t *slot_get(rtp_reorder_t *r, uint16_t seq)
+{
+    return &r->slots[seq % r->depth];
+}
+
+static inline
+uint8_t *slot_data(rtp_reorder_t *r, const rtp_slot_t *slot)
+{
+    return &r->data[(slot - r->slots) * r->size];
+}
+
+static void head_advance(rtp_reorder_t *r)
+{
+    rtp_slot_t *const slot = slot_get(r, r->next);
+
+    if (slot->used && slot->seq == r->next)
+    {
+        slot->used = false;
+        r->count--;
+
+        r->on_packet(r->arg, slot_data(r, slot), slot->len);
+    }
+    else
+    {
+        r->stat.lost++;
+    }
+
+    r->next++;
+}
+
+static bool head_expired(rtp_reorder_t *r)
+{
+    if (r->latency == 0)
+        return false;
+
+    /* look for the first datagram queued after the gap */
+    for (unsigned int i = 1; i < r->depth; i++)
+    {
+        const rtp_slot_t *const slot = slot_get(r, r->next + i);
+
+        if (slot->used)
+            return (asc_utime() - slot->time >= r->latency);
+    }
+
+    return false;
+}
+
+static void reorder_grow(rtp_reorder_t *r, unsigned int need)
+{
+    unsigned int depth = r->depth;
+    while (depth <= need && depth < r->max_depth)
+        depth *= 2;
+
+    if (depth > r->max_depth)
+        depth = r->max_depth;
+
+    rtp_slot_t *const slots = ASC_ALLOC(depth, rtp_slot_t);
+    uint8_t *const data = ASC_ALLOC(depth * r->size, uint8_t);
+
+    /*
+     * Queued datagrams lie within the old depth of consecutive sequence
+     * numbers. Both depths are powers of two and divide the sequence
+     * space, so they keep distinct slots across the wrap as well.
+     */
+    for (unsigned int i = 0; i < r->depth; i++)
+    {
+        const rtp_slot_t *const slot = &r->slots[i];
+        if (!slot->used)
+            continue;
+
+        const unsigned int idx = slot->seq % depth;
+        memcpy(&slots[idx], slot, sizeof(*slot));
+        memcpy(&data[idx * r->size], slot_data(r, slot), slot->len);
+    }
+
+    free(r->data);
+    free(r->slots);
+
+    r->slots = slots;
+    r->data = data;
+    r->depth = depth;
+
+    asc_log_debug("[rtp_reorder] buffer grown to %u datagrams", depth);
+}
+
+void rtp_reorder_flush(rtp_reorder_t *r, bool force)
+{
+    while (r->count > 0)
+    {
+        const rtp_slot_t *const slot = slot_get(r, r->next);
+
+        if (!(slot->used && slot->seq == r->next))
+        {
+            /* hole at the head of the queue */
+            if (!force && !head_expired(r))
+                break;
+        }
+
+        head_advance(r);
+    }
+}
+
+void rtp_reorder_reset(rtp_reorder_t *r)
+{
+    for (unsigned int i = 0; i < r->depth; i++)
+        r->slots[i].used = false;
+
+    r->count = 0;
+    r->started = false;
+}
+
+void rtp_reorder_push(rtp_reorder_t *r, const uint8_t *data, size_t len)
+{
+    if (len < RTP_HEADER_SIZE || len > r->size)
+        return;
+
+    const uint16_t seq = RTP_GET_SEQ(data);
+    bool is_behind = false;
+
+    r->stat.received++;
+
+    if (!r->started)
+    {
+        seq_start(r, seq);
+    }
+    else
+    {
+        const uint16_t udelta = seq - r->max;
+        const unsigned int misorder = RTP_MAX_MISORDER + r->depth;
+
+        if (udelta == 0)
+        {
+            is_behind = true;
+        }
+        else if (udelta < RTP_MAX_DROPOUT)
+        {
+            seq_advance(r, seq);
+        }
+        else if (udelta <= RTP_SEQ_MOD - misorder)
+        {
+            /*
+             * Large jump; accept it only if the next datagram confirms
+             * the new sequence. Otherwise it's just a stray packet.
+             */
+            if (seq != r->bad_seq)
+            {
+                r->bad_seq = (uint16_t)(seq + 1);
+                return;
+            }
+
+            rtp_reorder_flush(r, true);
+            rtp_reorder_reset(r);
+            seq_start(r, seq);
+
+            r->stat.resync++;
+        }
+        else
+        {
+            is_behind = true;
+        }
+    }
+
+    if (seen_check(r, seq))
+    {
+        r->stat.duplicate++;
+        return;
+    }
+    seen_set(r, seq);
+
+    const int diff = RTP_SEQ_DIFF(seq, r->next);
+
+    if (r->depth == 0)
+    {
+        /* pass-through; just keep track of the gaps */
+        if (diff >= 0)
+        {
+            r->stat.lost += diff;
+            r->next = seq + 1;
+        }
+        else
+        {
+            r->stat.reordered++;
+            if (r->stat.lost > 0)
+                r->stat.lost--;
+        }
+
+        r->on_packet(r->arg, data, len);
+        return;
+    }
+
+    if (diff < 0)
+    {
+        r->stat.late++;
+        return;
+    }
+
+    if (is_behind)
+        r->stat.reordered++;
+
+    /*
+     * The gap at the head hasn't waited for `latency' yet but the
+     * buffer is full; the stream is faster than the initial depth
+     * allows for.
+     */
+    if (diff >= (int)r->depth && r->depth < r->max_depth
+        && r->count > 0 && !head_expired(r))
+    {
+        reorder_grow(r, diff);
+    }
+
+    /* make room for this datagram */
+    for (int i = diff; i >= (int)r->depth; i--)
+        head_advance(r);
+
+    rtp_slot_t *const slot = slot_get(r, seq);
+
+    if (slot->used)
+    {
+        /* stale datagram that was never delivered */
+        r->stat.lost++;
+        r->count--;
+    }
+
+    slot->time = asc_utime();
+    slot->len = len;
+    slot->seq = seq;
+    slot->used = true;
+    memcpy(slot_data(r, slot), data, len);
+
+    r->count++;
+
+    rtp_reorder_flush(r, false);
+}
@@ -0,0 +1,178 @@
+/*
+ * Astra Module: UDP (RTP helpers)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UDP_RTP_H_
+#define _UDP_RTP_H_ 1
+
+#ifndef _ASTRA_H_
+#   error "Please include <astra.h> first"
+#endif /* !_ASTRA_H_ */
+
+#define RTP_HEADER_SIZE 12
+#define RTP_PT_MP2T 33 /* RFC2250 */
+
+#define RTP_IS_EXT(_data) ((_data[0] & 0x10))
+#define RTP_EXT_SIZE(_data) \
+    (((_data[RTP_HEADER_SIZE + 2] << 8) | _data[RTP_HEADER_SIZE + 3]) * 4 + 4)
+
+#define RTP_GET_PT(_data) ((_data[1] & 0x7F))
+#define RTP_GET_SEQ(_data) ((uint16_t)((_data[2] << 8) | _data[3]))
+#define RTP_GET_TS(_data) \
+    ((uint32_t)((_data[4] << 24) | (_data[5] << 16) | (_data[6] << 8) | _data[7]))
+#define RTP_GET_SSRC(_data) \
+    ((uint32_t)((_data[8] << 24) | (_data[9] << 16) | (_data[10] << 8) | _data[11]))
+
+/* signed distance between two sequence numbers, modulo 2^16 */
+#define RTP_SEQ_DIFF(_a, _b) ((int16_t)((uint16_t)(_a) - (uint16_t)(_b)))
+
+/* returns payload offset, or zero if the datagram is malformed */
+static inline __wur
+size_t rtp_payload_offset(const uint8_t *data, size_t len)
+{
+    size_t off = RTP_HEADER_SIZE + (data[0] & 0x0F) * 4;
+    if (len < off)
+        return 0;
+
+    if (RTP_IS_EXT(data))
+    {
+        if (len < off + 4)
+            return 0;
+
+        off += ((data[off + 2] << 8) | data[off + 3]) * 4 + 4;
+        if (len < off)
+            return 0;
+    }
+
+    return off;
+}
+
+/*
+ * Null packet deletion header extension, after RIST (VSF TR-06-2):
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |       0x52 ('R')      |  0x49 ('I')   |          length = 1           |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |N|E|Size |T|res|0|  NPD bits   |   sequence number extension   |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * Size is the number of TS packets in the original datagram; NPD bit
+ * (6 - i) is set if the i-th of them was a null packet and has been
+ * removed from the payload.
+ */
+#define RTP_NPD_PROFILE 0x5249
+#define RTP_NPD_EXT_SIZE 8
+#define RTP_NPD_MAX_PACKETS 7
+
+static inline
+void rtp_npd_init(uint8_t *data)
+{
+    data[0] |= 0x10;
+    data[RTP_HEADER_SIZE + 0] = (RTP_NPD_PROFILE >> 8) & 0xFF;
+    data[RTP_HEADER_SIZE + 1] = (RTP_NPD_PROFILE) & 0xFF;
+    data[RTP_HEADER_SIZE + 2] = 0x00;
+    data[RTP_HEADER_SIZE + 3] = 0x01;
+}
+
+static inline
+void rtp_npd_set(uint8_t *data, unsigned int count, uint8_t npd)
+{
+    uint8_t *const ext = &data[RTP_HEADER_SIZE + 4];
+
+    ext[0] = 0x80 | ((count & 0x07) << 3);
+    ext[1] = npd & 0x7F;
+    ext[2] = 0x00;
+    ext[3] = 0x00;
+}
+
+/* returns false if the datagram has no null packet deletion extension */
+static inline __wur
+bool rtp_npd_get(const uint8_t *data, size_t len, unsigned int *count
+                 , uint8_t *npd)
+{
+    const size_t off = RTP_HEADER_SIZE + (data[0] & 0x0F) * 4;
+
+    if (!RTP_IS_EXT(data) || len < off + RTP_NPD_EXT_SIZE)
+        return false;
+
+    const uint8_t *const ext = &data[off];
+    if (((ext[0] << 8) | ext[1]) != RTP_NPD_PROFILE
+        || ((ext[2] << 8) | ext[3]) < 1 || !(ext[4] & 0x80))
+    {
+        return false;
+    }
+
+    *count = (ext[4] >> 3) & 0x07;
+    *npd = ext[5] & 0x7F;
+
+    return true;
+}
+
+/* maximum reorder buffer depth, datagrams */
+#define RTP_REORDER_MAX_DEPTH 16384
+
+/*
+ * RTP reorder buffer
+ *
+ * Datagrams are pushed in arrival order and delivered to the callback
+ * in sequence number order. Duplicates are always discarded. With a
+ * non-zero depth, a missing datagram holds back delivery until either
+ * the buffer fills up or the first datagram queued after the gap has
+ * waited for `latency' milliseconds; the gap is then counted as lost.
+ *
+ * Zero depth disables buffering: datagrams are delivered as soon as
+ * they arrive and the buffer only maintains loss statistics. Other
+ * depths are rounded up to a power of two.
+ *
+ * With a maximum depth set, a full buffer whose head gap has not yet
+ * waited for `latency' is reallocated at twice the size instead, so
+ * that the depth follows latency times the stream rate.
+ */
+typedef struct rtp_reorder_t rtp_reorder_t;
+typedef void (*rtp_callback_t)(void *, const uint8_t *, size_t);
+
+typedef struct
+{
+    uint64_t received;  /* valid datagrams, including duplicates */
+    uint64_t lost;      /* gaps that were never filled */
+    uint64_t reordered; /* datagrams that arrived out of order */
+    uint64_t duplicate; /* copies of already received datagrams */
+    uint64_t late;      /* arrived after their gap was given up on */
+    uint64_t resync;    /* sequence number discontinuities */
+} rtp_reorder_stat_t;
+
+rtp_reorder_t *rtp_reorder_init(unsigned int depth, unsigned int latency
+                                , size_t size) __wur;
+void rtp_reorder_destroy(rtp_reorder_t *r);
+
+void rtp_reorder_set_on_packet(rtp_reorder_t *r, rtp_callback_t on_packet);
+void rtp_reorder_set_arg(rtp_reorder_t *r, void *arg);
+void rtp_reorder_set_max_depth(rtp_reorder_t *r, unsigned int max_depth);
+
+unsigned int rtp_reorder_depth(const rtp_reorder_t *r) __func_pure;
+
+void rtp_reorder_push(rtp_reorder_t *r, const uint8_t *data, size_t len);
+void rtp_reorder_flush(rtp_reorder_t *r, bool force);
+void rtp_reorder_reset(rtp_reorder_t *r);
+
+void rtp_reorder_query(const rtp_reorder_t *r, rtp_reorder_stat_t *out);
+
+#endif /* _UDP_RTP_H_ */
@@ -0,0 +1,39 @@
+/*
+ * Astra Module: UDP (common definitions)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _UDP_H_
+#define _UDP_H_ 1
+
+#ifndef _ASTRA_H_
+#   error "Please include <astra.h> first"
+#endif /* !_ASTRA_H_ */
+
+/*
+ * TS packets per datagram. Seven fill a standard 1500 byte Ethernet
+ * frame, 47 fill a 9000 byte jumbo frame.
+ */
+#define UDP_PACKETS 7
+#define UDP_MAX_PACKETS 47
+
+/* buffer size for a datagram of `_n' TS packets, with room for RTP headers */
+#define UDP_DATAGRAM_SIZE(_n) ((size_t)(_n) * TS_PACKET_SIZE + 144)
+
+#endif /* _UDP_H_ */
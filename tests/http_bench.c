@@ -0,0 +1,215 @@
+/*
+ * HTTP request head parser benchmark
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <astra.h>
+#include <stream/http/parser.h>
+
+#define fatal(__fmt, ...) \
+    { \
+        fprintf(stderr, "error: " __fmt "\n", __VA_ARGS__); \
+        exit(1); \
+    }
+
+/* typical channel zap request */
+static const char request_short[] =
+    "GET /play/a012?token=0123456789abcdef HTTP/1.1\r\n"
+    "Host: iptv.example.com:8000\r\n"
+    "User-Agent: Lavf/57.56.100\r\n"
+    "Accept: */*\r\n"
+    "Range: bytes=0-\r\n"
+    "Connection: close\r\n"
+    "Icy-MetaData: 1\r\n"
+    "\r\n";
+
+/* browser request with cookies */
+static const char request_long[] =
+    "GET /playlist.m3u8 HTTP/1.1\r\n"
+    "Host: iptv.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36"
+        " (KHTML, like Gecko) Chrome/53.0.2785.116 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9"
+        ",image/webp,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, sdch\r\n"
+    "Accept-Language: en-US,en;q=0.8,ru;q=0.6\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Referer: http://iptv.example.com/portal/index.html?section=tv\r\n"
+    "Cookie: session=3b6c1e0f9a2d4c8e8f7a6b5c4d3e2f1a; lang=en"
+        "; theme=dark; last_channel=a012; volume=80"
+        "; _ga=GA1.2.1234567890.1234567890; _gid=GA1.2.0987654321.0987654321\r\n"
+    "DNT: 1\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "X-Forwarded-For: 192.0.2.1, 198.51.100.2\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+typedef size_t (*bench_func_t)(const char *, size_t, size_t);
+
+/* previous approach: look for CRLFCRLF from the start on every read */
+static size_t parse_legacy(const char *str, size_t size, size_t step)
+{
+    size_t count = 0;
+    size_t eoh = 0;
+
+    for (size_t fill = step; eoh == 0; fill += step)
+    {
+        if (fill > size)
+            fill = size;
+
+        for (size_t skip = 0; skip + 4 <= fill; skip++)
+        {
+            if (str[skip + 0] == '\r' && str[skip + 1] == '\n'
+                && str[skip + 2] == '\r' && str[skip + 3] == '\n')
+            {
+                eoh = skip + 4;
+                break;
+            }
+        }
+    }
+
+    parse_match_t m[4];
+    if (!http_parse_request(str, eoh, m))
+        fatal("%s", "failed to parse request line");
+
+    size_t skip = m[0].eo;
+    while (skip < eoh)
+    {
+        if (!http_parse_header(&str[skip], eoh - skip, m))
+            fatal("%s", "failed to parse header");
+
+        skip += m[0].eo;
+        if (m[1].eo == 0)
+            break;
+
+        count++;
+    }
+
+    return count;
+}
+
+/* incremental scanner */
+static size_t parse_scan(const char *str, size_t size, size_t step)
+{
+    static http_scan_t scan;
+    http_scan_reset(&scan);
+
+    for (size_t fill = step; scan.eoh == 0; fill += step)
+    {
+        if (fill > size)
+            fill = size;
+
+        if (!http_scan_head(&scan, str, fill))
+            fatal("%s", "too many lines");
+    }
+
+    parse_match_t m[4];
+    if (!http_parse_request(str, scan.line[1].so, m))
+        fatal("%s", "failed to parse request line");
+
+    return scan.count - 1;
+}
+
+static void verify(const char *str, size_t size)
+{
+    http_scan_t scan;
+    http_scan_reset(&scan);
+
+    if (!http_scan_head(&scan, str, size) || scan.eoh != size)
+        fatal("%s", "scanner did not find end of head");
+
+    parse_match_t m[4];
+    if (!http_parse_request(str, size, m) || m[0].eo != scan.line[1].so)
+        fatal("%s", "request line mismatch");
+
+    size_t skip = m[0].eo;
+    for (unsigned int i = 1; i < scan.count; i++)
+    {
+        const http_scan_line_t *const line = &scan.line[i];
+
+        if (!http_parse_header(&str[skip], size - skip, m)
+            || skip + m[1].eo != line->delim
+            || skip + m[2].eo != line->eo)
+        {
+            fatal("header %u mismatch", i);
+        }
+
+        skip += m[0].eo;
+    }
+}
+
+static void run(const char *name, bench_func_t func, const char *str
+                , size_t size, size_t step, unsigned int loops)
+{
+    size_t count = 0;
+
+    const uint64_t start = asc_utime();
+    for (unsigned int i = 0; i < loops; i++)
+        count += func(str, size, step);
+    const uint64_t elapsed = asc_utime() - start;
+
+    printf("%-8s %5zu bytes, %4zu per read: %8.1f ns/request (%zu headers)\n"
+           , name, size, step, (elapsed * 1000.0) / loops, count / loops);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int loops = 200000;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (c)
+        {
+            case 'n':
+                loops = atoi(optarg);
+                break;
+
+            default:
+                fatal("usage: %s [-n <loops>]", argv[0]);
+        }
+    }
+
+    if (loops == 0)
+        fatal("%s", "invalid loop count");
+
+    static const struct
+    {
+        const char *str;
+        size_t size;
+    } list[] = {
+        { request_short, sizeof(request_short) - 1 },
+        { request_long, sizeof(request_long) - 1 },
+    };
+
+    static const size_t steps[] = { 0, 256, 64 };
+
+    for (size_t i = 0; i < ASC_ARRAY_SIZE(list); i++)
+    {
+        verify(list[i].str, list[i].size);
+
+        for (size_t j = 0; j < ASC_ARRAY_SIZE(steps); j++)
+        {
+            const size_t step = (steps[j] > 0) ? steps[j] : list[i].size;
+
+            run("legacy", parse_legacy, list[i].str, list[i].size, step, loops);
+            run("scan", parse_scan, list[i].str, list[i].size, step, loops);
+        }
+    }
+
+    return 0;
+}
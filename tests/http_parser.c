@@ -0,0 +1,135 @@
+/*
+ * Astra: Unit tests
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unit_tests.h"
+#include <stream/http/parser.h>
+
+static void setup(void)
+{
+    lib_setup();
+}
+
+static void teardown(void)
+{
+    lib_teardown();
+}
+
+static int range(const char *value, off_t size, off_t *first, off_t *last)
+{
+    *first = -1;
+    *last = -1;
+
+    return http_parse_range(value, size, first, last);
+}
+
+START_TEST(range_valid)
+{
+    off_t first, last;
+
+    ck_assert(range("bytes=0-499", 1000, &first, &last) == 1);
+    ck_assert(first == 0 && last == 499);
+
+    ck_assert(range("bytes=500-", 1000, &first, &last) == 1);
+    ck_assert(first == 500 && last == 999);
+
+    ck_assert(range("bytes=999-999", 1000, &first, &last) == 1);
+    ck_assert(first == 999 && last == 999);
+
+    ck_assert(range("BYTES=0-0", 1000, &first, &last) == 1);
+    ck_assert(first == 0 && last == 0);
+
+    /* last byte past the end is clamped */
+    ck_assert(range("bytes=900-5000", 1000, &first, &last) == 1);
+    ck_assert(first == 900 && last == 999);
+}
+END_TEST
+
+START_TEST(range_suffix)
+{
+    off_t first, last;
+
+    ck_assert(range("bytes=-200", 1000, &first, &last) == 1);
+    ck_assert(first == 800 && last == 999);
+
+    ck_assert(range("bytes=-1000", 1000, &first, &last) == 1);
+    ck_assert(first == 0 && last == 999);
+
+    ck_assert(range("bytes=-2000", 1000, &first, &last) == 1);
+    ck_assert(first == 0 && last == 999);
+}
+END_TEST
+
+START_TEST(range_unsatisfiable)
+{
+    off_t first, last;
+
+    ck_assert(range("bytes=1000-", 1000, &first, &last) == -1);
+    ck_assert(range("bytes=1000-2000", 1000, &first, &last) == -1);
+    ck_assert(range("bytes=-0", 1000, &first, &last) == -1);
+
+    ck_assert(range("bytes=0-", 0, &first, &last) == -1);
+    ck_assert(range("bytes=-5", 0, &first, &last) == -1);
+}
+END_TEST
+
+START_TEST(range_ignored)
+{
+    static const char *const list[] = {
+        "",
+        "bytes",
+        "bytes=",
+        "bytes=-",
+        "bytes=abc",
+        "bytes=1-2x",
+        "bytes= 1-2",
+        "bytes=5-4",
+        "bytes=0-1,5-6",
+        "items=0-1",
+        "bytes=1234567890123456789-",
+        "bytes=-1234567890123456789",
+    };
+
+    for (size_t i = 0; i < ASC_ARRAY_SIZE(list); i++)
+    {
+        off_t first, last;
+
+        ck_assert_msg(range(list[i], 1000, &first, &last) == 0
+                      , "'%s' was not ignored", list[i]);
+        ck_assert(first == -1 && last == -1);
+    }
+}
+END_TEST
+
+Suite *http_parser(void)
+{
+    Suite *const s = suite_create("http_parser");
+
+    TCase *const tc = tcase_create("range");
+    tcase_add_checked_fixture(tc, setup, teardown);
+
+    tcase_add_test(tc, range_valid);
+    tcase_add_test(tc, range_suffix);
+    tcase_add_test(tc, range_unsatisfiable);
+    tcase_add_test(tc, range_ignored);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -0,0 +1,153 @@
+/*
+ * Astra: Unit tests
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unit_tests.h"
+#include <stream/http/route.h>
+
+static http_route_t *table = NULL;
+
+static int r1, r2, r3, r4;
+
+static void setup(void)
+{
+    lib_setup();
+    table = http_route_init();
+}
+
+static void teardown(void)
+{
+    ASC_FREE(table, http_route_destroy);
+    lib_teardown();
+}
+
+START_TEST(empty_table)
+{
+    ck_assert(http_route_find(table, "/") == NULL);
+    ck_assert(http_route_find(table, "") == NULL);
+}
+END_TEST
+
+START_TEST(exact_match)
+{
+    ck_assert(http_route_add(table, "/", &r1));
+    ck_assert(http_route_add(table, "/play", &r2));
+    ck_assert(http_route_add(table, "/play/ch1", &r3));
+
+    ck_assert(http_route_find(table, "/") == &r1);
+    ck_assert(http_route_find(table, "/play") == &r2);
+    ck_assert(http_route_find(table, "/play/ch1") == &r3);
+
+    ck_assert(http_route_find(table, "/pla") == NULL);
+    ck_assert(http_route_find(table, "/play/") == NULL);
+    ck_assert(http_route_find(table, "/play/ch10") == NULL);
+}
+END_TEST
+
+START_TEST(prefix_match)
+{
+    ck_assert(http_route_add(table, "/play/*", &r1));
+
+    /* trailing '*' matches any remainder, including an empty one */
+    ck_assert(http_route_find(table, "/play/") == &r1);
+    ck_assert(http_route_find(table, "/play/ch1") == &r1);
+    ck_assert(http_route_find(table, "/play/a/b/c") == &r1);
+
+    ck_assert(http_route_find(table, "/play") == NULL);
+    ck_assert(http_route_find(table, "/player") == NULL);
+}
+END_TEST
+
+START_TEST(segment_match)
+{
+    ck_assert(http_route_add(table, "/hls/*/index.m3u8", &r1));
+    ck_assert(http_route_add(table, "/*/*/x", &r2));
+
+    ck_assert(http_route_find(table, "/hls/ch1/index.m3u8") == &r1);
+    ck_assert(http_route_find(table, "/hls/a.b-c/index.m3u8") == &r1);
+
+    /* one non-empty segment, no more */
+    ck_assert(http_route_find(table, "/hls//index.m3u8") == NULL);
+    ck_assert(http_route_find(table, "/hls/a/b/index.m3u8") == NULL);
+    ck_assert(http_route_find(table, "/hls/ch1/index.m3u8x") == NULL);
+
+    ck_assert(http_route_find(table, "/a/b/x") == &r2);
+    ck_assert(http_route_find(table, "/a/b/y") == NULL);
+}
+END_TEST
+
+START_TEST(bad_pattern)
+{
+    /* '*' must be the last character or followed by '/' */
+    ck_assert(!http_route_add(table, "/play*.ts", &r1));
+    ck_assert(!http_route_add(table, "/**", &r1));
+    ck_assert(http_route_add(table, "*", &r2));
+
+    ck_assert(http_route_find(table, "/anything") == &r2);
+}
+END_TEST
+
+START_TEST(first_wins)
+{
+    /* configuration order decides, not specificity */
+    ck_assert(http_route_add(table, "/a/*", &r1));
+    ck_assert(http_route_add(table, "/a/b", &r2));
+    ck_assert(http_route_add(table, "/*/c", &r3));
+    ck_assert(http_route_add(table, "*", &r4));
+
+    ck_assert(http_route_find(table, "/a/b") == &r1);
+    ck_assert(http_route_find(table, "/a/c") == &r1);
+    ck_assert(http_route_find(table, "/b/c") == &r3);
+    ck_assert(http_route_find(table, "/b/d") == &r4);
+
+    /* duplicates keep the first entry */
+    ck_assert(http_route_add(table, "/a/*", &r4));
+    ck_assert(http_route_find(table, "/a/x") == &r1);
+}
+END_TEST
+
+START_TEST(specific_first)
+{
+    ck_assert(http_route_add(table, "/a/b", &r1));
+    ck_assert(http_route_add(table, "/a/*", &r2));
+
+    ck_assert(http_route_find(table, "/a/b") == &r1);
+    ck_assert(http_route_find(table, "/a/bb") == &r2);
+}
+END_TEST
+
+Suite *http_route(void)
+{
+    Suite *const s = suite_create("http_route");
+
+    TCase *const tc = tcase_create("default");
+    tcase_add_checked_fixture(tc, setup, teardown);
+
+    tcase_add_test(tc, empty_table);
+    tcase_add_test(tc, exact_match);
+    tcase_add_test(tc, prefix_match);
+    tcase_add_test(tc, segment_match);
+    tcase_add_test(tc, bad_pattern);
+    tcase_add_test(tc, first_wins);
+    tcase_add_test(tc, specific_first);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -0,0 +1,146 @@
+/*
+ * Astra: Unit tests
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unit_tests.h"
+#include <stream/http/shaper.h>
+
+#define T0 1000000000ULL
+
+static http_shaper_t shaper;
+
+static void setup(void)
+{
+    lib_setup();
+    memset(&shaper, 0, sizeof(shaper));
+}
+
+static void teardown(void)
+{
+    lib_teardown();
+}
+
+START_TEST(unlimited)
+{
+    ck_assert(http_shaper_get(&shaper, T0) == SIZE_MAX);
+
+    http_shaper_put(&shaper, 1000000);
+    ck_assert(http_shaper_get(&shaper, T0) == SIZE_MAX);
+    ck_assert(http_shaper_delay(&shaper, 1000000) == 0);
+}
+END_TEST
+
+START_TEST(bucket_size)
+{
+    /* HTTP_SHAPER_DEPTH milliseconds of traffic */
+    http_shaper_set_rate(&shaper, 1000000);
+    ck_assert(shaper.size == 1000000 * HTTP_SHAPER_DEPTH / 1000);
+
+    /* but always room for a couple of sends */
+    http_shaper_set_rate(&shaper, 1000);
+    ck_assert(shaper.size == 2 * HTTP_SHAPER_CHUNK);
+}
+END_TEST
+
+START_TEST(refill)
+{
+    http_shaper_set_rate(&shaper, 1000000);
+    const size_t size = shaper.size;
+
+    /* starts full */
+    ck_assert(http_shaper_get(&shaper, T0) == size);
+
+    http_shaper_put(&shaper, size);
+    ck_assert(http_shaper_get(&shaper, T0) == 0);
+
+    /* 1 byte per microsecond */
+    ck_assert(http_shaper_get(&shaper, T0 + 10000) == 10000);
+    http_shaper_put(&shaper, 4000);
+    ck_assert(http_shaper_get(&shaper, T0 + 10000) == 6000);
+
+    /* never more than the bucket holds */
+    ck_assert(http_shaper_get(&shaper, T0 + 10000000) == size);
+
+    /* putting more than available empties the bucket */
+    http_shaper_put(&shaper, size * 2);
+    ck_assert(http_shaper_get(&shaper, T0 + 10000000) == 0);
+}
+END_TEST
+
+START_TEST(fractional_refill)
+{
+    /* 1 byte every 3 microseconds */
+    http_shaper_set_rate(&shaper, 333333);
+    ck_assert(http_shaper_get(&shaper, T0) == shaper.size);
+    http_shaper_put(&shaper, shaper.size);
+
+    /* frequent polls don't lose fractional tokens */
+    uint64_t now = T0;
+    for (unsigned int i = 0; i < 3000; i++)
+        ck_assert(http_shaper_get(&shaper, ++now) <= 1000);
+
+    const size_t tokens = http_shaper_get(&shaper, now);
+    ck_assert(tokens >= 999 && tokens <= 1000);
+}
+END_TEST
+
+START_TEST(delay)
+{
+    http_shaper_set_rate(&shaper, 1000000);
+    ck_assert(http_shaper_get(&shaper, T0) == shaper.size);
+    ck_assert(http_shaper_delay(&shaper, shaper.size) == 0);
+
+    http_shaper_put(&shaper, shaper.size);
+    ck_assert(http_shaper_delay(&shaper, 16000) == 17);
+
+    /* capped at a second */
+    http_shaper_set_rate(&shaper, 1000);
+    ck_assert(http_shaper_delay(&shaper, HTTP_SHAPER_CHUNK) == 1000);
+}
+END_TEST
+
+START_TEST(rate_change)
+{
+    http_shaper_set_rate(&shaper, 10000000);
+    ck_assert(http_shaper_get(&shaper, T0) == 1000000);
+
+    /* lower rate shrinks the bucket and what's in it */
+    http_shaper_set_rate(&shaper, 1000000);
+    ck_assert(http_shaper_get(&shaper, T0) == 100000);
+}
+END_TEST
+
+Suite *http_shaper(void)
+{
+    Suite *const s = suite_create("http_shaper");
+
+    TCase *const tc = tcase_create("default");
+    tcase_add_checked_fixture(tc, setup, teardown);
+
+    tcase_add_test(tc, unlimited);
+    tcase_add_test(tc, bucket_size);
+    tcase_add_test(tc, refill);
+    tcase_add_test(tc, fractional_refill);
+    tcase_add_test(tc, delay);
+    tcase_add_test(tc, rate_change);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -0,0 +1,297 @@
+/*
+ * Astra: Unit tests
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unit_tests.h"
+#include <stream/udp/fec.h>
+
+#define COLS 5
+#define ROWS 4
+#define MEDIA_COUNT (COLS * ROWS)
+
+#define PAYLOAD_SIZE (7 * 188)
+#define DATAGRAM_SIZE (RTP_HEADER_SIZE + FEC_HEADER_SIZE + PAYLOAD_SIZE)
+
+typedef struct
+{
+    uint8_t data[DATAGRAM_SIZE];
+    size_t len;
+} datagram_t;
+
+static datagram_t media[MEDIA_COUNT];
+static datagram_t col_fec[COLS];
+static unsigned int col_count;
+static datagram_t row_fec[ROWS];
+static unsigned int row_count;
+
+static datagram_t recovered[MEDIA_COUNT];
+static unsigned int recovered_count;
+
+static rtp_fec_enc_t *enc = NULL;
+static rtp_fec_dec_t *dec = NULL;
+
+static void store(datagram_t *dg, const uint8_t *data, size_t len)
+{
+    ck_assert(len <= sizeof(dg->data));
+
+    memcpy(dg->data, data, len);
+    dg->len = len;
+}
+
+static void on_column(void *arg, const uint8_t *data, size_t len)
+{
+    __uarg(arg);
+
+    ck_assert(col_count < COLS);
+    store(&col_fec[col_count++], data, len);
+}
+
+static void on_row(void *arg, const uint8_t *data, size_t len)
+{
+    __uarg(arg);
+
+    ck_assert(row_count < ROWS);
+    store(&row_fec[row_count++], data, len);
+}
+
+static void on_recovered(void *arg, const uint8_t *data, size_t len)
+{
+    __uarg(arg);
+
+    ck_assert(recovered_count < MEDIA_COUNT);
+    store(&recovered[recovered_count++], data, len);
+}
+
+/* random payload; lengths differ so the length recovery is exercised */
+static void media_init(uint16_t base)
+{
+    const uint32_t ssrc = rand();
+
+    for (unsigned int i = 0; i < MEDIA_COUNT; i++)
+    {
+        datagram_t *const dg = &media[i];
+        const uint16_t seq = base + i;
+        const uint32_t ts = 90000 + i * 3000;
+
+        dg->len = RTP_HEADER_SIZE + PAYLOAD_SIZE - (i % 3) * 188;
+
+        dg->data[0] = 0x80;
+        dg->data[1] = RTP_PT_MP2T;
+        dg->data[2] = (seq >> 8) & 0xFF;
+        dg->data[3] = (seq     ) & 0xFF;
+        dg->data[4] = (ts >> 24) & 0xFF;
+        dg->data[5] = (ts >> 16) & 0xFF;
+        dg->data[6] = (ts >>  8) & 0xFF;
+        dg->data[7] = (ts      ) & 0xFF;
+        dg->data[8] = (ssrc >> 24) & 0xFF;
+        dg->data[9] = (ssrc >> 16) & 0xFF;
+        dg->data[10] = (ssrc >> 8) & 0xFF;
+        dg->data[11] = (ssrc     ) & 0xFF;
+
+        for (size_t j = RTP_HEADER_SIZE; j < dg->len; j++)
+            dg->data[j] = rand();
+    }
+}
+
+static void encode(bool row)
+{
+    enc = rtp_fec_enc_init(COLS, ROWS, row, PAYLOAD_SIZE);
+    rtp_fec_enc_set_on_column(enc, on_column);
+    rtp_fec_enc_set_on_row(enc, on_row);
+
+    for (unsigned int i = 0; i < MEDIA_COUNT; i++)
+        rtp_fec_enc_push(enc, media[i].data, media[i].len);
+
+    ck_assert(col_count == COLS);
+    ck_assert(row_count == ((row) ? ROWS : 0));
+}
+
+/* feed the decoder everything but the datagrams in `lost' */
+static void decode(const unsigned int *lost, size_t lost_count)
+{
+    dec = rtp_fec_dec_init(DATAGRAM_SIZE);
+    rtp_fec_dec_set_on_packet(dec, on_recovered);
+
+    for (unsigned int i = 0; i < MEDIA_COUNT; i++)
+    {
+        bool is_lost = false;
+        for (size_t j = 0; j < lost_count; j++)
+            is_lost |= (lost[j] == i);
+
+        if (!is_lost)
+            rtp_fec_dec_media(dec, media[i].data, media[i].len);
+    }
+
+    for (unsigned int i = 0; i < row_count; i++)
+        rtp_fec_dec_push(dec, row_fec[i].data, row_fec[i].len);
+
+    for (unsigned int i = 0; i < col_count; i++)
+        rtp_fec_dec_push(dec, col_fec[i].data, col_fec[i].len);
+}
+
+static void check_recovered(unsigned int idx)
+{
+    const uint16_t seq = RTP_GET_SEQ(media[idx].data);
+
+    for (unsigned int i = 0; i < recovered_count; i++)
+    {
+        const datagram_t *const dg = &recovered[i];
+        if (RTP_GET_SEQ(dg->data) != seq)
+            continue;
+
+        ck_assert(dg->len == media[idx].len);
+        ck_assert(!memcmp(dg->data, media[idx].data, dg->len));
+        return;
+    }
+
+    ck_abort_msg("datagram %u was not recovered", idx);
+}
+
+static void setup(void)
+{
+    lib_setup();
+
+    col_count = 0;
+    row_count = 0;
+    recovered_count = 0;
+}
+
+static void teardown(void)
+{
+    ASC_FREE(enc, rtp_fec_enc_destroy);
+    ASC_FREE(dec, rtp_fec_dec_destroy);
+
+    lib_teardown();
+}
+
+START_TEST(no_loss)
+{
+    media_init(100);
+    encode(true);
+    decode(NULL, 0);
+
+    ck_assert(recovered_count == 0);
+
+    rtp_fec_dec_stat_t st;
+    rtp_fec_dec_query(dec, &st);
+    ck_assert(st.received == COLS + ROWS);
+    ck_assert(st.recovered == 0);
+}
+END_TEST
+
+START_TEST(column_loss)
+{
+    /* one datagram in each column */
+    static const unsigned int lost[] = { 0, 6, 12, 18, 19 };
+
+    media_init(65530);
+    encode(false);
+    decode(lost, ASC_ARRAY_SIZE(lost));
+
+    ck_assert(recovered_count == ASC_ARRAY_SIZE(lost));
+    for (size_t i = 0; i < ASC_ARRAY_SIZE(lost); i++)
+        check_recovered(lost[i]);
+}
+END_TEST
+
+START_TEST(burst_loss)
+{
+    /* a whole row; columns alone are enough */
+    static const unsigned int lost[] = { 5, 6, 7, 8, 9 };
+
+    media_init(2000);
+    encode(false);
+    decode(lost, ASC_ARRAY_SIZE(lost));
+
+    ck_assert(recovered_count == ASC_ARRAY_SIZE(lost));
+    for (size_t i = 0; i < ASC_ARRAY_SIZE(lost); i++)
+        check_recovered(lost[i]);
+}
+END_TEST
+
+START_TEST(row_and_column)
+{
+    /*
+     * Two losses in column 1 can't be fixed by the column, but each
+     * is alone in its row; the row fixes one, then the column the other.
+     */
+    static const unsigned int lost[] = { 1, 11 };
+
+    media_init(3000);
+    encode(true);
+    decode(lost, ASC_ARRAY_SIZE(lost));
+
+    ck_assert(recovered_count == ASC_ARRAY_SIZE(lost));
+    for (size_t i = 0; i < ASC_ARRAY_SIZE(lost); i++)
+        check_recovered(lost[i]);
+}
+END_TEST
+
+START_TEST(unrecoverable)
+{
+    /* two losses in the same column, no row FEC */
+    static const unsigned int lost[] = { 2, 7 };
+
+    media_init(4000);
+    encode(false);
+    decode(lost, ASC_ARRAY_SIZE(lost));
+
+    ck_assert(recovered_count == 0);
+}
+END_TEST
+
+START_TEST(parse_opts)
+{
+    unsigned int cols = 0, rows = 0;
+
+    ck_assert(rtp_fec_parse_opts("5,10", &cols, &rows));
+    ck_assert(cols == 5 && rows == 10);
+
+    ck_assert(rtp_fec_parse_opts("1,4", &cols, &rows));
+    ck_assert(rtp_fec_parse_opts("20,5", &cols, &rows));
+
+    ck_assert(!rtp_fec_parse_opts("", &cols, &rows));
+    ck_assert(!rtp_fec_parse_opts("5", &cols, &rows));
+    ck_assert(!rtp_fec_parse_opts("5,", &cols, &rows));
+    ck_assert(!rtp_fec_parse_opts("5,10x", &cols, &rows));
+    ck_assert(!rtp_fec_parse_opts("0,10", &cols, &rows));
+    ck_assert(!rtp_fec_parse_opts("5,3", &cols, &rows));
+    ck_assert(!rtp_fec_parse_opts("21,4", &cols, &rows));
+    ck_assert(!rtp_fec_parse_opts("20,6", &cols, &rows));
+}
+END_TEST
+
+Suite *udp_fec(void)
+{
+    Suite *const s = suite_create("udp_fec");
+
+    TCase *const tc = tcase_create("default");
+    tcase_add_checked_fixture(tc, setup, teardown);
+
+    tcase_add_test(tc, no_loss);
+    tcase_add_test(tc, column_loss);
+    tcase_add_test(tc, burst_loss);
+    tcase_add_test(tc, row_and_column);
+    tcase_add_test(tc, unrecoverable);
+    tcase_add_test(tc, parse_opts);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
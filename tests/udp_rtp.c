@@ -0,0 +1,287 @@
+/*
+ * Astra: Unit tests
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2016, Artem Kharitonov <artem@3phase.pw>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unit_tests.h"
+#include <stream/udp/rtp.h>
+
+#define PAYLOAD_SIZE 188
+#define DATAGRAM_SIZE (RTP_HEADER_SIZE + PAYLOAD_SIZE)
+
+static rtp_reorder_t *reorder = NULL;
+
+/* sequence numbers in delivery order */
+static uint16_t delivered[4096];
+static unsigned int delivered_count;
+
+static void on_packet(void *arg, const uint8_t *data, size_t len)
+{
+    __uarg(arg);
+
+    ck_assert(len == DATAGRAM_SIZE);
+    ck_assert(data[RTP_HEADER_SIZE] == (RTP_GET_SEQ(data) & 0xFF));
+    ck_assert(delivered_count < ASC_ARRAY_SIZE(delivered));
+
+    delivered[delivered_count++] = RTP_GET_SEQ(data);
+}
+
+static void push(uint16_t seq)
+{
+    uint8_t data[DATAGRAM_SIZE];
+    memset(data, 0, sizeof(data));
+
+    data[0] = 0x80;
+    data[1] = RTP_PT_MP2T;
+    data[2] = (seq >> 8) & 0xFF;
+    data[3] = (seq     ) & 0xFF;
+    data[RTP_HEADER_SIZE] = seq & 0xFF;
+
+    rtp_reorder_push(reorder, data, sizeof(data));
+}
+
+static void reorder_init(unsigned int depth, unsigned int latency)
+{
+    reorder = rtp_reorder_init(depth, latency, DATAGRAM_SIZE);
+    rtp_reorder_set_on_packet(reorder, on_packet);
+    rtp_reorder_set_arg(reorder, NULL);
+}
+
+static void check_delivered(uint16_t first, unsigned int count)
+{
+    ck_assert(delivered_count == count);
+    for (unsigned int i = 0; i < count; i++)
+        ck_assert(delivered[i] == (uint16_t)(first + i));
+}
+
+static void setup(void)
+{
+    lib_setup();
+    delivered_count = 0;
+}
+
+static void teardown(void)
+{
+    ASC_FREE(reorder, rtp_reorder_destroy);
+    lib_teardown();
+}
+
+START_TEST(in_order)
+{
+    reorder_init(16, 1000);
+
+    for (unsigned int i = 0; i < 100; i++)
+        push(1000 + i);
+
+    check_delivered(1000, 100);
+
+    rtp_reorder_stat_t st;
+    rtp_reorder_query(reorder, &st);
+    ck_assert(st.received == 100);
+    ck_assert(st.lost == 0 && st.reordered == 0 && st.duplicate == 0);
+}
+END_TEST
+
+START_TEST(out_of_order)
+{
+    reorder_init(16, 1000);
+
+    static const uint16_t order[] = { 10, 12, 11, 13, 16, 15, 14, 17 };
+    for (size_t i = 0; i < ASC_ARRAY_SIZE(order); i++)
+        push(order[i]);
+
+    check_delivered(10, 8);
+
+    rtp_reorder_stat_t st;
+    rtp_reorder_query(reorder, &st);
+    ck_assert(st.reordered == 3);
+    ck_assert(st.lost == 0);
+}
+END_TEST
+
+START_TEST(duplicate)
+{
+    reorder_init(16, 1000);
+
+    push(1);
+    push(2);
+    push(2);
+    push(1);
+    push(3);
+
+    check_delivered(1, 3);
+
+    rtp_reorder_stat_t st;
+    rtp_reorder_query(reorder, &st);
+    ck_assert(st.duplicate == 2);
+    ck_assert(st.received == 5);
+}
+END_TEST
+
+START_TEST(wrap_around)
+{
+    reorder_init(16, 1000);
+
+    push(65534);
+    push(0);
+    push(65535);
+    push(1);
+
+    check_delivered(65534, 4);
+}
+END_TEST
+
+START_TEST(wrap_odd_depth)
+{
+    reorder_init(200, 60000);
+    ck_assert(rtp_reorder_depth(reorder) == 256);
+
+    for (unsigned int i = 65490; i < 65500; i++)
+        push(i);
+
+    /* a gap at 65500 holds datagrams on both sides of the wrap */
+    for (unsigned int i = 65501; i < 65536; i++)
+        push(i);
+    for (unsigned int i = 0; i <= 140; i++)
+        push(i);
+
+    ck_assert(delivered_count == 10);
+
+    rtp_reorder_flush(reorder, true);
+    ck_assert(delivered_count == 10 + 35 + 141);
+    ck_assert(delivered[10] == 65501);
+    ck_assert(delivered[45] == 0);
+    ck_assert(delivered[delivered_count - 1] == 140);
+
+    rtp_reorder_stat_t st;
+    rtp_reorder_query(reorder, &st);
+    ck_assert(st.lost == 1);
+}
+END_TEST
+
+START_TEST(gap_full)
+{
+    /* no latency; the gap is only given up when the buffer fills */
+    reorder_init(8, 0);
+
+    push(0);
+    for (unsigned int i = 2; i < 9; i++)
+        push(i);
+
+    ck_assert(delivered_count == 1);
+
+    push(9);
+    ck_assert(delivered_count == 9);
+    ck_assert(delivered[1] == 2 && delivered[8] == 9);
+
+    /* too late to be delivered */
+    push(1);
+    ck_assert(delivered_count == 9);
+
+    rtp_reorder_stat_t st;
+    rtp_reorder_query(reorder, &st);
+    ck_assert(st.lost == 1);
+    ck_assert(st.late == 1);
+}
+END_TEST
+
+START_TEST(flush_force)
+{
+    reorder_init(16, 1000);
+
+    push(0);
+    push(2);
+    push(3);
+    ck_assert(delivered_count == 1);
+
+    rtp_reorder_flush(reorder, false);
+    ck_assert(delivered_count == 1);
+
+    rtp_reorder_flush(reorder, true);
+    ck_assert(delivered_count == 3);
+}
+END_TEST
+
+START_TEST(grow)
+{
+    reorder_init(4, 60000);
+    rtp_reorder_set_max_depth(reorder, 64);
+
+    /* the gap hasn't waited for `latency', so nothing is dropped */
+    push(0);
+    for (unsigned int i = 2; i < 40; i++)
+        push(i);
+
+    ck_assert(delivered_count == 1);
+    ck_assert(rtp_reorder_depth(reorder) == 64);
+
+    push(1);
+    check_delivered(0, 40);
+
+    /* and no further than the maximum */
+    push(41);
+    for (unsigned int i = 42; i < 120; i++)
+        push(i);
+
+    ck_assert(rtp_reorder_depth(reorder) == 64);
+
+    rtp_reorder_stat_t st;
+    rtp_reorder_query(reorder, &st);
+    ck_assert(st.lost == 1);
+}
+END_TEST
+
+START_TEST(pass_through)
+{
+    reorder_init(0, 0);
+
+    push(5);
+    push(7);
+    push(6);
+
+    ck_assert(delivered_count == 3);
+    ck_assert(delivered[0] == 5 && delivered[1] == 7 && delivered[2] == 6);
+
+    rtp_reorder_stat_t st;
+    rtp_reorder_query(reorder, &st);
+    ck_assert(st.lost == 0);
+    ck_assert(st.reordered == 1);
+}
+END_TEST
+
+Suite *udp_rtp(void)
+{
+    Suite *const s = suite_create("udp_rtp");
+
+    TCase *const tc = tcase_create("reorder");
+    tcase_add_checked_fixture(tc, setup, teardown);
+
+    tcase_add_test(tc, in_order);
+    tcase_add_test(tc, out_of_order);
+    tcase_add_test(tc, duplicate);
+    tcase_add_test(tc, wrap_around);
+    tcase_add_test(tc, wrap_odd_depth);
+    tcase_add_test(tc, gap_full);
+    tcase_add_test(tc, flush_force);
+    tcase_add_test(tc, grow);
+    tcase_add_test(tc, pass_through);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -40,6 +40,19 @@ Suite *core_child(void);
 Suite *core_thread(void);
 Suite *core_timer(void);
 
+/* http */
+#ifdef HAVE_STREAM_HTTP
+Suite *http_parser(void);
+Suite *http_route(void);
+Suite *http_shaper(void);
+#endif
+
+/* udp */
+#ifdef HAVE_STREAM_UDP
+Suite *udp_fec(void);
+Suite *udp_rtp(void);
+#endif
+
 /* unit test list */
 typedef Suite (*(*const suite_func_t)(void));
 
@@ -54,6 +67,19 @@ static suite_func_t suite_list[] = {
     core_thread,
     core_timer,
 
+#ifdef HAVE_STREAM_HTTP
+    /* http */
+    http_parser,
+    http_route,
+    http_shaper,
+#endif
+
+#ifdef HAVE_STREAM_UDP
+    /* udp */
+    udp_fec,
+    udp_rtp,
+#endif
+
     NULL,
 };
 